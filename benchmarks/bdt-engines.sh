@@ -0,0 +1,22 @@
+#!/bin/bash
+# Benchmark of the BDT inference engines: TMVA reader parsing the weight file, compiled plugin and native forest
+# engine. Only the BDT weight file and the preprocessing file are copied to the benchmark folder, so the timings
+# do not include other methods. Native engine run also checks its scores against the TMVA reader.
+# Usage: benchmarks/bdt-engines.sh <executable> <weight-dir> <test-dir>
+# Logs are written to ./benchmark-bdt-engines
+
+source "$(dirname "$0")/common.sh"
+
+EXE=$(realpath "$1"); WEIGHT=$(realpath "$2"); TEST=$(realpath "$3")
+
+mkdir -p benchmark-bdt-engines/weights && cd benchmark-bdt-engines
+cp "$WEIGHT"/*_BDT.weights.xml weights/
+cp "$WEIGHT"/*Preprocessing.root weights/ 2>/dev/null
+run_logged compile.log "$EXE" --mode compile-bdt --weight weights
+printf "engine\tsetup_ms\tinference_us\n"
+for ENGINE in reader auto native; do
+  run_logged "classify-$ENGINE.log" "$EXE" --mode classify --weight weights --test "$TEST" --threads 1 --engine "$ENGINE"
+  printf "%s\t%s\t%s\n" "$ENGINE" "$(setup_time classify-$ENGINE.log)" "$(inference_time classify-$ENGINE.log)"
+done
+run_logged check-native.log "$EXE" --mode classify --weight weights --test "$TEST" --engine native --check-engine
+grep -oP "Engine check for \K.*" check-native.log
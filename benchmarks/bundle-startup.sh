@@ -0,0 +1,17 @@
+#!/bin/bash
+# Benchmark of the classification startup: methods loaded from the weight folder (XML weight files) against the
+# memory-mapped model bundle. Both runs use the native engines for the BDT and the dense DNN.
+# Usage: benchmarks/bundle-startup.sh <executable> <weight-dir> <test-dir>
+# Logs are written to ./benchmark-bundle-startup
+
+source "$(dirname "$0")/common.sh"
+
+EXE=$(realpath "$1"); WEIGHT=$(realpath "$2"); TEST=$(realpath "$3")
+
+mkdir -p benchmark-bundle-startup && cd benchmark-bundle-startup
+run_logged bundle.log "$EXE" --mode bundle --weight "$WEIGHT" --bundle model.bundle
+run_logged classify-folder.log "$EXE" --mode classify --weight "$WEIGHT" --test "$TEST" --threads 1 --engine native
+run_logged classify-bundle.log "$EXE" --mode classify --bundle model.bundle --test "$TEST" --threads 1 --engine native
+printf "source\tbundle_load_ms\tsetup_ms\n"
+printf "folder\t-\t%s\n" "$(setup_time classify-folder.log)"
+printf "bundle\t%s\t%s\n" "$(bundle_time classify-bundle.log)" "$(setup_time classify-bundle.log)"
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Benchmark of the cascade classification: the first method (BDT) scores every waveform, the other methods only the
+# waveforms with the first score in the ambiguity band. Throughput is compared with the full evaluation.
+# Usage: benchmarks/cascade.sh <executable> <weight-dir> <test-dir> [bands ...]
+# Bands are "low,high" pairs, default -0.1,0.1 -0.2,0.2 -0.4,0.4
+# Logs are written to ./benchmark-cascade
+
+source "$(dirname "$0")/common.sh"
+
+EXE=$(realpath "$1"); WEIGHT=$(realpath "$2"); TEST=$(realpath "$3")
+shift 3
+BANDS=${@:-"-0.1,0.1 -0.2,0.2 -0.4,0.4"}
+
+mkdir -p benchmark-cascade && cd benchmark-cascade
+run_logged classify-full.log "$EXE" --mode classify --weight "$WEIGHT" --test "$TEST" --threads 1
+FULL=$(classify_rate classify-full.log)
+printf "band\tescalated_percent\twaveforms_per_second\tgain\n"
+printf "full\t100\t%s\t1.00\n" "$FULL"
+for BAND in $BANDS; do
+  run_logged "classify-$BAND.log" "$EXE" --mode classify --weight "$WEIGHT" --test "$TEST" --threads 1 --cascade --cascade-band="$BAND"
+  RATE=$(classify_rate "classify-$BAND.log")
+  printf "%s\t%s\t%s\t%s\n" "$BAND" "$(grep -oP "waveforms \(\K[0-9.]+(?=%\) escalated)" "classify-$BAND.log" | tail -1)" "$RATE" \
+    "$(awk -v a="$RATE" -v b="$FULL" 'BEGIN { if (b > 0) printf "%.2f", a / b }')"
+done
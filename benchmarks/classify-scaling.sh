@@ -0,0 +1,17 @@
+#!/bin/bash
+# Benchmark of the classification throughput against the number of worker threads.
+# Usage: benchmarks/classify-scaling.sh <executable> <weight-dir> <test-dir> [threads ...]
+# Logs are written to ./benchmark-classify
+
+source "$(dirname "$0")/common.sh"
+
+EXE=$(realpath "$1"); WEIGHT=$(realpath "$2"); TEST=$(realpath "$3")
+shift 3
+THREADS=${@:-1 2 4 8 16 32}
+
+mkdir -p benchmark-classify && cd benchmark-classify
+printf "threads\twaveforms_per_s\tinference_us\n"
+for N in $THREADS; do
+  run_logged "classify-$N.log" "$EXE" --mode classify --weight "$WEIGHT" --test "$TEST" --threads "$N"
+  printf "%s\t%s\t%s\n" "$N" "$(classify_rate classify-$N.log)" "$(inference_time classify-$N.log)"
+done
@@ -0,0 +1,26 @@
+#!/bin/bash
+# Benchmark of the 1D convolutional network against the dense network: parameter count, ROC-AUC, training time
+# and inference time per event (TMVA test sample and, if test folder is given, the classification stage).
+# Usage: benchmarks/cnn-vs-dnn.sh <executable> <tmva-input-file> [test-dir]
+# Every network is trained in a separate folder under ./benchmark-cnn
+
+source "$(dirname "$0")/common.sh"
+
+EXE=$(realpath "$1"); INPUT=$(realpath "$2")
+TEST=${3:+$(realpath "$3")}
+
+mkdir -p benchmark-cnn && cd benchmark-cnn
+printf "method\tparameters\troc_auc\ttrain_s\ttest_us\tclassify_us\n"
+for METHOD in DNN CNN; do
+  FLAG=--$(echo "$METHOD" | tr '[:upper:]' '[:lower:]')
+  mkdir -p "$METHOD" && pushd "$METHOD" > /dev/null
+  run_logged train.log "$EXE" --mode train "$FLAG" "$INPUT"
+  CLASSIFY_US=""
+  if [ -n "$TEST" ]; then
+    run_logged classify.log "$EXE" --mode classify --weight dataset/weights --test "$TEST"
+    CLASSIFY_US=$(inference_time classify.log)
+  fi
+  printf "%s\t%s\t%s\t%s\t%s\t%s\n" "$METHOD" "$(parameters train.log $METHOD)" "$(roc_auc train.log $METHOD)" \
+    "$(train_time train.log)" "$(test_inference_time train.log $METHOD)" "$CLASSIFY_US"
+  popd > /dev/null
+done
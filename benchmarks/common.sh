@@ -0,0 +1,58 @@
+#!/bin/bash
+# Helper functions shared by the benchmark scripts. Source this file, do not execute it.
+# Benchmarks parse the summary lines that the program writes to its log.
+
+# Run program in batch mode and save its output to the log file
+# Usage: run_logged <log-file> <executable> [arguments...]
+run_logged() {
+  local log=$1; shift
+  "$@" -b > "$log" 2>&1
+}
+
+# Extract ROC-AUC of a method from the training log
+# Usage: roc_auc <log-file> <method-title>
+roc_auc() {
+  grep -oP "ROC-AUC for $2: \K[0-9.]+" "$1" | tail -1
+}
+
+# Extract training wall time (seconds) from the training log
+train_time() {
+  grep -oP "Training time: \K[0-9.]+" "$1" | tail -1
+}
+
+# Extract inference time per waveform (microseconds) from the classification log
+inference_time() {
+  grep -oP "Inference time: .*\(\K[0-9.]+(?= us per waveform)" "$1" | tail -1
+}
+
+# Extract number of trainable parameters of a network from the training log
+# Usage: parameters <log-file> <method-title>
+parameters() {
+  grep -oP "$2 has \K[0-9]+(?= trainable parameters)" "$1" | tail -1
+}
+
+# Extract inference time per test event (microseconds) measured by TMVA during the training
+# Usage: test_inference_time <log-file> <method-title>
+test_inference_time() {
+  grep -oP "Cost of $2: .*inference \K[0-9.]+(?= us per event)" "$1" | tail -1
+}
+
+# Extract time (microseconds) spent passing a waveform to the TMVA reader from the classification log
+input_time() {
+  grep -oP "Input time \(.*\): .*\(\K[0-9.]+(?= us per waveform)" "$1" | tail -1
+}
+
+# Extract classification throughput (waveforms per second) from the classification log
+classify_rate() {
+  grep -oP "worker threads, \K[0-9]+(?= waveforms per second)" "$1" | tail -1
+}
+
+# Extract time (milliseconds) spent loading the methods before the classification from the classification log
+setup_time() {
+  grep -oP "Setup time: \K[0-9.]+(?= ms)" "$1" | tail -1
+}
+
+# Extract time (milliseconds) spent loading the model bundle from the classification log
+bundle_time() {
+  grep -oP "Model bundle .* loaded in \K[0-9.]+(?= ms)" "$1" | tail -1
+}
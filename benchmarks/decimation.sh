@@ -0,0 +1,21 @@
+#!/bin/bash
+# Benchmark of the classification accuracy and training/inference time against the waveform decimation factor.
+# Usage: benchmarks/decimation.sh <executable> <background-dir> <signal-dir> <test-dir> [factor ...]
+# Every factor is processed in a separate folder under ./benchmark-decimation
+
+source "$(dirname "$0")/common.sh"
+
+EXE=$(realpath "$1"); BACKGROUND=$(realpath "$2"); SIGNAL=$(realpath "$3"); TEST=$(realpath "$4")
+shift 4
+FACTORS=${@:-1 2 4 8}
+
+mkdir -p benchmark-decimation && cd benchmark-decimation
+printf "factor\tBDT_AUC\tDNN_AUC\ttrain_s\tinference_us\n"
+for F in $FACTORS; do
+  mkdir -p "factor-$F" && pushd "factor-$F" > /dev/null
+  run_logged prepare.log "$EXE" --mode prepare --decimate "$F" --background "$BACKGROUND" --signal "$SIGNAL"
+  run_logged train.log "$EXE" --mode train tmva-input.root
+  run_logged classify.log "$EXE" --mode classify --weight dataset/weights --test "$TEST"
+  printf "%s\t%s\t%s\t%s\t%s\n" "$F" "$(roc_auc train.log BDT)" "$(roc_auc train.log DNN)" "$(train_time train.log)" "$(inference_time classify.log)"
+  popd > /dev/null
+done
@@ -0,0 +1,22 @@
+#!/bin/bash
+# Benchmark of the dense DNN inference engines: TMVA reader against the native engine with every instruction set
+# of the matrix product kernel. Only the DNN weight file and the preprocessing file are copied to the benchmark
+# folder, so the timings do not include other methods. Native engine runs also compare scores with the TMVA reader.
+# Usage: benchmarks/dnn-engines.sh <executable> <weight-dir> <test-dir>
+# Logs are written to ./benchmark-dnn-engines
+
+source "$(dirname "$0")/common.sh"
+
+EXE=$(realpath "$1"); WEIGHT=$(realpath "$2"); TEST=$(realpath "$3")
+
+mkdir -p benchmark-dnn-engines/weights && cd benchmark-dnn-engines
+cp "$WEIGHT"/*_DNN.weights.xml weights/
+cp "$WEIGHT"/*Preprocessing.root weights/ 2>/dev/null
+printf "engine\tinference_us\tmax_difference\n"
+run_logged classify-reader.log "$EXE" --mode classify --weight weights --test "$TEST" --threads 1 --engine reader
+printf "reader\t%s\t-\n" "$(inference_time classify-reader.log)"
+for SIMD in scalar avx2 avx512; do
+  run_logged "classify-$SIMD.log" "$EXE" --mode classify --weight weights --test "$TEST" --threads 1 --engine native --simd "$SIMD" --check-engine
+  grep -q "is not supported" "classify-$SIMD.log" && continue
+  printf "%s\t%s\t%s\n" "$SIMD" "$(inference_time classify-$SIMD.log)" "$(grep -oP "Engine check for .*max difference \K[0-9.e+-]+" classify-$SIMD.log | tail -1)"
+done
@@ -0,0 +1,21 @@
+#!/bin/bash
+# Benchmark of the int8-quantized dense DNN: scales are calibrated on the training events of the training output file,
+# ROC-AUC of the int8 network is compared with the float network on its test events, then the test folder is classified
+# with both networks by the native engine.
+# Usage: benchmarks/dnn-int8.sh <executable> <weight-dir> <training-output-file> <test-dir> [calibration-events]
+# Logs are written to ./benchmark-dnn-int8
+
+source "$(dirname "$0")/common.sh"
+
+EXE=$(realpath "$1"); WEIGHT=$(realpath "$2"); INPUT=$(realpath "$3"); TEST=$(realpath "$4"); NCAL=${5:-1000}
+
+mkdir -p benchmark-dnn-int8/weights && cd benchmark-dnn-int8
+cp "$WEIGHT"/*_DNN.weights.xml weights/
+cp "$WEIGHT"/*Preprocessing.root weights/ 2>/dev/null
+run_logged quantize.log "$EXE" --mode quantize-dnn --weight weights --calibration-events "$NCAL" "$INPUT"
+printf "precision\troc_auc\tinference_us\n"
+run_logged classify-float.log "$EXE" --mode classify --weight weights --test "$TEST" --threads 1 --engine native
+run_logged classify-int8.log "$EXE" --mode classify --weight weights --test "$TEST" --threads 1 --engine native --int8
+printf "float\t%s\t%s\n" "$(grep -oP "ROC-AUC for .*: float \K[0-9.]+" quantize.log | tail -1)" "$(inference_time classify-float.log)"
+printf "int8\t%s\t%s\n" "$(grep -oP "ROC-AUC for .*int8 \K[0-9.]+" quantize.log | tail -1)" "$(inference_time classify-int8.log)"
+grep -oP "ROC-AUC for .*change \K[+-][0-9.]+" quantize.log | sed 's/^/ROC-AUC change: /'
@@ -0,0 +1,20 @@
+#!/bin/bash
+# Benchmark of the dense DNN compiled through TMVA SOFIE against the TMVA reader: setup time, inference time and
+# throughput. Only the DNN weight file and the preprocessing file are copied to the benchmark folder.
+# Usage: benchmarks/dnn-sofie.sh <executable> <weight-dir> [test-dir]
+# Logs are written to ./benchmark-dnn-sofie
+
+source "$(dirname "$0")/common.sh"
+
+EXE=$(realpath "$1"); WEIGHT=$(realpath "$2"); TEST=$(realpath "${3:-$(dirname "$0")/../data/test}")
+
+mkdir -p benchmark-dnn-sofie/weights && cd benchmark-dnn-sofie
+cp "$WEIGHT"/*_DNN.weights.xml weights/
+cp "$WEIGHT"/*Preprocessing.root weights/ 2>/dev/null
+run_logged compile.log "$EXE" --mode compile-dnn --weight weights
+printf "engine\tsetup_ms\tinference_us\twaveforms_per_s\n"
+for ENGINE in reader auto; do
+  run_logged "classify-$ENGINE.log" "$EXE" --mode classify --weight weights --test "$TEST" --threads 1 --engine "$ENGINE"
+  NAME=$ENGINE; [ "$ENGINE" = "auto" ] && NAME=sofie
+  printf "%s\t%s\t%s\t%s\n" "$NAME" "$(setup_time classify-$ENGINE.log)" "$(inference_time classify-$ENGINE.log)" "$(classify_rate classify-$ENGINE.log)"
+done
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Benchmark of the TMVA reader input path: waveforms copied straight from the prepared histograms against
+# the former TTree round trip (--reader-tree). Prints input and total inference time per waveform.
+# Usage: benchmarks/reader-input.sh <executable> <weight-dir> <test-dir>
+# Logs are written to ./benchmark-reader-input
+
+source "$(dirname "$0")/common.sh"
+
+EXE=$(realpath "$1"); WEIGHT=$(realpath "$2"); TEST=$(realpath "$3")
+
+mkdir -p benchmark-reader-input && cd benchmark-reader-input
+printf "input\tinput_us\tinference_us\n"
+for INPUT in direct tree; do
+  FLAGS=""
+  [ "$INPUT" = "tree" ] && FLAGS="--reader-tree"
+  run_logged "classify-$INPUT.log" "$EXE" --mode classify --weight "$WEIGHT" --test "$TEST" $FLAGS
+  printf "%s\t%s\t%s\n" "$INPUT" "$(input_time classify-$INPUT.log)" "$(inference_time classify-$INPUT.log)"
+done
@@ -0,0 +1,20 @@
+#!/bin/bash
+# Benchmark of the BDT and DNN training wall time against the number of threads.
+# Usage: benchmarks/thread-scaling.sh <executable> <tmva-input-file> [threads ...]
+# Every run is performed in a separate folder under ./benchmark-threads
+
+source "$(dirname "$0")/common.sh"
+
+EXE=$(realpath "$1"); INPUT=$(realpath "$2")
+shift 2
+THREADS=${@:-1 2 4 8 16 32}
+
+mkdir -p benchmark-threads && cd benchmark-threads
+printf "threads\tBDT_train_s\tDNN_train_s\n"
+for N in $THREADS; do
+  mkdir -p "threads-$N" && pushd "threads-$N" > /dev/null
+  run_logged train-bdt.log "$EXE" --mode train --bdt --threads "$N" "$INPUT"
+  run_logged train-dnn.log "$EXE" --mode train --dnn --threads "$N" "$INPUT"
+  printf "%s\t%s\t%s\n" "$N" "$(train_time train-bdt.log)" "$(train_time train-dnn.log)"
+  popd > /dev/null
+done
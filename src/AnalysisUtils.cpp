@@ -0,0 +1,291 @@
+#include "./AnalysisUtils.h"
+#include "./FileUtils.h"
+#include "./HistUtils.h"
+
+#include <TObjString.h>
+#include <TFile.h>
+#include <TTree.h>
+#include <TROOT.h>
+#include <TError.h>
+#include <ROOT/TThreadExecutor.hxx>
+#include <ROOT/TSeq.hxx>
+
+#include <string>
+#include <algorithm>
+
+using namespace AnalysisUtils;
+
+namespace {
+	// Running sums accumulated by one worker
+	struct Moments {
+		std::vector<Double_t> sum;
+		std::vector<Double_t> sumSq;
+		Long64_t n = 0;
+	};
+
+	// Reduce sums of the workers into mean and variance. Returns total number of entries
+	Long64_t reduceMoments(const std::vector<Moments>& partials, Int_t n, std::vector<Double_t>& mean, std::vector<Double_t>& variance){
+		Moments total;
+		total.sum.assign(n, 0);
+		total.sumSq.assign(n, 0);
+		for (const Moments& m : partials){
+			for (Int_t i = 0; i < n; i++){
+				total.sum[i] += m.sum[i];
+				total.sumSq[i] += m.sumSq[i];
+			}
+			total.n += m.n;
+		}
+
+		mean.assign(n, 0);
+		variance.assign(n, 0);
+		if (total.n == 0) return 0;
+		for (Int_t i = 0; i < n; i++){
+			mean[i] = total.sum[i]/total.n;
+			variance[i] = std::max(0., total.sumSq[i]/total.n - mean[i]*mean[i]);
+		}
+		return total.n;
+	}
+
+	// Sorted distinct values at nSteps + 1 evenly spaced quantiles (minimum and maximum included)
+	std::vector<Double_t> getQuantiles(std::vector<Double_t> values, Int_t nSteps){
+		std::vector<Double_t> quantiles;
+		if (values.empty()) return quantiles;
+		std::sort(values.begin(), values.end());
+		for (Int_t i = 0; i <= nSteps; i++){
+			Double_t value = values[(size_t)((values.size() - 1)*(Double_t)i/nSteps)];
+			if (quantiles.empty() || value > quantiles.back()) quantiles.push_back(value);
+		}
+		return quantiles;
+	}
+}
+
+Long64_t AnalysisUtils::computeMeanVariance(TList* filePaths, Int_t maxFiles, Double_t voltageThreshold, Double_t minPeakPos, Double_t maxPeakPos,
+	std::vector<Double_t>& mean, std::vector<Double_t>& variance, std::vector<Double_t>& time){
+	// Pick evenly spaced sample of files. Copy paths because TList is not safe for concurrent access
+	std::vector<std::string> paths;
+	Int_t nFiles = filePaths->GetSize();
+	Int_t nSample = (maxFiles > 0 && maxFiles < nFiles) ? maxFiles : nFiles;
+	for (Int_t i = 0; i < nSample; i++){
+		paths.push_back(((TObjString*)filePaths->At((Long64_t)i*nFiles/nSample))->GetString().Data());
+	}
+	if (paths.empty()) return 0;
+
+	// First waveform defines the record length and the time axis (same as in FileUtils::tekWaveformToHist)
+	std::vector<double> t, v;
+	if (!FileUtils::readTekWaveform(paths[0].c_str(), t, v) || t.size() <= 2) return 0;
+	Int_t nSamples = t.size();
+	Double_t binWidth = t[1] - t[0];
+	Double_t leftEdge = t[1] - binWidth/2;
+	Double_t width = (t.back() + binWidth/2 - leftEdge)/nSamples;
+	time.resize(nSamples);
+	for (Int_t i = 0; i < nSamples; i++) time[i] = leftEdge + (i + 0.5)*width;
+
+	// Each worker accumulates sums over its own subset of files
+	ROOT::TThreadExecutor executor;
+	UInt_t nChunks = std::min<UInt_t>(paths.size(), 4*executor.GetPoolSize());
+	auto accumulate = [&](UInt_t chunk){
+		Moments m;
+		m.sum.assign(nSamples, 0);
+		m.sumSq.assign(nSamples, 0);
+		std::vector<double> sampleTime, voltage;
+		std::vector<Float_t> buffer(nSamples);
+		for (size_t f = chunk; f < paths.size(); f += nChunks){
+			if (!FileUtils::readTekWaveform(paths[f].c_str(), sampleTime, voltage) || (Int_t)voltage.size() != nSamples) continue;
+
+			// Same "good" waveform criteria as in getGoodHistogramsList()
+			Int_t minBin = std::min_element(voltage.begin(), voltage.end()) - voltage.begin();
+			Double_t peakPos = leftEdge + (minBin + 0.5)*width;
+			if (voltage[minBin] > voltageThreshold || peakPos < minPeakPos || peakPos > maxPeakPos) continue;
+
+			// Inverted waveform with negative values set to zero (same as HistUtils::invertHist), optionally aligned
+			for (Int_t i = 0; i < nSamples; i++){
+				buffer[i] = voltage[i] < 0 ? -voltage[i] : 0;
+			}
+			if (HistUtils::alignFraction > 0){
+				HistUtils::alignWaveform(buffer.data(), nSamples, time[0], width);
+			}
+			for (Int_t i = 0; i < nSamples; i++){
+				m.sum[i] += buffer[i];
+				m.sumSq[i] += (Double_t)buffer[i]*buffer[i];
+			}
+			m.n++;
+		}
+		return m;
+	};
+	std::vector<Moments> partials = executor.Map(accumulate, ROOT::TSeqU(nChunks));
+
+	Long64_t n = reduceMoments(partials, nSamples, mean, variance);
+	Info("AnalysisUtils::computeMeanVariance", "Accumulated %lld \"good\" waveforms out of %d sampled files", n, nSample);
+	return n;
+}
+
+Long64_t AnalysisUtils::computeTreeMeanVariance(const char* filePath, const char* treeName, Int_t nBins,
+	std::vector<Double_t>& mean, std::vector<Double_t>& variance){
+	ROOT::EnableThreadSafety();
+	mean.assign(nBins, 0);
+	variance.assign(nBins, 0);
+
+	Long64_t nEntries = 0;
+	{
+		TDirectory::TContext context;
+		TFile* file = TFile::Open(filePath);
+		if (!file || file->IsZombie()) return 0;
+		TTree* tree = file->Get<TTree>(treeName);
+		if (tree) nEntries = tree->GetEntries();
+		file->Close();
+		delete file;
+	}
+	if (nEntries == 0) return 0;
+
+	// Every worker opens its own copy of the file (TTree is not thread-safe) and reads a contiguous range of entries
+	ROOT::TThreadExecutor executor;
+	UInt_t nChunks = std::min<Long64_t>(nEntries, executor.GetPoolSize());
+	auto accumulate = [&](UInt_t chunk){
+		Moments m;
+		m.sum.assign(nBins, 0);
+		m.sumSq.assign(nBins, 0);
+		TDirectory::TContext context;
+		TFile* file = TFile::Open(filePath);
+		TTree* tree = file->Get<TTree>(treeName);
+		std::vector<Float_t> values(nBins);
+		for (Int_t i = 0; i < nBins; i++){
+			tree->SetBranchAddress(TString::Format("var%d", i).Data(), &values[i]);
+		}
+		for (Long64_t entry = nEntries*chunk/nChunks; entry < nEntries*(chunk + 1)/nChunks; entry++){
+			tree->GetEntry(entry);
+			for (Int_t i = 0; i < nBins; i++){
+				m.sum[i] += values[i];
+				m.sumSq[i] += (Double_t)values[i]*values[i];
+			}
+			m.n++;
+		}
+		file->Close();
+		delete file;
+		return m;
+	};
+	std::vector<Moments> partials = executor.Map(accumulate, ROOT::TSeqU(nChunks));
+
+	return reduceMoments(partials, nBins, mean, variance);
+}
+
+std::vector<Double_t> AnalysisUtils::getSeparation(const std::vector<Double_t>& meanS, const std::vector<Double_t>& varianceS,
+	const std::vector<Double_t>& meanB, const std::vector<Double_t>& varianceB){
+	size_t n = std::min(meanS.size(), meanB.size());
+	std::vector<Double_t> separation(n, 0);
+	for (size_t i = 0; i < n; i++){
+		Double_t variance = varianceS[i] + varianceB[i];
+		Double_t diff = meanS[i] - meanB[i];
+		if (variance > 0) separation[i] = diff*diff/variance;
+	}
+	return separation;
+}
+
+void AnalysisUtils::findSmallestWindow(const std::vector<Double_t>& separation, Double_t fraction, Int_t& first, Int_t& last){
+	Int_t n = separation.size();
+	first = 0;
+	last = n - 1;
+
+	Double_t total = 0;
+	for (Double_t s : separation) total += s;
+	Double_t target = fraction*total;
+	if (total <= 0) return;
+
+	// Two pointers: for every right edge move the left edge as far as the window still holds the target
+	Double_t sum = 0;
+	Int_t left = 0;
+	for (Int_t right = 0; right < n; right++){
+		sum += separation[right];
+		while (left < right && sum - separation[left] >= target){
+			sum -= separation[left];
+			left++;
+		}
+		if (sum >= target && right - left < last - first){
+			first = left;
+			last = right;
+		}
+	}
+}
+
+Bool_t AnalysisUtils::optimizeRectangularCut(const std::vector<Double_t>& xGood, const std::vector<Double_t>& yGood, const std::vector<Double_t>& xNoise,
+	const std::vector<Double_t>& yNoise, Double_t minEfficiency, Int_t nSteps, RectangularCut& cut){
+	if (xGood.empty() || xNoise.empty()) return kFALSE;
+
+	// Candidate cut values
+	std::vector<Double_t> x(xGood), y(yGood);
+	x.insert(x.end(), xNoise.begin(), xNoise.end());
+	y.insert(y.end(), yNoise.begin(), yNoise.end());
+	std::vector<Double_t> xCuts = getQuantiles(x, nSteps);
+	std::vector<Double_t> yCuts = getQuantiles(y, nSteps);
+	Int_t nX = xCuts.size(), nY = yCuts.size();
+
+	// Event passes "x <= xCuts[i]" for every i >= xIndex
+	const std::vector<Double_t>* xSamples[2] = { &xGood, &xNoise };
+	const std::vector<Double_t>* ySamples[2] = { &yGood, &yNoise };
+	std::vector<Int_t> xIndex[2];
+	for (Int_t c = 0; c < 2; c++){
+		for (Double_t value : *xSamples[c]){
+			xIndex[c].push_back(std::lower_bound(xCuts.begin(), xCuts.end(), value) - xCuts.begin());
+		}
+	}
+
+	// Every worker scans windows with the same lower edge: counts events inside the y window per x index and
+	// accumulates them over the x cut values
+	auto scan = [&](UInt_t j){
+		RectangularCut best;
+		std::vector<Long64_t> counts[2];
+		for (Int_t k = j; k < nY; k++){
+			for (Int_t c = 0; c < 2; c++){
+				counts[c].assign(nX + 1, 0);
+				const std::vector<Double_t>& ys = *ySamples[c];
+				for (size_t e = 0; e < ys.size(); e++){
+					if (ys[e] >= yCuts[j] && ys[e] <= yCuts[k]) counts[c][xIndex[c][e]]++;
+				}
+			}
+			Long64_t nPassed[2] = { 0, 0 };
+			for (Int_t i = 0; i < nX; i++){
+				nPassed[0] += counts[0][i];
+				nPassed[1] += counts[1][i];
+				Double_t goodEfficiency = (Double_t)nPassed[0]/xGood.size();
+				Double_t noiseEfficiency = (Double_t)nPassed[1]/xNoise.size();
+				if (goodEfficiency < minEfficiency) continue;
+				if (noiseEfficiency < best.noiseEfficiency || (noiseEfficiency == best.noiseEfficiency && goodEfficiency > best.goodEfficiency)){
+					best.xMax = xCuts[i];
+					best.yMin = yCuts[j];
+					best.yMax = yCuts[k];
+					best.goodEfficiency = goodEfficiency;
+					best.noiseEfficiency = noiseEfficiency;
+				}
+			}
+		}
+		return best;
+	};
+	ROOT::TThreadExecutor executor;
+	std::vector<RectangularCut> rows = executor.Map(scan, ROOT::TSeqU(nY));
+
+	Bool_t found = kFALSE;
+	for (const RectangularCut& row : rows){
+		if (row.goodEfficiency < minEfficiency) continue;
+		if (!found || row.noiseEfficiency < cut.noiseEfficiency || (row.noiseEfficiency == cut.noiseEfficiency && row.goodEfficiency > cut.goodEfficiency)){
+			cut = row;
+			found = kTRUE;
+		}
+	}
+	Info("AnalysisUtils::optimizeRectangularCut", "Scanned %d x cut values and %d y cut values over %zu good and %zu noise events", nX, nY, xGood.size(), xNoise.size());
+	return found;
+}
+
+Double_t AnalysisUtils::getRocAuc(std::vector<Double_t> signalScores, std::vector<Double_t> backgroundScores){
+	if (signalScores.empty() || backgroundScores.empty()) return 0;
+	std::sort(signalScores.begin(), signalScores.end());
+	std::sort(backgroundScores.begin(), backgroundScores.end());
+
+	// For every signal score count background scores below and equal to it
+	Double_t sum = 0;
+	size_t below = 0, notAbove = 0;
+	for (Double_t score : signalScores){
+		while (below < backgroundScores.size() && backgroundScores[below] < score) below++;
+		while (notAbove < backgroundScores.size() && backgroundScores[notAbove] <= score) notAbove++;
+		sum += below + 0.5*(notAbove - below);
+	}
+	return sum/signalScores.size()/backgroundScores.size();
+}
@@ -0,0 +1,45 @@
+#ifndef AnalysisUtils_hh
+#define AnalysisUtils_hh 1
+
+#include <TList.h>
+
+#include <vector>
+
+// Statistical passes over the raw CSV waveforms (run in parallel before the preparation stage) and the prepared trees
+
+namespace AnalysisUtils {
+	// Accumulate per-sample mean and variance of the inverted "good" waveforms. Up to maxFiles evenly spaced files
+	// from the list are processed in parallel. Time holds sample positions on the tekWaveformToHist() axis.
+	// Returns number of waveforms that passed the cut
+	Long64_t computeMeanVariance(TList* filePaths, Int_t maxFiles, Double_t voltageThreshold, Double_t minPeakPos, Double_t maxPeakPos,
+		std::vector<Double_t>& mean, std::vector<Double_t>& variance, std::vector<Double_t>& time);
+
+	// Accumulate per-bin mean and variance of the "var0", "var1",... branches of the prepared tree in parallel.
+	// Returns number of entries
+	Long64_t computeTreeMeanVariance(const char* filePath, const char* treeName, Int_t nBins,
+		std::vector<Double_t>& mean, std::vector<Double_t>& variance);
+
+	// Per-sample separation power (meanS - meanB)^2/(varianceS + varianceB)
+	std::vector<Double_t> getSeparation(const std::vector<Double_t>& meanS, const std::vector<Double_t>& varianceS,
+		const std::vector<Double_t>& meanB, const std::vector<Double_t>& varianceB);
+
+	// Find smallest contiguous range of samples holding given fraction of the total separation
+	void findSmallestWindow(const std::vector<Double_t>& separation, Double_t fraction, Int_t& first, Int_t& last);
+
+	// Rectangular cut "x <= xMax && yMin <= y <= yMax" and its efficiencies on the good and noise samples
+	struct RectangularCut {
+		Double_t xMax = 0, yMin = 0, yMax = 0;
+		Double_t goodEfficiency = 0, noiseEfficiency = 1;
+	};
+
+	// Grid scan for the rectangular cut that keeps at least minEfficiency of the good events and passes the smallest
+	// fraction of the noise events. Cut values are nSteps quantiles of the combined sample, y windows are scanned
+	// in parallel. Returns false if no cut keeps enough good events
+	Bool_t optimizeRectangularCut(const std::vector<Double_t>& xGood, const std::vector<Double_t>& yGood, const std::vector<Double_t>& xNoise,
+		const std::vector<Double_t>& yNoise, Double_t minEfficiency, Int_t nSteps, RectangularCut& cut);
+
+	// Area under the ROC curve: probability that a signal score is above a background score (ties count half)
+	Double_t getRocAuc(std::vector<Double_t> signalScores, std::vector<Double_t> backgroundScores);
+}
+
+#endif
@@ -0,0 +1,368 @@
+#include "./BundleUtils.h"
+#include "./HistUtils.h"
+
+#include <TError.h>
+#include <TMD5.h>
+#include <TSystem.h>
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace BundleUtils;
+
+namespace {
+	// Signature with the format version. Header: signature, MD5 of the contents (32 hex digits), contents size
+	const char bundleMagic[8] = { 'D', 'R', 'B', 'N', 'D', 'L', '0', '2' };
+	const size_t hashLength = 32;
+	const size_t headerSize = sizeof(bundleMagic) + hashLength + sizeof(ULong64_t);
+
+	// Engine tables stored after the weight file of the method
+	enum EngineTables : UChar_t { kNoTables = 0, kForestTables = 1, kNetworkTables = 2 };
+
+	// Bundle contents are appended to the byte buffer in the host byte order
+	struct Writer {
+		std::string buffer;
+
+		template <class T> void put(T value){
+			buffer.append((const char*) &value, sizeof(T));
+		}
+		void putBytes(const char* data, size_t length){
+			put<ULong64_t>(length);
+			buffer.append(data, length);
+		}
+		void putString(const TString& value){
+			putBytes(value.Data(), value.Length());
+		}
+		template <class T> void putVector(const std::vector<T>& values){
+			putBytes((const char*) values.data(), values.size()*sizeof(T));
+		}
+		void putStrings(const std::vector<TString>& values){
+			put<ULong64_t>(values.size());
+			for (const TString& value : values) putString(value);
+		}
+	};
+
+	// Cursor over the mapped contents. Every read is bounds-checked, ok turns false on the first failure
+	struct Reader {
+		const char* data;
+		size_t size;
+		size_t position = 0;
+		Bool_t ok = kTRUE;
+
+		template <class T> T get(){
+			T value {};
+			if (!ok || size - position < sizeof(T)){
+				ok = kFALSE;
+				return value;
+			}
+			memcpy(&value, data + position, sizeof(T));
+			position += sizeof(T);
+			return value;
+		}
+		// Pointer to the next length-prefixed block
+		const char* getBytes(size_t& length){
+			length = get<ULong64_t>();
+			if (!ok || size - position < length){
+				ok = kFALSE;
+				length = 0;
+				return nullptr;
+			}
+			const char* bytes = data + position;
+			position += length;
+			return bytes;
+		}
+		TString getString(){
+			size_t length;
+			const char* bytes = getBytes(length);
+			return ok ? TString(bytes, length) : TString();
+		}
+		template <class T> void getVector(std::vector<T>& values){
+			size_t length;
+			const char* bytes = getBytes(length);
+			ok = ok && length % sizeof(T) == 0;
+			values.resize(ok ? length/sizeof(T) : 0);
+			if (ok) memcpy(values.data(), bytes, length);
+		}
+		void getStrings(std::vector<TString>& values){
+			ULong64_t n = get<ULong64_t>();
+			values.clear();
+			for (ULong64_t i = 0; ok && i < n; i++) values.push_back(getString());
+		}
+	};
+
+	void putForest(Writer& writer, const ForestUtils::Forest& forest){
+		writer.putStrings(forest.variables);
+		writer.put<UChar_t>(forest.gradBoost);
+		writer.putVector(forest.treeWeights);
+		writer.putVector(forest.treeRoots);
+		writer.putVector(forest.treeDepths);
+		writer.putVector(forest.nodeVariables);
+		writer.putVector(forest.nodeCuts);
+		writer.putVector(forest.nodeChildren);
+		writer.putVector(forest.nodeValues);
+	}
+
+	void getForest(Reader& reader, ForestUtils::Forest& forest){
+		reader.getStrings(forest.variables);
+		forest.gradBoost = reader.get<UChar_t>() != 0;
+		reader.getVector(forest.treeWeights);
+		reader.getVector(forest.treeRoots);
+		reader.getVector(forest.treeDepths);
+		reader.getVector(forest.nodeVariables);
+		reader.getVector(forest.nodeCuts);
+		reader.getVector(forest.nodeChildren);
+		reader.getVector(forest.nodeValues);
+		// Node indices are used without checks by the traversal
+		Int_t nNodes = forest.nodeVariables.size();
+		reader.ok = reader.ok && forest.nodeCuts.size() == (size_t) nNodes && forest.nodeChildren.size() == (size_t) nNodes
+			&& forest.nodeValues.size() == (size_t) nNodes && forest.treeRoots.size() == forest.treeWeights.size()
+			&& forest.treeDepths.size() == forest.treeWeights.size();
+		for (Int_t i = 0; reader.ok && i < nNodes; i++){
+			Int_t child = forest.nodeChildren[i];
+			reader.ok = child >= 0 && (child == i || child + 1 < nNodes) && forest.nodeVariables[i] >= 0
+				&& forest.nodeVariables[i] < (Int_t) forest.variables.size();
+		}
+		for (size_t t = 0; reader.ok && t < forest.treeRoots.size(); t++){
+			reader.ok = forest.treeRoots[t] >= 0 && forest.treeRoots[t] < nNodes;
+		}
+	}
+
+	void putNetwork(Writer& writer, const NetworkUtils::Network& network){
+		writer.putStrings(network.variables);
+		writer.put<Char_t>(network.outputFunction);
+		writer.put<ULong64_t>(network.layers.size());
+		for (const NetworkUtils::DenseLayer& layer : network.layers){
+			writer.put<Int_t>(layer.nInputs);
+			writer.put<Int_t>(layer.nOutputs);
+			writer.put<Int_t>(layer.activation);
+			writer.putVector(layer.weights);
+			writer.putVector(layer.biases);
+		}
+	}
+
+	void getNetwork(Reader& reader, NetworkUtils::Network& network){
+		reader.getStrings(network.variables);
+		network.outputFunction = reader.get<Char_t>();
+		ULong64_t nLayers = reader.get<ULong64_t>();
+		network.layers.clear();
+		Int_t nInputs = network.variables.size();
+		for (ULong64_t l = 0; reader.ok && l < nLayers; l++){
+			NetworkUtils::DenseLayer layer;
+			layer.nInputs = reader.get<Int_t>();
+			layer.nOutputs = reader.get<Int_t>();
+			layer.activation = reader.get<Int_t>();
+			reader.getVector(layer.weights);
+			reader.getVector(layer.biases);
+			reader.ok = reader.ok && layer.nInputs == nInputs && layer.nOutputs > 0 && layer.weights.size() == (size_t) layer.nInputs*layer.nOutputs
+				&& layer.biases.size() == (size_t) layer.nOutputs;
+			nInputs = layer.nOutputs;
+			network.layers.push_back(layer);
+		}
+		reader.ok = reader.ok && nInputs == 1;
+	}
+
+	TString getHash(const char* contents, size_t size){
+		TMD5 md5;
+		md5.Update((const UChar_t*) contents, size);
+		md5.Final();
+		return md5.AsString();
+	}
+}
+
+Preprocessing BundleUtils::getPreprocessing(){
+	Preprocessing preprocessing;
+	preprocessing.decimationFactor = HistUtils::decimationFactor;
+	preprocessing.leftEdgeSeconds = HistUtils::leftEdgeSeconds;
+	preprocessing.rightEdgeSeconds = HistUtils::rightEdgeSeconds;
+	preprocessing.alignFraction = HistUtils::alignFraction;
+	preprocessing.alignTimeSeconds = HistUtils::alignTimeSeconds;
+	preprocessing.alignCubic = HistUtils::alignCubic;
+	preprocessing.rejectPileup = HistUtils::rejectPileup;
+	preprocessing.voltageThreshold = HistUtils::voltageThreshold;
+	preprocessing.minPeakSeconds = HistUtils::minPeakSeconds;
+	preprocessing.maxPeakSeconds = HistUtils::maxPeakSeconds;
+	return preprocessing;
+}
+
+void BundleUtils::setPreprocessing(const Preprocessing& preprocessing){
+	HistUtils::decimationFactor = preprocessing.decimationFactor;
+	HistUtils::leftEdgeSeconds = preprocessing.leftEdgeSeconds;
+	HistUtils::rightEdgeSeconds = preprocessing.rightEdgeSeconds;
+	HistUtils::alignFraction = preprocessing.alignFraction;
+	HistUtils::alignTimeSeconds = preprocessing.alignTimeSeconds;
+	HistUtils::alignCubic = preprocessing.alignCubic;
+	HistUtils::rejectPileup = preprocessing.rejectPileup;
+	HistUtils::voltageThreshold = preprocessing.voltageThreshold;
+	HistUtils::minPeakSeconds = preprocessing.minPeakSeconds;
+	HistUtils::maxPeakSeconds = preprocessing.maxPeakSeconds;
+}
+
+Bool_t BundleUtils::writeBundle(const char* filePath, Bundle& bundle){
+	Writer writer;
+
+	// Preprocessing
+	const Preprocessing& p = bundle.preprocessing;
+	writer.put<Int_t>(p.decimationFactor);
+	writer.put<Double_t>(p.leftEdgeSeconds);
+	writer.put<Double_t>(p.rightEdgeSeconds);
+	writer.put<Double_t>(p.alignFraction);
+	writer.put<Double_t>(p.alignTimeSeconds);
+	writer.put<UChar_t>(p.alignCubic);
+	writer.put<UChar_t>(p.rejectPileup);
+	writer.put<Double_t>(p.voltageThreshold);
+	writer.put<Double_t>(p.minPeakSeconds);
+	writer.put<Double_t>(p.maxPeakSeconds);
+	writer.putVector(bundle.bins);
+	writer.put<Int_t>(bundle.projection.GetNrows());
+	writer.put<Int_t>(bundle.projection.GetNcols());
+	writer.putBytes((const char*) bundle.projection.GetMatrixArray(), bundle.projection.GetNoElements()*sizeof(Float_t));
+	writer.putBytes((const char*) bundle.offset.GetMatrixArray(), bundle.offset.GetNrows()*sizeof(Float_t));
+	writer.putVector(bundle.variables);
+	writer.putStrings(bundle.classes);
+
+	// Methods: name, type, variables, weight file, engine tables, int8 scales
+	writer.put<ULong64_t>(bundle.methods.size());
+	for (const BundleMethod& entry : bundle.methods){
+		const InferenceUtils::Method& method = entry.method;
+		writer.putString(method.name);
+		writer.put<Int_t>(method.type);
+		writer.putStrings(entry.variables);
+		writer.putBytes(method.weights.data(), method.weights.size());
+		if (method.forest){
+			writer.put<UChar_t>(kForestTables);
+			putForest(writer, *method.forest);
+		} else if (method.network){
+			writer.put<UChar_t>(kNetworkTables);
+			putNetwork(writer, *method.network);
+		} else {
+			writer.put<UChar_t>(kNoTables);
+		}
+		writer.putVector(entry.inputScales);
+	}
+	bundle.hash = getHash(writer.buffer.data(), writer.buffer.size());
+
+	TString tmpFilePath = TString::Format("%s.%d", filePath, gSystem->GetPid());
+	FILE* file = fopen(tmpFilePath.Data(), "wb");
+	if (!file){
+		Error("BundleUtils::writeBundle", "Cannot write \"%s\"", filePath);
+		return kFALSE;
+	}
+	ULong64_t size = writer.buffer.size();
+	fwrite(bundleMagic, 1, sizeof(bundleMagic), file);
+	fwrite(bundle.hash.Data(), 1, hashLength, file);
+	fwrite(&size, sizeof(ULong64_t), 1, file);
+	fwrite(writer.buffer.data(), 1, size, file);
+
+	Bool_t ok = !ferror(file);
+	ok = (fclose(file) == 0) && ok;
+	if (ok) ok = (gSystem->Rename(tmpFilePath.Data(), filePath) == 0);
+	if (!ok){
+		gSystem->Unlink(tmpFilePath.Data());
+		Error("BundleUtils::writeBundle", "Cannot write \"%s\"", filePath);
+	}
+	return ok;
+}
+
+Bool_t BundleUtils::readBundle(const char* filePath, Bundle& bundle){
+	int fd = open(filePath, O_RDONLY);
+	struct stat status;
+	if (fd < 0 || fstat(fd, &status) != 0){
+		if (fd >= 0) close(fd);
+		Error("BundleUtils::readBundle", "Cannot read \"%s\"", filePath);
+		return kFALSE;
+	}
+	size_t fileSize = status.st_size;
+	void* mapping = fileSize > 0 ? mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (mapping == MAP_FAILED){
+		Error("BundleUtils::readBundle", "Cannot map \"%s\"", filePath);
+		return kFALSE;
+	}
+	const char* data = (const char*) mapping;
+
+	// Header and hash of the contents
+	ULong64_t size = 0;
+	if (fileSize >= headerSize) memcpy(&size, data + sizeof(bundleMagic) + hashLength, sizeof(ULong64_t));
+	if (fileSize < headerSize || memcmp(data, bundleMagic, sizeof(bundleMagic)) != 0 || size != fileSize - headerSize){
+		munmap(mapping, fileSize);
+		Error("BundleUtils::readBundle", "\"%s\" is not a model bundle of this program version, run 'bundle' again", filePath);
+		return kFALSE;
+	}
+	bundle.hash = TString(data + sizeof(bundleMagic), hashLength);
+	if (getHash(data + headerSize, size) != bundle.hash){
+		munmap(mapping, fileSize);
+		Error("BundleUtils::readBundle", "Model bundle \"%s\" is corrupted", filePath);
+		return kFALSE;
+	}
+	Reader reader { data + headerSize, size };
+
+	// Preprocessing
+	Preprocessing& p = bundle.preprocessing;
+	p.decimationFactor = reader.get<Int_t>();
+	p.leftEdgeSeconds = reader.get<Double_t>();
+	p.rightEdgeSeconds = reader.get<Double_t>();
+	p.alignFraction = reader.get<Double_t>();
+	p.alignTimeSeconds = reader.get<Double_t>();
+	p.alignCubic = reader.get<UChar_t>() != 0;
+	p.rejectPileup = reader.get<UChar_t>() != 0;
+	p.voltageThreshold = reader.get<Double_t>();
+	p.minPeakSeconds = reader.get<Double_t>();
+	p.maxPeakSeconds = reader.get<Double_t>();
+	reader.getVector(bundle.bins);
+	reader.ok = reader.ok && (bundle.bins.empty() || bundle.bins.size() == 3);
+	Int_t nRows = reader.get<Int_t>();
+	Int_t nCols = reader.get<Int_t>();
+	std::vector<Float_t> projection, offset;
+	reader.getVector(projection);
+	reader.getVector(offset);
+	reader.ok = reader.ok && nRows >= 0 && nCols >= 0 && projection.size() == (size_t) nRows*nCols && offset.size() == (size_t) nRows;
+	if (reader.ok && nRows > 0){
+		bundle.projection.ResizeTo(nRows, nCols);
+		bundle.projection.SetMatrixArray(projection.data());
+		bundle.offset.ResizeTo(nRows);
+		bundle.offset.SetElements(offset.data());
+	}
+	reader.getVector(bundle.variables);
+	reader.getStrings(bundle.classes);
+
+	// Methods
+	ULong64_t nMethods = reader.get<ULong64_t>();
+	bundle.methods.clear();
+	for (ULong64_t m = 0; reader.ok && m < nMethods; m++){
+		BundleMethod entry;
+		InferenceUtils::Method& method = entry.method;
+		method.name = reader.getString();
+		method.filePath = filePath;
+		method.type = (TMVA::Types::EMVA) reader.get<Int_t>();
+		reader.getStrings(entry.variables);
+		size_t length;
+		const char* weights = reader.getBytes(length);
+		if (reader.ok) method.weights.assign(weights, length);
+		UChar_t tables = reader.get<UChar_t>();
+		if (tables == kForestTables){
+			std::shared_ptr<ForestUtils::Forest> forest = std::make_shared<ForestUtils::Forest>();
+			getForest(reader, *forest);
+			method.forest = forest;
+		} else if (tables == kNetworkTables){
+			std::shared_ptr<NetworkUtils::Network> network = std::make_shared<NetworkUtils::Network>();
+			getNetwork(reader, *network);
+			method.network = network;
+		} else {
+			reader.ok = reader.ok && tables == kNoTables;
+		}
+		reader.getVector(entry.inputScales);
+		bundle.methods.push_back(entry);
+	}
+	munmap(mapping, fileSize);
+
+	if (!reader.ok || reader.position != size){
+		Error("BundleUtils::readBundle", "Model bundle \"%s\" is corrupted", filePath);
+		return kFALSE;
+	}
+	return kTRUE;
+}
@@ -0,0 +1,60 @@
+#ifndef BundleUtils_hh
+#define BundleUtils_hh 1
+
+#include <TString.h>
+#include <TMatrixF.h>
+#include <TVectorF.h>
+
+#include "./InferenceUtils.h"
+
+#include <vector>
+
+// Binary model bundle: trained methods with their variable lists, native engine tables and the waveform
+// preprocessing of the training packed into one file. The file is memory-mapped when read, so the classification
+// starts without scanning the weight folder and parsing the XML weight files for the native engines
+
+namespace BundleUtils {
+	// Waveform preprocessing the methods were trained with (HistUtils parameters and noise cuts)
+	struct Preprocessing {
+		Int_t decimationFactor = 1;
+		Double_t leftEdgeSeconds = 0;
+		Double_t rightEdgeSeconds = 0;
+		Double_t alignFraction = 0;
+		Double_t alignTimeSeconds = 0;
+		Bool_t alignCubic = kFALSE;
+		Bool_t rejectPileup = kFALSE;
+		Double_t voltageThreshold = 0;
+		Double_t minPeakSeconds = 0;
+		Double_t maxPeakSeconds = 0;
+	};
+
+	// Current HistUtils values and their update
+	Preprocessing getPreprocessing();
+	void setPreprocessing(const Preprocessing& preprocessing);
+
+	// Method of the bundle. Forest or network of the native engine is stored if the weight file can be read by it
+	struct BundleMethod {
+		InferenceUtils::Method method;
+		std::vector<TString> variables;
+		std::vector<Float_t> inputScales;  // int8 scales of the dense network ("quantize-dnn"), empty if not calibrated
+	};
+
+	struct Bundle {
+		TString hash;                      // MD5 of the bundle contents, identifies the model version
+		Preprocessing preprocessing;
+		std::vector<Double_t> bins;        // number of bins and axis range of the prepared training waveforms, empty if unknown
+		TMatrixF projection;               // no rows if waveforms are not projected
+		TVectorF offset;
+		std::vector<Int_t> variables;      // selected waveform bins, empty if all bins are used
+		std::vector<TString> classes;
+		std::vector<BundleMethod> methods;
+	};
+
+	// Write the bundle, its hash is updated. File is written under a temporary name and renamed
+	Bool_t writeBundle(const char* filePath, Bundle& bundle);
+
+	// Read the memory-mapped bundle. Returns false if the file is not a bundle of this version or is corrupted
+	Bool_t readBundle(const char* filePath, Bundle& bundle);
+}
+
+#endif
@@ -5,8 +5,8 @@
 #include <TSystemDirectory.h>
 #include <TGClient.h>
 #include <TObjString.h>
-#include <TUUID.h>
 #include <TError.h>
+#include <TMemFile.h>
 // #include <TCanvas.h>
 
 #include <iostream>
@@ -55,14 +55,14 @@ TList* FileUtils::getFilePathsInDirectory(const char *dirPath, const char *ext)
     return fileNames;
 }
 
-TH1* FileUtils::tekWaveformToHist(const char *filePath) {
+Bool_t FileUtils::readTekWaveform(const char *filePath, std::vector<double> &time, std::vector<double> &ch1) {
     // Open waveform file
     std::ifstream myfile(filePath);
 
     // Check file opened successully
     if (!myfile) {
         std::cerr << "Error: file could not be opened" << std::endl;
-        exit(1);
+        return kFALSE;
     }
 
     // Skip header
@@ -75,8 +75,8 @@ TH1* FileUtils::tekWaveformToHist(const char *filePath) {
     }
 
     // Start reading values until EOF
-    std::vector<double> time;
-    std::vector<double> ch1;
+    time.clear();
+    ch1.clear();
     while (!myfile.eof()) {
         // Read first two columns
         double col1, col2;
@@ -93,13 +93,46 @@ TH1* FileUtils::tekWaveformToHist(const char *filePath) {
         myfile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
     }
     myfile.close();
+    return kTRUE;
+}
+
+TH1* FileUtils::tekWaveformToHist(const char *filePath) {
+    // Read waveform file
+    std::vector<double> time;
+    std::vector<double> ch1;
+    if (!readTekWaveform(filePath, time, ch1)) {
+        exit(1);
+    }
+    return waveformToHist(filePath, time, ch1);
+}
 
+TFile* FileUtils::loadFileToMemory(const char *filePath) {
+    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+    if (!file) {
+        Error("FileUtils::loadFileToMemory", "Cannot open \"%s\"", filePath);
+        return nullptr;
+    }
+    Long64_t size = file.tellg();
+    file.seekg(0);
+    std::vector<char> buffer(size);
+    if (!file.read(buffer.data(), size)) {
+        Error("FileUtils::loadFileToMemory", "Cannot read \"%s\"", filePath);
+        return nullptr;
+    }
+
+    // TMemFile keeps its own copy of the buffer
+    TFile *memFile = new TMemFile(filePath, buffer.data(), size, "READ");
+    if (memFile->IsZombie()) {
+        delete memFile;
+        return nullptr;
+    }
+    Info("FileUtils::loadFileToMemory", "Loaded \"%s\" into memory (%.1f MB)", filePath, size/1048576.);
+    return memFile;
+}
+
+TH1* FileUtils::waveformToHist(const char *filePath, const std::vector<double> &time, const std::vector<double> &ch1) {
     // Create histogram
-    TString histName = FileUtils::getFileNameNoExtensionFromPath(filePath);
-    TUUID uid = TUUID();
-    TString uidSuffix = uid.AsString();
-    histName += "_";
-    histName += uidSuffix(0, 4);
+    TString histName = StringUtils::getUniqueName(FileUtils::getFileNameNoExtensionFromPath(filePath));
 
     if (time.size() <= 2) {
         return nullptr;
@@ -133,6 +166,13 @@ TH1* FileUtils::tekWaveformToHist(const char *filePath) {
 //  return file;
 //}
 
+TString FileUtils::getAbsolutePath(const char *path) {
+    if (gSystem->IsAbsoluteFileName(path)) {
+        return path;
+    }
+    return gSystem->ConcatFileName(gSystem->WorkingDirectory(), path);
+}
+
 TString FileUtils::getFileNameFromPath(const char *fileNamePath) {
     // Get file path directory
     TString dirName = gSystem->DirName(fileNamePath);
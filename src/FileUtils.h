@@ -6,17 +6,32 @@
 #include <TFile.h>
 #include <TString.h>
 
+#include <vector>
+
 namespace FileUtils {
 
 	// Obtain list of all file paths in directory
 	TList* getFilePathsInDirectory(const char* dirPath = "", const char* ext = 0);
 
+	// Read time and voltage columns of the CSV waveform (thread-safe, no ROOT objects created)
+	Bool_t readTekWaveform(const char* fileName, std::vector<double>& time, std::vector<double>& voltage);
+
+	// Create ROOT histogram from the waveform columns (not thread-safe)
+	TH1* waveformToHist(const char* fileName, const std::vector<double>& time, const std::vector<double>& voltage);
+
 	// Import CSV waveform to ROOT histogram
 	TH1* tekWaveformToHist(const char* fileName);
 
+	// Read whole ROOT file into memory. No file descriptor is kept open, so the file can be shared by forked
+	// worker processes (pages are copied on write only). Returns nullptr if file cannot be read
+	TFile* loadFileToMemory(const char* filePath);
+
 	// Open file with checks
 	/// TFile* openFile(const char* fileName);
 
+	// Absolute path relative to the current working directory
+	TString getAbsolutePath(const char* path);
+
 	// Extract file name from path
 	TString getFileNameFromPath(const char* path);
 
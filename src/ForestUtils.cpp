@@ -0,0 +1,297 @@
+#include "./ForestUtils.h"
+
+#include <TXMLEngine.h>
+#include <TError.h>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace ForestUtils;
+
+namespace {
+	// Child element with given name
+	XMLNodePointer_t findChild(TXMLEngine& xml, XMLNodePointer_t node, const char* name){
+		for (XMLNodePointer_t child = xml.GetChild(node); child; child = xml.GetNext(child)){
+			if (TString(xml.GetNodeName(child)) == name) return child;
+		}
+		return nullptr;
+	}
+
+	// Value of the method option (<Option name="...">value</Option>), empty if not present
+	TString getOption(TXMLEngine& xml, XMLNodePointer_t root, const char* name){
+		XMLNodePointer_t options = findChild(xml, root, "Options");
+		for (XMLNodePointer_t option = options ? xml.GetChild(options) : nullptr; option; option = xml.GetNext(option)){
+			if (TString(xml.GetAttr(option, "name")) == name) return xml.GetNodeContent(option);
+		}
+		return "";
+	}
+
+	// Gini index of the node, p*(1-p) with signal purity p
+	Double_t getGiniIndex(Double_t s, Double_t b){
+		return (s > 0 && b > 0) ? s*b/((s + b)*(s + b)) : 0;
+	}
+
+	Double_t getAttr(TXMLEngine& xml, XMLNodePointer_t node, const char* name){
+		const char* value = xml.GetAttr(node, name);
+		return value ? std::atof(value) : 0;
+	}
+
+	// Nested if/else statements of the subtree
+	void writeNode(std::ofstream& file, const Forest& forest, Int_t node, Int_t depth){
+		TString indent(' ', 4*depth);
+		if (forest.nodeChildren[node] == node){
+			file << indent << TString::Format("return %a;", forest.nodeValues[node]) << std::endl;
+			return;
+		}
+		Int_t child = forest.nodeChildren[node];
+		file << indent << TString::Format("if (x[%d] >= %af) {", forest.nodeVariables[node], forest.nodeCuts[node]) << std::endl;
+		writeNode(file, forest, child + 1, depth + 1);
+		file << indent << "} else {" << std::endl;
+		writeNode(file, forest, child, depth + 1);
+		file << indent << "}" << std::endl;
+	}
+}
+
+Bool_t ForestUtils::readForest(const char* weightFilePath, Forest& forest){
+	forest = Forest();
+	TXMLEngine xml;
+	XMLDocPointer_t doc = xml.ParseFile(weightFilePath);
+	if (!doc){
+		Error("ForestUtils::readForest", "Cannot parse \"%s\"", weightFilePath);
+		return kFALSE;
+	}
+	XMLNodePointer_t root = xml.DocGetRootElement(doc);
+	Bool_t ok = kFALSE;
+	do {
+		if (!TString(xml.GetAttr(root, "Method")).BeginsWith("BDT::")){
+			Error("ForestUtils::readForest", "\"%s\" is not a BDT weight file", weightFilePath);
+			break;
+		}
+		XMLNodePointer_t transformations = findChild(xml, root, "Transformations");
+		if (transformations && getAttr(xml, transformations, "NTransformations") > 0){
+			Error("ForestUtils::readForest", "Variable transformations are not supported");
+			break;
+		}
+		XMLNodePointer_t weights = findChild(xml, root, "Weights");
+		if (!weights || getAttr(xml, weights, "AnalysisType") != 0){
+			Error("ForestUtils::readForest", "Only binary classification is supported");
+			break;
+		}
+		forest.gradBoost = getOption(xml, root, "BoostType") == "Grad";
+		TString useYesNoLeaf = getOption(xml, root, "UseYesNoLeaf");
+		useYesNoLeaf.ToLower();
+		Bool_t yesNoLeaf = useYesNoLeaf != "false" && useYesNoLeaf != "f" && useYesNoLeaf != "0";
+
+		XMLNodePointer_t variables = findChild(xml, root, "Variables");
+		for (XMLNodePointer_t variable = variables ? xml.GetChild(variables) : nullptr; variable; variable = xml.GetNext(variable)){
+			forest.variables.push_back(xml.GetAttr(variable, "Expression"));
+		}
+
+		// Trees are flattened breadth-first. Children of the node are placed next to each other, the child taken
+		// for values >= cut is the second one
+		Bool_t supported = kTRUE;
+		for (XMLNodePointer_t tree = xml.GetChild(weights); tree && supported; tree = xml.GetNext(tree)){
+			forest.treeWeights.push_back(getAttr(xml, tree, "boostWeight"));
+			forest.treeRoots.push_back(forest.nodeVariables.size());
+			forest.treeDepths.push_back(0);
+			std::vector<XMLNodePointer_t> queue { findChild(xml, tree, "Node") };
+			std::vector<Int_t> depths { 0 };
+			for (size_t i = 0; i < queue.size() && supported; i++){
+				XMLNodePointer_t node = queue[i];
+				forest.treeDepths.back() = std::max(forest.treeDepths.back(), depths[i]);
+				XMLNodePointer_t left = nullptr, right = nullptr;
+				for (XMLNodePointer_t child = xml.GetChild(node); child; child = xml.GetNext(child)){
+					if (TString(xml.GetAttr(child, "pos")) == "l") left = child;
+					if (TString(xml.GetAttr(child, "pos")) == "r") right = child;
+				}
+				Int_t nodeType = (Int_t) getAttr(xml, node, "nType");
+				if (nodeType != 0 || !left || !right){
+					forest.nodeVariables.push_back(0);
+					forest.nodeCuts.push_back(std::numeric_limits<Float_t>::quiet_NaN());
+					forest.nodeChildren.push_back(forest.treeRoots.back() + i);
+					// TMVA keeps the response and purity in single precision
+					forest.nodeValues.push_back(forest.gradBoost ? (Float_t) getAttr(xml, node, "res")
+						: (yesNoLeaf ? nodeType : (Float_t) getAttr(xml, node, "purity")));
+					continue;
+				}
+				// Fisher cuts (UseFisherCuts option) cut on a linear combination of the variables, not on one variable
+				Int_t variable = (Int_t) getAttr(xml, node, "IVar");
+				if (getAttr(xml, node, "NCoef") > 0 || variable < 0 || variable >= (Int_t) forest.variables.size()){
+					Error("ForestUtils::readForest", "Only cuts on single variables are supported (Fisher cuts are not)");
+					supported = kFALSE;
+					break;
+				}
+				// Cut type 1: "right" branch for values >= cut, otherwise for values < cut
+				Bool_t cutType = getAttr(xml, node, "cType") != 0;
+				forest.nodeVariables.push_back(variable);
+				forest.nodeCuts.push_back((Float_t) getAttr(xml, node, "Cut"));
+				forest.nodeChildren.push_back(forest.treeRoots.back() + queue.size());
+				forest.nodeValues.push_back(0);
+				queue.push_back(cutType ? left : right);
+				queue.push_back(cutType ? right : left);
+				depths.push_back(depths[i] + 1);
+				depths.push_back(depths[i] + 1);
+			}
+		}
+		ok = supported && forest.treeRoots.size() > 0;
+		if (ok){
+			Info("ForestUtils::readForest", "Read %zu trees with %zu nodes (%s) from \"%s\"", forest.treeRoots.size(), forest.nodeVariables.size(),
+				forest.gradBoost ? "gradient boosting" : "AdaBoost", weightFilePath);
+		}
+	} while (kFALSE);
+	xml.FreeDoc(doc);
+	return ok;
+}
+
+void ForestUtils::evaluate(const Forest& forest, const Float_t* inputs, Long64_t nEvents, Double_t* scores){
+	const Int_t blockSize = 64;
+	const Int_t nVariables = forest.variables.size();
+	const Int_t* nodeVariables = forest.nodeVariables.data();
+	const Float_t* nodeCuts = forest.nodeCuts.data();
+	const Int_t* nodeChildren = forest.nodeChildren.data();
+	const Double_t* nodeValues = forest.nodeValues.data();
+
+	Double_t norm = 0;
+	for (Double_t weight : forest.treeWeights) norm += weight;
+
+	Int_t nodes[blockSize];
+	Double_t sums[blockSize];
+	for (Long64_t start = 0; start < nEvents; start += blockSize){
+		Int_t n = (Int_t) std::min<Long64_t>(blockSize, nEvents - start);
+		const Float_t* x = inputs + start*nVariables;
+		std::fill(sums, sums + n, 0.);
+		for (size_t t = 0; t < forest.treeRoots.size(); t++){
+			std::fill(nodes, nodes + n, forest.treeRoots[t]);
+			// Branchless step: comparison result selects the child. Comparison with NaN cut keeps events in the leaves
+			for (Int_t level = 0; level < forest.treeDepths[t]; level++){
+				#pragma omp simd
+				for (Int_t i = 0; i < n; i++){
+					Int_t node = nodes[i];
+					nodes[i] = nodeChildren[node] + (x[i*nVariables + nodeVariables[node]] >= nodeCuts[node]);
+				}
+			}
+			if (forest.gradBoost){
+				for (Int_t i = 0; i < n; i++) sums[i] += nodeValues[nodes[i]];
+			} else {
+				Double_t weight = forest.treeWeights[t];
+				for (Int_t i = 0; i < n; i++) sums[i] += weight*nodeValues[nodes[i]];
+			}
+		}
+		for (Int_t i = 0; i < n; i++){
+			if (forest.gradBoost){
+				scores[start + i] = 2.0/(1.0 + std::exp(-2.0*sums[i])) - 1;
+			} else {
+				scores[start + i] = norm > std::numeric_limits<Double_t>::epsilon() ? sums[i]/norm : 0;
+			}
+		}
+	}
+}
+
+Bool_t ForestUtils::getVariableImportance(const Forest& forest, const Float_t* inputs, const Int_t* classes, Long64_t nEvents,
+		std::vector<Double_t>& importance){
+	const Int_t nVariables = forest.variables.size();
+	const Int_t nTrees = forest.treeRoots.size();
+	const Int_t nNodes = forest.nodeVariables.size();
+
+	// Signal and background events reaching every node
+	std::vector<Double_t> nSignal(nNodes, 0), nBackground(nNodes, 0);
+	for (Long64_t e = 0; e < nEvents; e++){
+		const Float_t* x = inputs + e*nVariables;
+		std::vector<Double_t>& counts = classes[e] == 0 ? nSignal : nBackground;
+		for (Int_t t = 0; t < nTrees; t++){
+			Int_t node = forest.treeRoots[t];
+			while (kTRUE){
+				counts[node]++;
+				Int_t child = forest.nodeChildren[node];
+				if (child == node) break;
+				node = child + (x[forest.nodeVariables[node]] >= forest.nodeCuts[node]);
+			}
+		}
+	}
+
+	importance.assign(nVariables, 0);
+	std::vector<Double_t> treeImportance(nVariables);
+	for (Int_t t = 0; t < nTrees; t++){
+		std::fill(treeImportance.begin(), treeImportance.end(), 0);
+		Double_t treeSum = 0;
+		Int_t last = t + 1 < nTrees ? forest.treeRoots[t+1] : nNodes;
+		for (Int_t node = forest.treeRoots[t]; node < last; node++){
+			Int_t child = forest.nodeChildren[node];
+			Double_t n = nSignal[node] + nBackground[node];
+			if (child == node || n == 0) continue;
+			Double_t gain = getGiniIndex(nSignal[node], nBackground[node])*n
+				- getGiniIndex(nSignal[child], nBackground[child])*(nSignal[child] + nBackground[child])
+				- getGiniIndex(nSignal[child+1], nBackground[child+1])*(nSignal[child+1] + nBackground[child+1]);
+			treeImportance[forest.nodeVariables[node]] += gain*n;
+			treeSum += gain*n;
+		}
+		if (treeSum <= 0) continue;
+		for (Int_t i = 0; i < nVariables; i++){
+			importance[i] += forest.treeWeights[t]*treeImportance[i]/treeSum;
+		}
+	}
+
+	Double_t sum = 0;
+	for (Double_t& value : importance){
+		value = std::sqrt(std::max(value, 0.));
+		sum += value;
+	}
+	if (!(sum > 0)) return kFALSE;
+	for (Double_t& value : importance) value /= sum;
+	return kTRUE;
+}
+
+Bool_t ForestUtils::writeSource(const Forest& forest, const char* sourceFilePath, const char* comment){
+	std::ofstream file(sourceFilePath);
+	if (!file.is_open()){
+		Error("ForestUtils::writeSource", "Cannot write \"%s\"", sourceFilePath);
+		return kFALSE;
+	}
+	file << "// " << comment << std::endl;
+	file << "// Generated by dual-readout-tmva, do not edit. Constants are written in hexadecimal notation to keep them exact" << std::endl;
+	file << std::endl << "#include <cmath>" << std::endl << std::endl;
+	file << "namespace {" << std::endl;
+	Int_t nTrees = forest.treeRoots.size();
+	for (Int_t t = 0; t < nTrees; t++){
+		file << "double tree" << t << "(const float* x) {" << std::endl;
+		writeNode(file, forest, forest.treeRoots[t], 1);
+		file << "}" << std::endl << std::endl;
+	}
+	file << "const char* variables[] = {";
+	for (size_t i = 0; i < forest.variables.size(); i++){
+		file << (i % 8 == 0 ? "\n    " : " ") << "\"" << forest.variables[i] << "\",";
+	}
+	file << std::endl << "};" << std::endl;
+	file << "}" << std::endl << std::endl;
+
+	Int_t nVariables = forest.variables.size();
+	file << "extern \"C\" int tmvaNVariables() {" << std::endl;
+	file << "    return " << nVariables << ";" << std::endl << "}" << std::endl << std::endl;
+	file << "extern \"C\" const char* tmvaVariable(int i) {" << std::endl;
+	file << "    return variables[i];" << std::endl << "}" << std::endl << std::endl;
+
+	// Same summation order as TMVA::MethodBDT
+	file << "extern \"C\" void tmvaEvaluate(const float* inputs, long long nEvents, double* scores) {" << std::endl;
+	file << "    for (long long i = 0; i < nEvents; i++) {" << std::endl;
+	file << "        const float* x = inputs + i*" << nVariables << ";" << std::endl;
+	file << "        double sum = 0, norm = 0;" << std::endl;
+	for (Int_t t = 0; t < nTrees; t++){
+		if (forest.gradBoost){
+			file << "        sum += tree" << t << "(x);" << std::endl;
+		} else {
+			file << TString::Format("        sum += %a*tree%d(x);", forest.treeWeights[t], t) << std::endl;
+			file << TString::Format("        norm += %a;", forest.treeWeights[t]) << std::endl;
+		}
+	}
+	if (forest.gradBoost){
+		file << "        scores[i] = 2.0/(1.0 + std::exp(-2.0*sum)) - 1;" << std::endl;
+	} else {
+		file << "        scores[i] = norm > 2.220446049250313e-16 ? sum/norm : 0;" << std::endl;
+	}
+	file << "    }" << std::endl << "}" << std::endl;
+	return kTRUE;
+}
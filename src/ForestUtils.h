@@ -0,0 +1,47 @@
+#ifndef ForestUtils_hh
+#define ForestUtils_hh 1
+
+#include <TString.h>
+
+#include <vector>
+
+// Boosted decision trees of the TMVA BDT weight file in flat (structure of arrays) node tables. Nodes of every tree
+// are stored breadth-first, children of a node are adjacent: first child is taken if value < cut, second if
+// value >= cut. Leaves point to themselves with NaN cut, so the traversal runs a fixed number of levels per tree
+
+namespace ForestUtils {
+	struct Forest {
+		std::vector<TString> variables;     // input variable names
+		Bool_t gradBoost = kFALSE;          // gradient boosting: 2/(1 + exp(-2*sum)) - 1, AdaBoost: weighted mean of leaf values
+		std::vector<Double_t> treeWeights;  // boost weights
+		std::vector<Int_t> treeRoots;       // index of the root node of every tree
+		std::vector<Int_t> treeDepths;      // number of cuts on the longest path
+		std::vector<Int_t> nodeVariables;   // index of the cut variable
+		std::vector<Float_t> nodeCuts;
+		std::vector<Int_t> nodeChildren;    // index of the first child, own index for leaves
+		std::vector<Double_t> nodeValues;   // leaf value (node type, purity or gradient boosting response)
+	};
+
+	// Read trees of the binary classification BDT without variable transformations. Returns false if the weight
+	// file holds another method or configuration
+	Bool_t readForest(const char* weightFilePath, Forest& forest);
+
+	// Evaluate the forest over nEvents input rows (nEvents x nVariables, row-major). Events are processed in blocks,
+	// every tree descends all events of the block level by level. Scores are summed in the tree order of TMVA::MethodBDT
+	void evaluate(const Forest& forest, const Float_t* inputs, Long64_t nEvents, Double_t* scores);
+
+	// Variable importance as in TMVA::MethodBDT::GetVariableImportance: Gini separation gain of every cut times the
+	// squared number of events in the node, normalized per tree and summed with the boost weights. Weight files hold
+	// no event counts, so the counts come from passing the given events (nEvents x nVariables, classes 0 - signal,
+	// 1 - background) down the trees. Returns false if none of the cuts separates the events
+	Bool_t getVariableImportance(const Forest& forest, const Float_t* inputs, const Int_t* classes, Long64_t nEvents,
+			std::vector<Double_t>& importance);
+
+	// Write C++ source of the standalone response function (trees as nested if/else statements). Entry points:
+	//   extern "C" int tmvaNVariables();
+	//   extern "C" const char* tmvaVariable(int i);
+	//   extern "C" void tmvaEvaluate(const float* inputs, long long nEvents, double* scores);
+	Bool_t writeSource(const Forest& forest, const char* sourceFilePath, const char* comment);
+}
+
+#endif
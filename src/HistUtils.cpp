@@ -1,9 +1,20 @@
 #include "./HistUtils.h"
 #include "./FileUtils.h"
+#include "./KernelUtils.h"
+#include "./StringUtils.h"
 
 #include <TRandom3.h>
+#include <TVectorD.h>
+#include <TError.h>
+#include <TMath.h>
 
+#include <algorithm>
 #include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
 
 using namespace HistUtils;
 
@@ -117,6 +128,19 @@ TTree* HistUtils::histsToTreeXY(TList* hists, const char* treeName, const char*
 	return tree;
 }
 
+void HistUtils::histToBuffer(TH1* hist, Float_t* buffer){
+	Int_t nBins = hist->GetNbinsX();
+	// Read the bin storage directly (bin 0 is the underflow), prepared histograms are TH1D
+	if (TArrayD* array = dynamic_cast<TArrayD*>(hist)){
+		const Double_t* contents = array->GetArray() + 1;
+		for (Int_t i = 0; i < nBins; i++) buffer[i] = contents[i];
+	} else if (TArrayF* array = dynamic_cast<TArrayF*>(hist)){
+		std::copy(array->GetArray() + 1, array->GetArray() + 1 + nBins, buffer);
+	} else {
+		for (Int_t i = 0; i < nBins; i++) buffer[i] = hist->GetBinContent(i+1);
+	}
+}
+
 TH1* HistUtils::cropHistogram(TH1* hist, Double_t minX, Double_t maxX){
 	Int_t minBin = hist->GetXaxis()->FindBin(minX);
 	if (minBin == 0) minBin = 1;
@@ -128,11 +152,7 @@ TH1* HistUtils::cropHistogram(TH1* hist, Double_t minX, Double_t maxX){
 }
 
 TH1* HistUtils::cropHistogram(TH1* hist, Int_t minBin, Int_t maxBin){
-	TString histName = hist->GetName();
-	TUUID uid = TUUID();
-	TString uidSuffix = uid.AsString();
-	histName += "_";
-	histName += uidSuffix(0,4);
+	TString histName = StringUtils::getUniqueName(hist->GetName());
 
 	TString histTitle = hist->GetTitle();
 	histTitle += " (cropped)";
@@ -160,11 +180,117 @@ void HistUtils::invertHist(TH1* hist){
 	}
 }
 
+TH1* HistUtils::decimateHist(TH1* hist, Int_t factor){
+	Int_t nBins = hist->GetNbinsX();
+	std::vector<Float_t> in(nBins);
+	for (Int_t i = 0; i < nBins; i++){
+		in[i] = hist->GetBinContent(i+1);
+	}
+
+	// Cutoff at the Nyquist frequency of the downsampled waveform. Even factors get an even number of taps, so the
+	// filter is centered between the two middle samples of the block without a half-sample delay
+	Int_t nTaps = 4*factor + factor%2;
+	std::vector<Float_t> taps(nTaps);
+	KernelUtils::designLowPass(taps.data(), nTaps, 0.5/factor);
+
+	std::vector<Float_t> out(nBins/factor);
+	Int_t nOut = KernelUtils::firDecimate(in.data(), nBins, taps.data(), nTaps, factor, out.data());
+
+	TString histName = StringUtils::getUniqueName(hist->GetName());
+
+	TString histTitle = hist->GetTitle();
+	histTitle += TString::Format(" (decimated x%d)", factor);
+	Double_t lowEdge = hist->GetXaxis()->GetBinLowEdge(1);
+	Double_t upEdge = hist->GetXaxis()->GetBinLowEdge(nOut*factor + 1);
+	TH1* decimatedHist = new TH1D(histName.Data(), histTitle.Data(), nOut, lowEdge, upEdge);
+	for (Int_t j = 0; j < nOut; j++){
+		decimatedHist->SetBinContent(j+1, out[j]);
+	}
+
+	return decimatedHist;
+}
+
+void HistUtils::alignWaveform(Float_t* buffer, Int_t n, Double_t firstBinCenter, Double_t binWidth){
+	Double_t index = KernelUtils::cfdTime(buffer, n, alignFraction);
+	if (index < 0) return;
+
+	Double_t shift = (alignTimeSeconds - (firstBinCenter + index*binWidth))/binWidth;
+	std::vector<Float_t> in(buffer, buffer + n);
+	KernelUtils::fractionalShift(in.data(), buffer, n, shift, alignCubic);
+}
+
+void HistUtils::alignHist(TH1* hist){
+	Int_t nBins = hist->GetNbinsX();
+	std::vector<Float_t> buffer(nBins);
+	for (Int_t i = 0; i < nBins; i++){
+		buffer[i] = hist->GetBinContent(i+1);
+	}
+	alignWaveform(buffer.data(), nBins, hist->GetXaxis()->GetBinCenter(1), hist->GetXaxis()->GetBinWidth(1));
+	for (Int_t i = 0; i < nBins; i++){
+		hist->SetBinContent(i+1, buffer[i]);
+	}
+}
+
+Double_t HistUtils::leftEdgeSeconds = -1;        // [s], before the first sample - no crop on the left
 Double_t HistUtils::rightEdgeSeconds = 300E-9; // [s]
+Int_t HistUtils::decimationFactor = 1;
+Double_t HistUtils::alignFraction = 0;
+Double_t HistUtils::alignTimeSeconds = 0; // [s]
+Bool_t HistUtils::alignCubic = kFALSE;
+Bool_t HistUtils::rejectPileup = kFALSE;
+Double_t HistUtils::voltageThreshold = -0.03; // [V]
+Double_t HistUtils::minPeakSeconds = -1E-8;    // [s]
+Double_t HistUtils::maxPeakSeconds = 2E-8;     // [s]
+
+Bool_t HistUtils::writeNoiseCuts(const char* filePath){
+	std::ofstream file(filePath);
+	if (!file.is_open()){
+		Error("HistUtils::writeNoiseCuts", "Cannot write file \"%s\"", filePath);
+		return kFALSE;
+	}
+	file << "# Noise waveform cuts: \"good\" waveform minimum is below voltageThreshold [V] inside minPeakPosition ... maxPeakPosition [s]" << std::endl;
+	file << std::setprecision(6);
+	file << "voltageThreshold " << voltageThreshold << std::endl;
+	file << "minPeakPosition " << minPeakSeconds << std::endl;
+	file << "maxPeakPosition " << maxPeakSeconds << std::endl;
+	return kTRUE;
+}
+
+Bool_t HistUtils::readNoiseCuts(const char* filePath){
+	std::ifstream file(filePath);
+	if (!file.is_open()) return kFALSE;
+	std::string line;
+	while (std::getline(file, line)){
+		std::istringstream stream(line);
+		std::string name;
+		Double_t value;
+		if (!(stream >> name) || name[0] == '#') continue;
+		if (!(stream >> value)){
+			Warning("HistUtils::readNoiseCuts", "No value for \"%s\" in \"%s\"", name.c_str(), filePath);
+			continue;
+		}
+		if (name == "voltageThreshold") voltageThreshold = value;
+		else if (name == "minPeakPosition") minPeakSeconds = value;
+		else if (name == "maxPeakPosition") maxPeakSeconds = value;
+		else Warning("HistUtils::readNoiseCuts", "Unknown cut \"%s\" in \"%s\"", name.c_str(), filePath);
+	}
+	Info("HistUtils::readNoiseCuts", "Noise cuts from \"%s\": minimum voltage < %.3f V, peak position %.2e ... %.2e s", filePath, voltageThreshold,
+		minPeakSeconds, maxPeakSeconds);
+	return kTRUE;
+}
 
 TH1* HistUtils::prepHistForTMVA(TH1* hist){
 	invertHist(hist);
-	TH1* croppedHist = HistUtils::cropHistogram(hist, hist->GetXaxis()->GetBinCenter(1), rightEdgeSeconds);
+	if (alignFraction > 0){
+		alignHist(hist);
+	}
+	Double_t leftEdge = TMath::Max(leftEdgeSeconds, hist->GetXaxis()->GetBinCenter(1));
+	TH1* croppedHist = HistUtils::cropHistogram(hist, leftEdge, rightEdgeSeconds);
+	if (decimationFactor > 1){
+		TH1* decimatedHist = HistUtils::decimateHist(croppedHist, decimationFactor);
+		delete croppedHist;
+		return decimatedHist;
+	}
 	return croppedHist;
 }
 
@@ -178,3 +304,63 @@ TList* HistUtils::prepHistsForTMVA(TList* histsList){
 	}
 	return preppedHistsList;
 }
+
+void HistUtils::writeParameters(TDirectory* dir){
+	TVectorD decimation(1);
+	decimation[0] = decimationFactor;
+	dir->WriteObject(&decimation, "decimation");
+
+	TVectorD window(2);
+	window[0] = leftEdgeSeconds;
+	window[1] = rightEdgeSeconds;
+	dir->WriteObject(&window, "window");
+
+	TVectorD alignment(3);
+	alignment[0] = alignFraction;
+	alignment[1] = alignTimeSeconds;
+	alignment[2] = alignCubic;
+	dir->WriteObject(&alignment, "alignment");
+
+	TVectorD pileup(1);
+	pileup[0] = rejectPileup;
+	dir->WriteObject(&pileup, "pileup");
+
+	TVectorD noiseCuts(3);
+	noiseCuts[0] = voltageThreshold;
+	noiseCuts[1] = minPeakSeconds;
+	noiseCuts[2] = maxPeakSeconds;
+	dir->WriteObject(&noiseCuts, "noiseCuts");
+}
+
+void HistUtils::readParameters(TDirectory* dir){
+	if (!dir) return;
+	// Parameters missing in files written by older versions keep their default values
+	if (TVectorD* decimation = dir->Get<TVectorD>("decimation")){
+		decimationFactor = (Int_t)(*decimation)[0];
+	}
+	if (TVectorD* window = dir->Get<TVectorD>("window")){
+		leftEdgeSeconds = (*window)[0];
+		rightEdgeSeconds = (*window)[1];
+	}
+	if (TVectorD* alignment = dir->Get<TVectorD>("alignment")){
+		alignFraction = (*alignment)[0];
+		alignTimeSeconds = (*alignment)[1];
+		alignCubic = (*alignment)[2] != 0;
+	}
+	if (TVectorD* pileup = dir->Get<TVectorD>("pileup")){
+		rejectPileup = (*pileup)[0] != 0;
+	}
+	if (TVectorD* noiseCuts = dir->Get<TVectorD>("noiseCuts")){
+		voltageThreshold = (*noiseCuts)[0];
+		minPeakSeconds = (*noiseCuts)[1];
+		maxPeakSeconds = (*noiseCuts)[2];
+		Info("HistUtils::readParameters", "Noise cuts: minimum voltage < %.3f V, peak position %.2e ... %.2e s", voltageThreshold, minPeakSeconds, maxPeakSeconds);
+	}
+	Info("HistUtils::readParameters", "Waveform window: %.3e ... %.3e s, decimation factor: %d", leftEdgeSeconds, rightEdgeSeconds, decimationFactor);
+	if (alignFraction > 0){
+		Info("HistUtils::readParameters", "Waveforms aligned at %.3e s (constant fraction %.2f, %s interpolation)", alignTimeSeconds, alignFraction, alignCubic ? "cubic" : "linear");
+	}
+	if (rejectPileup){
+		Info("HistUtils::readParameters", "Pile-up waveforms are rejected");
+	}
+}
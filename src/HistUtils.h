@@ -4,6 +4,7 @@
 #include <TH1.h>
 #include <TList.h>
 #include <TTree.h>
+#include <TDirectory.h>
 
 //enum class VarNamingPattern {
 //	varN,
@@ -20,6 +21,9 @@ namespace HistUtils {
 	TTree* histsToTree(TList* hists, const char* treeName, const char* treeTitle);
 	TTree* histsToTreeXY(TList* hists, const char* treeName, const char* treeTitle);
 
+	// Copy bin contents (without underflow and overflow) to a buffer of GetNbinsX() floats
+	void histToBuffer(TH1* hist, Float_t* buffer);
+
 	// Invert histogram
 	void invertHist(TH1* hist);
 
@@ -27,11 +31,39 @@ namespace HistUtils {
 	TH1* cropHistogram(TH1* hist, Double_t minX, Double_t maxX);
 	TH1* cropHistogram(TH1* hist, Int_t minBin, Int_t maxBin);
 
+	extern Double_t leftEdgeSeconds;  // [s]
 	extern Double_t rightEdgeSeconds; // [s]
+	extern Int_t decimationFactor;    // 1 - no decimation
+
+	extern Double_t alignFraction;    // constant fraction for pulse timing, 0 - no alignment
+	extern Double_t alignTimeSeconds; // [s], common pulse time after alignment
+	extern Bool_t alignCubic;         // cubic instead of linear interpolation
+	extern Bool_t rejectPileup;       // drop waveforms with more than one pulse
+
+	// Noise waveform cuts: "good" waveform has minimum below the voltage threshold inside the peak window
+	extern Double_t voltageThreshold; // [V]
+	extern Double_t minPeakSeconds;   // [s]
+	extern Double_t maxPeakSeconds;   // [s]
+
+	// Write and read noise cuts config file ("name value" lines, "#" starts a comment). Returns false if file
+	// cannot be opened
+	Bool_t writeNoiseCuts(const char* filePath);
+	Bool_t readNoiseCuts(const char* filePath);
 
-	// Prepare histogram for machine learning analysis (invert and crop)
+	// Low-pass filter (anti-alias FIR) and downsample histogram by an integer factor
+	TH1* decimateHist(TH1* hist, Int_t factor);
+
+	// Shift inverted waveform buffer so its constant fraction time is at alignTimeSeconds
+	void alignWaveform(Float_t* buffer, Int_t n, Double_t firstBinCenter, Double_t binWidth);
+	void alignHist(TH1* hist);
+
+	// Prepare histogram for machine learning analysis (invert, align, crop and decimate)
 	TH1* prepHistForTMVA(TH1* hist);
 	TList* prepHistsForTMVA(TList* histsList);
+
+	// Write and read preprocessing parameters (noise cuts included) so that later stages apply the same transform
+	void writeParameters(TDirectory* dir);
+	void readParameters(TDirectory* dir);
 }
 
 #endif
@@ -0,0 +1,225 @@
+#include "./InferenceUtils.h"
+
+#include <TError.h>
+#include <TXMLEngine.h>
+#include <TMVA/Reader.h>
+#include <TMVA/MethodBase.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <dlfcn.h>
+
+using namespace InferenceUtils;
+
+Bool_t InferenceUtils::loadMethod(const char* weightFilePath, const char* methodName, Method& method){
+	std::ifstream file(weightFilePath);
+	if (!file.is_open()){
+		Error("InferenceUtils::loadMethod", "Cannot read weight file \"%s\"", weightFilePath);
+		return kFALSE;
+	}
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	method.name = methodName;
+	method.filePath = weightFilePath;
+	method.weights = buffer.str();
+
+	// Method type is the first part of the "Method" attribute of the setup node, e.g. Method="BDT::BDT"
+	size_t start = method.weights.find("Method=\"");
+	size_t end = start == std::string::npos ? start : method.weights.find("::", start);
+	if (end == std::string::npos){
+		Error("InferenceUtils::loadMethod", "Method type not found in \"%s\"", weightFilePath);
+		return kFALSE;
+	}
+	method.type = TMVA::Types::Instance().GetMethodType(method.weights.substr(start + 8, end - start - 8).c_str());
+	return kTRUE;
+}
+
+Bool_t InferenceUtils::getVariables(const Method& method, std::vector<TString>& variables){
+	variables.clear();
+	TXMLEngine xml;
+	XMLDocPointer_t doc = xml.ParseString(method.weights.c_str());
+	if (!doc) return kFALSE;
+	XMLNodePointer_t root = xml.DocGetRootElement(doc);
+	for (XMLNodePointer_t node = xml.GetChild(root); node; node = xml.GetNext(node)){
+		if (TString(xml.GetNodeName(node)) != "Variables") continue;
+		for (XMLNodePointer_t variable = xml.GetChild(node); variable; variable = xml.GetNext(variable)){
+			variables.push_back(xml.GetAttr(variable, "Expression"));
+		}
+	}
+	xml.FreeDoc(doc);
+	return variables.size() > 0;
+}
+
+Bool_t InferenceUtils::loadPlugin(const char* libraryFilePath, const char* methodName, const std::vector<TString>& variables, Method& method){
+	void* library = dlopen(libraryFilePath, RTLD_NOW | RTLD_LOCAL);
+	if (!library){
+		Error("InferenceUtils::loadPlugin", "Cannot load \"%s\": %s", libraryFilePath, dlerror());
+		return kFALSE;
+	}
+	typedef int (*NVariablesFunc)();
+	typedef const char* (*VariableFunc)(int);
+	NVariablesFunc nVariablesFunc = (NVariablesFunc) dlsym(library, "tmvaNVariables");
+	VariableFunc variableFunc = (VariableFunc) dlsym(library, "tmvaVariable");
+	PluginFunc plugin = (PluginFunc) dlsym(library, "tmvaEvaluate");
+	if (!nVariablesFunc || !variableFunc || !plugin){
+		Error("InferenceUtils::loadPlugin", "\"%s\" is not a method plugin", libraryFilePath);
+		dlclose(library);
+		return kFALSE;
+	}
+
+	// Plugin compiled for another variable list (e.g. other projection or pruned bins) would silently give wrong scores
+	Bool_t match = nVariablesFunc() == (int) variables.size();
+	for (size_t i = 0; match && i < variables.size(); i++){
+		match = variables[i] == variableFunc(i);
+	}
+	if (!match){
+		Error("InferenceUtils::loadPlugin", "Input variables of \"%s\" do not match the prepared waveforms", libraryFilePath);
+		dlclose(library);
+		return kFALSE;
+	}
+
+	method.name = methodName;
+	method.filePath = libraryFilePath;
+	method.type = TMVA::Types::kPlugins;
+	method.weights.clear();
+	method.nOutputs = 1;
+	method.plugin = plugin;
+	return kTRUE;
+}
+
+Bool_t InferenceUtils::loadForest(const char* weightFilePath, const char* methodName, const std::vector<TString>& variables, Method& method){
+	std::shared_ptr<ForestUtils::Forest> forest = std::make_shared<ForestUtils::Forest>();
+	if (!ForestUtils::readForest(weightFilePath, *forest)) return kFALSE;
+	if (forest->variables != variables){
+		Error("InferenceUtils::loadForest", "Input variables of \"%s\" do not match the prepared waveforms", weightFilePath);
+		return kFALSE;
+	}
+	method.name = methodName;
+	method.filePath = weightFilePath;
+	method.type = TMVA::Types::kBDT;
+	method.weights.clear();
+	method.nOutputs = 1;
+	method.forest = forest;
+	return kTRUE;
+}
+
+Bool_t InferenceUtils::loadNetwork(const char* weightFilePath, const char* methodName, const std::vector<TString>& variables, Method& method,
+		const char* inputScalesFilePath){
+	std::shared_ptr<NetworkUtils::Network> network = std::make_shared<NetworkUtils::Network>();
+	if (!NetworkUtils::readNetwork(weightFilePath, *network)) return kFALSE;
+	if (network->variables != variables){
+		Error("InferenceUtils::loadNetwork", "Input variables of \"%s\" do not match the prepared waveforms", weightFilePath);
+		return kFALSE;
+	}
+	if (inputScalesFilePath){
+		std::vector<Float_t> inputScales;
+		if (!NetworkUtils::readInputScales(inputScalesFilePath, weightFilePath, inputScales) || inputScales.size() != network->layers.size()){
+			Error("InferenceUtils::loadNetwork", "Cannot read int8 input scales of \"%s\" from \"%s\"", weightFilePath, inputScalesFilePath);
+			return kFALSE;
+		}
+		NetworkUtils::quantize(*network, inputScales);
+	}
+	method.name = methodName;
+	method.filePath = weightFilePath;
+	method.type = TMVA::Types::kDL;
+	method.weights.clear();
+	method.nOutputs = 1;
+	method.network = network;
+	return kTRUE;
+}
+
+Bool_t InferenceUtils::createEvaluator(const std::vector<Method>& methods, const std::vector<TString>& variables, Evaluator& evaluator){
+	evaluator.reader = std::make_shared<TMVA::Reader>("!Color:Silent");
+	evaluator.values.assign(variables.size(), 0);
+	evaluator.methods.clear();
+	for (size_t i = 0; i < variables.size(); i++){
+		evaluator.reader->AddVariable(variables[i], &evaluator.values[i]);
+	}
+
+	for (const Method& method : methods){
+		if (!method.usesReader()){
+			evaluator.methods.push_back(nullptr);
+			continue;
+		}
+		// Cross-validation ensemble locates the fold weight files next to its own weight file
+		TMVA::IMethod* imethod = method.type == TMVA::Types::kCrossValidation ? evaluator.reader->BookMVA(method.name, method.filePath)
+			: evaluator.reader->BookMVA(method.type, method.weights.c_str());
+		TMVA::MethodBase* methodBase = dynamic_cast<TMVA::MethodBase*>(imethod);
+		if (!methodBase){
+			Error("InferenceUtils::createEvaluator", "Cannot book method %s", method.name.Data());
+			return kFALSE;
+		}
+		evaluator.methods.push_back(methodBase);
+	}
+	return kTRUE;
+}
+
+void InferenceUtils::updateOutputs(std::vector<Method>& methods, const Evaluator& evaluator){
+	for (size_t m = 0; m < methods.size(); m++){
+		TMVA::MethodBase* methodBase = evaluator.methods[m];
+		if (methodBase){
+			methods[m].nOutputs = methodBase->GetAnalysisType() == TMVA::Types::kMulticlass ? methodBase->DataInfo().GetNClasses() : 1;
+		}
+	}
+}
+
+Int_t InferenceUtils::getNScores(const std::vector<Method>& methods){
+	Int_t nScores = 0;
+	for (const Method& method : methods) nScores += method.nOutputs;
+	return nScores;
+}
+
+void InferenceUtils::evaluateMethod(Evaluator& evaluator, const std::vector<Method>& methods, size_t m, const Float_t* inputs, Long64_t nEvents,
+		Double_t* scores){
+	const Method& method = methods[m];
+	if (method.plugin){
+		method.plugin(inputs, nEvents, scores);
+	} else if (method.forest){
+		ForestUtils::evaluate(*method.forest, inputs, nEvents, scores);
+	} else if (method.network){
+		NetworkUtils::evaluate(*method.network, inputs, nEvents, scores);
+	} else {
+		Int_t nVariables = evaluator.values.size();
+		for (Long64_t i = 0; i < nEvents; i++){
+			std::copy(inputs + i*nVariables, inputs + (i + 1)*nVariables, evaluator.values.begin());
+			scores[i] = evaluator.reader->EvaluateMVA(evaluator.methods[m]);
+		}
+	}
+}
+
+void InferenceUtils::evaluateBatch(Evaluator& evaluator, const std::vector<Method>& methods, const Float_t* inputs, Long64_t nEvents, Float_t* scores){
+	Int_t nVariables = evaluator.values.size();
+	Int_t nScores = getNScores(methods);
+
+	// Compiled and native methods evaluate the whole batch at once
+	Bool_t hasReaderMethods = kFALSE;
+	Int_t column = 0;
+	for (size_t m = 0; m < methods.size(); m++){
+		if (methods[m].usesReader()){
+			hasReaderMethods = kTRUE;
+		} else {
+			evaluator.nativeScores.resize(nEvents);
+			evaluateMethod(evaluator, methods, m, inputs, nEvents, evaluator.nativeScores.data());
+			for (Long64_t i = 0; i < nEvents; i++) scores[i*nScores + column] = evaluator.nativeScores[i];
+		}
+		column += methods[m].nOutputs;
+	}
+	if (!hasReaderMethods) return;
+
+	for (Long64_t i = 0; i < nEvents; i++){
+		// Methods read the event from the variables bound to the reader
+		std::copy(inputs + i*nVariables, inputs + (i + 1)*nVariables, evaluator.values.begin());
+		Float_t* row = scores + i*nScores;
+		for (size_t m = 0; m < methods.size(); m++){
+			if (!methods[m].usesReader()){
+				row++;
+			} else if (methods[m].nOutputs > 1){
+				const std::vector<Float_t>& values = evaluator.reader->EvaluateMulticlass(evaluator.methods[m]);
+				row = std::copy(values.begin(), values.begin() + methods[m].nOutputs, row);
+			} else {
+				*row++ = evaluator.reader->EvaluateMVA(evaluator.methods[m]);
+			}
+		}
+	}
+}
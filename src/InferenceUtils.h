@@ -0,0 +1,87 @@
+#ifndef InferenceUtils_hh
+#define InferenceUtils_hh 1
+
+#include <TString.h>
+#include <TMVA/Types.h>
+
+#include "./ForestUtils.h"
+#include "./NetworkUtils.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace TMVA {
+	class Reader;
+	class MethodBase;
+}
+
+// Batch evaluation of the trained methods over the prepared waveforms. Inputs and scores are contiguous row-major
+// matrices (nEvents x nVariables and nEvents x nScores)
+
+namespace InferenceUtils {
+	// Response function of the compiled method plugin (ForestUtils::writeSource)
+	typedef void (*PluginFunc)(const float* inputs, long long nEvents, double* scores);
+
+	// Trained method. Weight file is read once and shared by all evaluators
+	struct Method {
+		TString name;
+		TString filePath;
+		TMVA::Types::EMVA type = TMVA::Types::kVariable;
+		std::string weights;         // weight file contents (XML)
+		Int_t nOutputs = 1;          // one score for classification, one per class for multiclass methods
+		PluginFunc plugin = nullptr; // compiled method, evaluated without the TMVA reader
+		std::shared_ptr<const ForestUtils::Forest> forest;      // native BDT engine, evaluated without the TMVA reader
+		std::shared_ptr<const NetworkUtils::Network> network;  // native dense network engine
+
+		// Method is booked in the TMVA reader
+		Bool_t usesReader() const { return !plugin && !forest && !network; }
+	};
+
+	// Methods booked in own TMVA::Reader with own bound variable array. TMVA::Reader is not thread-safe,
+	// every thread evaluates with its own evaluator
+	struct Evaluator {
+		std::shared_ptr<TMVA::Reader> reader;
+		std::vector<Float_t> values;
+		std::vector<TMVA::MethodBase*> methods;    // nullptr for methods evaluated without the reader
+		std::vector<Double_t> nativeScores;
+	};
+
+	// Read the weight file and method type
+	Bool_t loadMethod(const char* weightFilePath, const char* methodName, Method& method);
+
+	// Names of the input variables listed in the weight file of the method
+	Bool_t getVariables(const Method& method, std::vector<TString>& variables);
+
+	// Load the compiled method plugin (shared library). Input variables of the plugin must match the variables.
+	// Library stays loaded until the program exits
+	Bool_t loadPlugin(const char* libraryFilePath, const char* methodName, const std::vector<TString>& variables, Method& method);
+
+	// Load the BDT weight file into the native engine. Input variables of the forest must match the variables
+	Bool_t loadForest(const char* weightFilePath, const char* methodName, const std::vector<TString>& variables, Method& method);
+
+	// Load the deep learning weight file of the dense network into the native engine. Network is quantized to int8 if
+	// the file with calibrated input scales ("quantize-dnn" mode) is given
+	Bool_t loadNetwork(const char* weightFilePath, const char* methodName, const std::vector<TString>& variables, Method& method,
+		const char* inputScalesFilePath = nullptr);
+
+	// Book methods from the loaded weight files. Methods are not modified, so threads can book their own evaluators
+	// from the shared method list at the same time
+	Bool_t createEvaluator(const std::vector<Method>& methods, const std::vector<TString>& variables, Evaluator& evaluator);
+
+	// Update number of outputs of the methods booked in the evaluator (known only after the booking)
+	void updateOutputs(std::vector<Method>& methods, const Evaluator& evaluator);
+
+	// Total number of scores of the methods (columns of the score matrix)
+	Int_t getNScores(const std::vector<Method>& methods);
+
+	// Scores of the binary method m over nEvents input rows in double precision, as returned by the engine before
+	// the cast to the score matrix. Methods evaluated without the reader do not use the evaluator
+	void evaluateMethod(Evaluator& evaluator, const std::vector<Method>& methods, size_t m, const Float_t* inputs, Long64_t nEvents,
+		Double_t* scores);
+
+	// Evaluate every method over nEvents input rows. Columns of the score matrix follow the method order
+	void evaluateBatch(Evaluator& evaluator, const std::vector<Method>& methods, const Float_t* inputs, Long64_t nEvents, Float_t* scores);
+}
+
+#endif
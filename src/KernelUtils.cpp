@@ -0,0 +1,379 @@
+#include "./KernelUtils.h"
+
+#include <TMath.h>
+#include <TString.h>
+
+#include <cstring>
+#include <vector>
+
+// AVX2 and AVX-512 variants of the dense kernel are compiled for their target only and picked at run time, the
+// program itself is built for the baseline instruction set
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define KERNEL_UTILS_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace KernelUtils;
+
+void KernelUtils::matVec(const Float_t* __restrict__ matrix, const Float_t* __restrict__ x, const Float_t* __restrict__ offset, Float_t* __restrict__ y, Int_t nRows, Int_t nCols){
+	for (Int_t row = 0; row < nRows; row++){
+		const Float_t* __restrict__ a = matrix + (Long64_t)row*nCols;
+		Float_t sum = 0;
+		#pragma omp simd reduction(+:sum)
+		for (Int_t col = 0; col < nCols; col++){
+			sum += a[col]*x[col];
+		}
+		y[row] = offset ? sum - offset[row] : sum;
+	}
+}
+
+void KernelUtils::designLowPass(Float_t* taps, Int_t nTaps, Double_t cutoff){
+	// Symmetric around (nTaps-1)/2, a half-sample position for an even number of taps
+	Double_t center = 0.5*(nTaps - 1);
+	Double_t sum = 0;
+	for (Int_t k = 0; k < nTaps; k++){
+		Double_t m = k - center;
+		Double_t sinc = (m == 0) ? 2*cutoff : TMath::Sin(TMath::TwoPi()*cutoff*m)/(TMath::Pi()*m);
+		Double_t window = nTaps > 1 ? 0.54 - 0.46*TMath::Cos(TMath::TwoPi()*k/(nTaps-1)) : 1.;
+		taps[k] = sinc*window;
+		sum += taps[k];
+	}
+	// Normalize for unity DC gain
+	for (Int_t k = 0; k < nTaps; k++) taps[k] /= sum;
+}
+
+Int_t KernelUtils::firDecimate(const Float_t* __restrict__ in, Int_t n, const Float_t* __restrict__ taps, Int_t nTaps, Int_t factor, Float_t* __restrict__ out){
+	// Filter center (start + (nTaps-1)/2) is placed on the block center j*factor + (factor-1)/2. Both are whole or
+	// half samples when nTaps and factor have the same parity
+	Int_t nOut = n/factor;
+	for (Int_t j = 0; j < nOut; j++){
+		Int_t start = j*factor + (factor - nTaps)/2;
+		Float_t sum = 0;
+		if (start >= 0 && start + nTaps <= n){
+			// Interior - contiguous dot product
+			const Float_t* __restrict__ x = in + start;
+			#pragma omp simd reduction(+:sum)
+			for (Int_t k = 0; k < nTaps; k++){
+				sum += taps[k]*x[k];
+			}
+		} else {
+			// Edges - clamp sample index
+			for (Int_t k = 0; k < nTaps; k++){
+				Int_t i = start + k;
+				i = i < 0 ? 0 : (i >= n ? n-1 : i);
+				sum += taps[k]*in[i];
+			}
+		}
+		out[j] = sum;
+	}
+	return nOut;
+}
+
+Double_t KernelUtils::cfdTime(const Float_t* x, Int_t n, Double_t fraction){
+	Int_t peak = 0;
+	for (Int_t i = 1; i < n; i++){
+		if (x[i] > x[peak]) peak = i;
+	}
+	if (x[peak] <= 0) return -1;
+
+	// Walk back from the peak to the threshold crossing and interpolate linearly
+	Float_t threshold = fraction*x[peak];
+	for (Int_t i = peak - 1; i >= 0; i--){
+		if (x[i] < threshold){
+			return i + (threshold - x[i])/(x[i+1] - x[i]);
+		}
+	}
+	return 0;
+}
+
+void KernelUtils::fractionalShift(const Float_t* __restrict__ in, Float_t* __restrict__ out, Int_t n, Double_t shift, Bool_t cubic){
+	// Sample i is taken at position u = i - shift = (i + offset) + t with constant offset and 0 <= t < 1
+	Int_t offset = (Int_t)TMath::Floor(-shift);
+	Float_t t = -shift - offset;
+
+	// Interpolation weights are the same for every sample
+	Float_t w[4];
+	if (cubic){
+		Float_t t2 = t*t, t3 = t2*t;
+		w[0] = 0.5f*(-t3 + 2*t2 - t);
+		w[1] = 0.5f*(3*t3 - 5*t2 + 2);
+		w[2] = 0.5f*(-3*t3 + 4*t2 + t);
+		w[3] = 0.5f*(t3 - t2);
+	} else {
+		w[0] = 0;
+		w[1] = 1 - t;
+		w[2] = t;
+		w[3] = 0;
+	}
+
+	// Interior samples need in[i+offset-1] ... in[i+offset+2], edge samples use clamped indices
+	Int_t begin = TMath::Min(n, TMath::Max(0, 1 - offset));
+	Int_t end = TMath::Max(begin, TMath::Min(n, n - 2 - offset));
+	auto edge = [&](Int_t i){
+		Int_t j = i + offset;
+		Float_t sum = 0;
+		for (Int_t k = 0; k < 4; k++){
+			Int_t index = TMath::Min(n - 1, TMath::Max(0, j - 1 + k));
+			sum += w[k]*in[index];
+		}
+		out[i] = sum;
+	};
+	for (Int_t i = 0; i < begin; i++) edge(i);
+	#pragma omp simd
+	for (Int_t i = begin; i < end; i++){
+		Int_t j = i + offset;
+		out[i] = w[0]*in[j-1] + w[1]*in[j] + w[2]*in[j+1] + w[3]*in[j+2];
+	}
+	for (Int_t i = end; i < n; i++) edge(i);
+}
+
+Int_t KernelUtils::findPeaks(const Float_t* __restrict__ x, Int_t n, Float_t threshold, Int_t minDistance, Float_t valleyFraction, Int_t* peaks, Int_t maxPeaks){
+	if (n < 3) return 0;
+
+	// Three-point moving average suppresses single-sample noise spikes
+	std::vector<Float_t> smooth(n);
+	Float_t* __restrict__ s = smooth.data();
+	s[0] = x[0];
+	s[n-1] = x[n-1];
+	#pragma omp simd
+	for (Int_t i = 1; i < n-1; i++){
+		s[i] = (x[i-1] + x[i] + x[i+1])*(1.f/3);
+	}
+
+	// Derivative sign change from rising to falling above threshold
+	Int_t nPeaks = 0;
+	Int_t last = -1;
+	for (Int_t i = 1; i < n-1; i++){
+		if (s[i] < threshold || !(s[i] > s[i-1] && s[i] >= s[i+1])) continue;
+		if (last >= 0){
+			Float_t valley = s[last];
+			for (Int_t j = last + 1; j < i; j++) valley = TMath::Min(valley, s[j]);
+			if (i - last < minDistance || valley > valleyFraction*TMath::Min(s[last], s[i])){
+				// Same pulse - keep the higher maximum
+				if (s[i] > s[last]){
+					last = i;
+					if (nPeaks > 0 && nPeaks <= maxPeaks) peaks[nPeaks-1] = i;
+				}
+				continue;
+			}
+		}
+		if (nPeaks < maxPeaks) peaks[nPeaks] = i;
+		nPeaks++;
+		last = i;
+	}
+	return nPeaks;
+}
+
+namespace {
+	// Output columns [first, last) of the dense layer
+	void denseScalar(const Float_t* __restrict__ in, Int_t nRows, Int_t nIn, const Float_t* __restrict__ weights, const Float_t* __restrict__ bias,
+			Int_t nOut, Float_t* __restrict__ out, Int_t first, Int_t last){
+		for (Int_t r = 0; r < nRows; r++){
+			const Float_t* __restrict__ x = in + (Long64_t)r*nIn;
+			Float_t* __restrict__ y = out + (Long64_t)r*nOut;
+			for (Int_t o = first; o < last; o++) y[o] = bias[o];
+			for (Int_t i = 0; i < nIn; i++){
+				const Float_t* __restrict__ w = weights + (Long64_t)i*nOut;
+				Float_t xi = x[i];
+				#pragma omp simd
+				for (Int_t o = first; o < last; o++){
+					y[o] += xi*w[o];
+				}
+			}
+		}
+	}
+
+	void denseScalar(const Float_t* in, Int_t nRows, Int_t nIn, const Float_t* weights, const Float_t* bias, Int_t nOut, Float_t* out){
+		denseScalar(in, nRows, nIn, weights, bias, nOut, out, 0, nOut);
+	}
+
+#ifdef KERNEL_UTILS_X86
+	// Four rows share every loaded weight vector, accumulators stay in registers for the whole input loop
+	__attribute__((target("avx2,fma")))
+	void denseAvx2(const Float_t* in, Int_t nRows, Int_t nIn, const Float_t* weights, const Float_t* bias, Int_t nOut, Float_t* out){
+		Int_t o = 0;
+		for (; o + 8 <= nOut; o += 8){
+			__m256 b = _mm256_loadu_ps(bias + o);
+			Int_t r = 0;
+			for (; r + 4 <= nRows; r += 4){
+				const Float_t* x = in + (Long64_t)r*nIn;
+				__m256 acc0 = b, acc1 = b, acc2 = b, acc3 = b;
+				for (Int_t i = 0; i < nIn; i++){
+					__m256 w = _mm256_loadu_ps(weights + (Long64_t)i*nOut + o);
+					acc0 = _mm256_fmadd_ps(_mm256_set1_ps(x[i]), w, acc0);
+					acc1 = _mm256_fmadd_ps(_mm256_set1_ps(x[nIn + i]), w, acc1);
+					acc2 = _mm256_fmadd_ps(_mm256_set1_ps(x[2*nIn + i]), w, acc2);
+					acc3 = _mm256_fmadd_ps(_mm256_set1_ps(x[3*nIn + i]), w, acc3);
+				}
+				Float_t* y = out + (Long64_t)r*nOut + o;
+				_mm256_storeu_ps(y, acc0);
+				_mm256_storeu_ps(y + nOut, acc1);
+				_mm256_storeu_ps(y + 2*nOut, acc2);
+				_mm256_storeu_ps(y + 3*nOut, acc3);
+			}
+			for (; r < nRows; r++){
+				const Float_t* x = in + (Long64_t)r*nIn;
+				__m256 acc = b;
+				for (Int_t i = 0; i < nIn; i++){
+					acc = _mm256_fmadd_ps(_mm256_set1_ps(x[i]), _mm256_loadu_ps(weights + (Long64_t)i*nOut + o), acc);
+				}
+				_mm256_storeu_ps(out + (Long64_t)r*nOut + o, acc);
+			}
+		}
+		if (o < nOut) denseScalar(in, nRows, nIn, weights, bias, nOut, out, o, nOut);
+	}
+
+	__attribute__((target("avx512f")))
+	void denseAvx512(const Float_t* in, Int_t nRows, Int_t nIn, const Float_t* weights, const Float_t* bias, Int_t nOut, Float_t* out){
+		Int_t o = 0;
+		for (; o + 16 <= nOut; o += 16){
+			__m512 b = _mm512_loadu_ps(bias + o);
+			Int_t r = 0;
+			for (; r + 4 <= nRows; r += 4){
+				const Float_t* x = in + (Long64_t)r*nIn;
+				__m512 acc0 = b, acc1 = b, acc2 = b, acc3 = b;
+				for (Int_t i = 0; i < nIn; i++){
+					__m512 w = _mm512_loadu_ps(weights + (Long64_t)i*nOut + o);
+					acc0 = _mm512_fmadd_ps(_mm512_set1_ps(x[i]), w, acc0);
+					acc1 = _mm512_fmadd_ps(_mm512_set1_ps(x[nIn + i]), w, acc1);
+					acc2 = _mm512_fmadd_ps(_mm512_set1_ps(x[2*nIn + i]), w, acc2);
+					acc3 = _mm512_fmadd_ps(_mm512_set1_ps(x[3*nIn + i]), w, acc3);
+				}
+				Float_t* y = out + (Long64_t)r*nOut + o;
+				_mm512_storeu_ps(y, acc0);
+				_mm512_storeu_ps(y + nOut, acc1);
+				_mm512_storeu_ps(y + 2*nOut, acc2);
+				_mm512_storeu_ps(y + 3*nOut, acc3);
+			}
+			for (; r < nRows; r++){
+				const Float_t* x = in + (Long64_t)r*nIn;
+				__m512 acc = b;
+				for (Int_t i = 0; i < nIn; i++){
+					acc = _mm512_fmadd_ps(_mm512_set1_ps(x[i]), _mm512_loadu_ps(weights + (Long64_t)i*nOut + o), acc);
+				}
+				_mm512_storeu_ps(out + (Long64_t)r*nOut + o, acc);
+			}
+		}
+		if (o < nOut) denseScalar(in, nRows, nIn, weights, bias, nOut, out, o, nOut);
+	}
+#endif
+
+	void denseInt8Scalar(const std::int8_t* __restrict__ in, Int_t nRows, Int_t nIn, const std::int8_t* __restrict__ weights, Int_t nOut, Int_t* __restrict__ out){
+		for (Int_t r = 0; r < nRows; r++){
+			const std::int8_t* __restrict__ x = in + (Long64_t)r*nIn;
+			Int_t* __restrict__ y = out + (Long64_t)r*nOut;
+			for (Int_t o = 0; o < nOut; o++) y[o] = 0;
+			for (Int_t g = 0; g < nIn/4; g++){
+				const std::int8_t* __restrict__ w = weights + (Long64_t)g*nOut*4;
+				#pragma omp simd
+				for (Int_t o = 0; o < nOut; o++){
+					y[o] += x[4*g]*w[4*o] + x[4*g + 1]*w[4*o + 1] + x[4*g + 2]*w[4*o + 2] + x[4*g + 3]*w[4*o + 3];
+				}
+			}
+		}
+	}
+
+#ifdef KERNEL_UTILS_X86
+	// Unsigned by signed byte products need non-negative inputs: |x| times weight with the sign of x. Pairs of
+	// products stay below 2*127*127 and never saturate the 16-bit sums
+	__attribute__((target("avx2")))
+	void denseInt8Avx2(const std::int8_t* in, Int_t nRows, Int_t nIn, const std::int8_t* weights, Int_t nOut, Int_t* out){
+		const __m256i ones = _mm256_set1_epi16(1);
+		for (Int_t r = 0; r < nRows; r++){
+			const std::int8_t* x = in + (Long64_t)r*nIn;
+			for (Int_t o = 0; o < nOut; o += 8){
+				__m256i acc = _mm256_setzero_si256();
+				for (Int_t g = 0; g < nIn/4; g++){
+					Int_t group;
+					std::memcpy(&group, x + 4*g, 4);
+					__m256i xv = _mm256_set1_epi32(group);
+					__m256i wv = _mm256_loadu_si256((const __m256i*)(weights + ((Long64_t)g*nOut + o)*4));
+					__m256i products = _mm256_maddubs_epi16(_mm256_sign_epi8(xv, xv), _mm256_sign_epi8(wv, xv));
+					acc = _mm256_add_epi32(acc, _mm256_madd_epi16(products, ones));
+				}
+				_mm256_storeu_si256((__m256i*)(out + (Long64_t)r*nOut + o), acc);
+			}
+		}
+	}
+
+	// VNNI multiplies and accumulates four byte products into 32 bits in one instruction
+	__attribute__((target("avx2,avx512vnni,avx512vl")))
+	void denseInt8Vnni(const std::int8_t* in, Int_t nRows, Int_t nIn, const std::int8_t* weights, Int_t nOut, Int_t* out){
+		for (Int_t r = 0; r < nRows; r++){
+			const std::int8_t* x = in + (Long64_t)r*nIn;
+			for (Int_t o = 0; o < nOut; o += 8){
+				__m256i acc = _mm256_setzero_si256();
+				for (Int_t g = 0; g < nIn/4; g++){
+					Int_t group;
+					std::memcpy(&group, x + 4*g, 4);
+					__m256i xv = _mm256_set1_epi32(group);
+					__m256i wv = _mm256_loadu_si256((const __m256i*)(weights + ((Long64_t)g*nOut + o)*4));
+					acc = _mm256_dpbusd_epi32(acc, _mm256_sign_epi8(xv, xv), _mm256_sign_epi8(wv, xv));
+				}
+				_mm256_storeu_si256((__m256i*)(out + (Long64_t)r*nOut + o), acc);
+			}
+		}
+	}
+#endif
+
+	typedef void (*DenseKernel)(const Float_t*, Int_t, Int_t, const Float_t*, const Float_t*, Int_t, Float_t*);
+	typedef void (*DenseInt8Kernel)(const std::int8_t*, Int_t, Int_t, const std::int8_t*, Int_t, Int_t*);
+	DenseKernel denseKernel = nullptr;
+	DenseInt8Kernel denseInt8Kernel = nullptr;
+	const char* denseKernelName = "scalar";
+	const char* denseInt8KernelName = "scalar";
+}
+
+void KernelUtils::dense(const Float_t* in, Int_t nRows, Int_t nIn, const Float_t* weights, const Float_t* bias, Int_t nOut, Float_t* out){
+	if (!denseKernel) selectDenseKernel("auto");
+	denseKernel(in, nRows, nIn, weights, bias, nOut, out);
+}
+
+void KernelUtils::denseInt8(const std::int8_t* in, Int_t nRows, Int_t nIn, const std::int8_t* weights, Int_t nOut, Int_t* out){
+	if (!denseInt8Kernel) selectDenseKernel("auto");
+	denseInt8Kernel(in, nRows, nIn, weights, nOut, out);
+}
+
+Bool_t KernelUtils::selectDenseKernel(const char* name){
+	TString kernel = name;
+#ifdef KERNEL_UTILS_X86
+	Bool_t hasAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	Bool_t hasAvx512 = __builtin_cpu_supports("avx512f");
+	Bool_t hasVnni = __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl");
+	if (kernel == "auto") kernel = hasAvx512 ? "avx512" : (hasAvx2 ? "avx2" : "scalar");
+	if (kernel == "avx512" && hasAvx512){
+		denseKernel = denseAvx512;
+		denseKernelName = "avx512";
+		denseInt8Kernel = hasVnni ? denseInt8Vnni : denseInt8Avx2;
+		denseInt8KernelName = hasVnni ? "vnni" : "avx2";
+		return kTRUE;
+	}
+	if (kernel == "avx2" && hasAvx2){
+		denseKernel = denseAvx2;
+		denseKernelName = "avx2";
+		denseInt8Kernel = denseInt8Avx2;
+		denseInt8KernelName = "avx2";
+		return kTRUE;
+	}
+#else
+	if (kernel == "auto") kernel = "scalar";
+#endif
+	if (kernel == "scalar"){
+		denseKernel = denseScalar;
+		denseKernelName = "scalar";
+		denseInt8Kernel = denseInt8Scalar;
+		denseInt8KernelName = "scalar";
+		return kTRUE;
+	}
+	return kFALSE;
+}
+
+const char* KernelUtils::getDenseKernel(){
+	if (!denseKernel) selectDenseKernel("auto");
+	return denseKernelName;
+}
+
+const char* KernelUtils::getInt8Kernel(){
+	if (!denseInt8Kernel) selectDenseKernel("auto");
+	return denseInt8KernelName;
+}
@@ -0,0 +1,53 @@
+#ifndef KernelUtils_hh
+#define KernelUtils_hh 1
+
+#include <Rtypes.h>
+
+#include <cstdint>
+
+// Low-level numeric kernels operating on contiguous float buffers.
+// Loops are written for compiler auto-vectorization (see -fopenmp-simd in CMakeLists.txt)
+
+namespace KernelUtils {
+	// Matrix-vector product y = A*x - offset. Matrix is stored row-major (nRows x nCols)
+	void matVec(const Float_t* matrix, const Float_t* x, const Float_t* offset, Float_t* y, Int_t nRows, Int_t nCols);
+
+	// Design windowed-sinc (Hamming) low-pass FIR taps. Cutoff is given in units of the sampling frequency
+	void designLowPass(Float_t* taps, Int_t nTaps, Double_t cutoff);
+
+	// Filter buffer with symmetric FIR and keep every factor-th sample (output sample j is centered on the block of
+	// input samples j*factor ... j*factor + factor-1). Number of taps must have the parity of the factor. Edges are
+	// padded with boundary values. Returns number of output samples (n/factor)
+	Int_t firDecimate(const Float_t* in, Int_t n, const Float_t* taps, Int_t nTaps, Int_t factor, Float_t* out);
+
+	// Constant fraction discriminator. Returns fractional sample index where the leading edge of a positive pulse
+	// crosses given fraction of its maximum, -1 if there is no pulse
+	Double_t cfdTime(const Float_t* x, Int_t n, Double_t fraction);
+
+	// Resample buffer delayed by a fractional number of samples: out[i] = in(i - shift).
+	// Linear or cubic (Catmull-Rom) interpolation, edges are padded with boundary values
+	void fractionalShift(const Float_t* in, Float_t* out, Int_t n, Double_t shift, Bool_t cubic = kFALSE);
+
+	// Find pulses in a positive waveform: local maxima of the smoothed buffer above threshold. Neighbouring maxima
+	// closer than minDistance samples, or not separated by a valley below valleyFraction of the lower maximum,
+	// are merged. Writes up to maxPeaks sample indices (in time order) and returns number of pulses found
+	Int_t findPeaks(const Float_t* x, Int_t n, Float_t threshold, Int_t minDistance, Float_t valleyFraction, Int_t* peaks, Int_t maxPeaks);
+
+	// Dense layer over a batch: out = in*weights + bias. Inputs are row-major (nRows x nIn), weights are stored
+	// transposed (nIn x nOut) so that every input value updates a contiguous run of outputs
+	void dense(const Float_t* in, Int_t nRows, Int_t nIn, const Float_t* weights, const Float_t* bias, Int_t nOut, Float_t* out);
+
+	// Int8 dense layer without bias: out = in*weights accumulated in int32. Inputs are row-major (nRows x nIn) in
+	// -127..127, weights are grouped by four inputs for every output ([nIn/4][nOut][4]). nIn must be a multiple of 4,
+	// nOut a multiple of 8
+	void denseInt8(const std::int8_t* in, Int_t nRows, Int_t nIn, const std::int8_t* weights, Int_t nOut, Int_t* out);
+
+	// Instruction set of the dense kernels: "auto" (best supported by the CPU), "avx512", "avx2" or "scalar".
+	// Int8 kernel uses VNNI with "avx512" if the CPU has it, AVX2 otherwise. Returns false if the CPU or the
+	// compiler does not support the instruction set
+	Bool_t selectDenseKernel(const char* name);
+	const char* getDenseKernel();
+	const char* getInt8Kernel();
+}
+
+#endif
@@ -0,0 +1,466 @@
+#include "./NetworkUtils.h"
+#include "./KernelUtils.h"
+
+#include <TXMLEngine.h>
+#include <TError.h>
+#include <TMD5.h>
+#include <TMVA/DNN/Functions.h>
+#ifdef HAS_TMVA_SOFIE
+#include <TMVA/RModel.hxx>
+#include <TMVA/ROperator_Gemm.hxx>
+#include <TMVA/ROperator_Relu.hxx>
+#include <TMVA/ROperator_Sigmoid.hxx>
+#include <TMVA/ROperator_Tanh.hxx>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+
+using namespace NetworkUtils;
+
+namespace {
+	// Child element with given name
+	XMLNodePointer_t findChild(TXMLEngine& xml, XMLNodePointer_t node, const char* name){
+		for (XMLNodePointer_t child = xml.GetChild(node); child; child = xml.GetNext(child)){
+			if (TString(xml.GetNodeName(child)) == name) return child;
+		}
+		return nullptr;
+	}
+
+	// Values of the matrix element written by TMVA::DNN::VGeneralLayer::WriteMatrixToXML (row-major)
+	Bool_t readMatrix(TXMLEngine& xml, XMLNodePointer_t layer, const char* name, std::vector<Double_t>& values){
+		XMLNodePointer_t matrix = findChild(xml, layer, name);
+		if (!matrix) return kFALSE;
+		values.clear();
+		const char* text = xml.GetNodeContent(matrix);
+		char* end = nullptr;
+		for (const char* p = text; p && *p; p = end){
+			// Parsed in single precision as in TMVA
+			Float_t value = std::strtof(p, &end);
+			if (end == p) break;
+			values.push_back(value);
+		}
+		return values.size() == (size_t) (std::atoi(xml.GetAttr(matrix, "Rows")) * std::atoi(xml.GetAttr(matrix, "Columns")));
+	}
+
+	// Activation in place
+	void activate(Float_t* x, Long64_t n, Int_t activation){
+		switch ((TMVA::DNN::EActivationFunction) activation){
+			case TMVA::DNN::EActivationFunction::kRelu:
+				#pragma omp simd
+				for (Long64_t i = 0; i < n; i++) x[i] = x[i] > 0 ? x[i] : 0;
+				break;
+			case TMVA::DNN::EActivationFunction::kSigmoid:
+				for (Long64_t i = 0; i < n; i++) x[i] = 1/(1 + std::exp(-x[i]));
+				break;
+			case TMVA::DNN::EActivationFunction::kTanh:
+			case TMVA::DNN::EActivationFunction::kFastTanh:
+				for (Long64_t i = 0; i < n; i++) x[i] = std::tanh(x[i]);
+				break;
+			case TMVA::DNN::EActivationFunction::kSymmRelu:
+				for (Long64_t i = 0; i < n; i++) x[i] = std::fabs(x[i]);
+				break;
+			case TMVA::DNN::EActivationFunction::kSoftSign:
+				for (Long64_t i = 0; i < n; i++) x[i] = x[i]/(1 + std::fabs(x[i]));
+				break;
+			case TMVA::DNN::EActivationFunction::kGauss:
+				for (Long64_t i = 0; i < n; i++) x[i] = std::exp(-x[i]*x[i]);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+Bool_t NetworkUtils::readNetwork(const char* weightFilePath, Network& network){
+	network = Network();
+	TXMLEngine xml;
+	XMLDocPointer_t doc = xml.ParseFile(weightFilePath);
+	if (!doc){
+		Error("NetworkUtils::readNetwork", "Cannot parse \"%s\"", weightFilePath);
+		return kFALSE;
+	}
+	XMLNodePointer_t root = xml.DocGetRootElement(doc);
+	Bool_t ok = kFALSE;
+	do {
+		if (!TString(xml.GetAttr(root, "Method")).BeginsWith("DL::")){
+			Error("NetworkUtils::readNetwork", "\"%s\" is not a deep learning weight file", weightFilePath);
+			break;
+		}
+		XMLNodePointer_t transformations = findChild(xml, root, "Transformations");
+		if (transformations && std::atoi(xml.GetAttr(transformations, "NTransformations")) > 0){
+			Error("NetworkUtils::readNetwork", "Variable transformations are not supported");
+			break;
+		}
+		XMLNodePointer_t variables = findChild(xml, root, "Variables");
+		for (XMLNodePointer_t variable = variables ? xml.GetChild(variables) : nullptr; variable; variable = xml.GetNext(variable)){
+			network.variables.push_back(xml.GetAttr(variable, "Expression"));
+		}
+
+		// Network node (with the NetDepth attribute) is nested in the weights node of the method
+		XMLNodePointer_t net = findChild(xml, root, "Weights");
+		if (net && findChild(xml, net, "Weights")) net = findChild(xml, net, "Weights");
+		if (!net || !xml.HasAttr(net, "OutputFunction")){
+			Error("NetworkUtils::readNetwork", "Network not found in \"%s\"", weightFilePath);
+			break;
+		}
+		network.outputFunction = xml.GetAttr(net, "OutputFunction")[0];
+
+		// Batch normalization y = scale*x + shift is kept until the next dense layer and folded into its weights:
+		// W*(scale*x + shift) + b = (W*scale)*x + (W*shift + b)
+		std::vector<Double_t> scale, shift;
+		Int_t width = network.variables.size();
+		ok = kTRUE;
+		for (XMLNodePointer_t layer = xml.GetChild(net); ok && layer; layer = xml.GetNext(layer)){
+			TString type = xml.GetNodeName(layer);
+			std::vector<Double_t> weights, biases;
+			if (type == "DenseLayer" && readMatrix(xml, layer, "Weights", weights) && readMatrix(xml, layer, "Biases", biases)){
+				DenseLayer dense;
+				dense.nOutputs = biases.size();
+				dense.nInputs = weights.size()/std::max<size_t>(1, biases.size());
+				dense.activation = std::atoi(xml.GetAttr(layer, "ActivationFunction"));
+				if (dense.nInputs != width || dense.activation < 0 || dense.activation > (Int_t) TMVA::DNN::EActivationFunction::kFastTanh){
+					Error("NetworkUtils::readNetwork", "Unexpected dense layer %zu (%d inputs, activation %d)", network.layers.size(), dense.nInputs, dense.activation);
+					ok = kFALSE;
+					break;
+				}
+				dense.weights.resize(weights.size());
+				dense.biases.resize(dense.nOutputs);
+				for (Int_t o = 0; o < dense.nOutputs; o++){
+					Double_t bias = biases[o];
+					for (Int_t i = 0; i < dense.nInputs; i++){
+						Double_t weight = weights[o*dense.nInputs + i];
+						if (!scale.empty()){
+							bias += weight*shift[i];
+							weight *= scale[i];
+						}
+						dense.weights[i*dense.nOutputs + o] = weight;
+					}
+					dense.biases[o] = bias;
+				}
+				scale.clear();
+				shift.clear();
+				width = dense.nOutputs;
+				network.layers.push_back(dense);
+			} else if (type == "BatchNormLayer") {
+				std::vector<Double_t> mean, variance, gamma, beta;
+				Bool_t found = (readMatrix(xml, layer, "Training-mean", mean) || readMatrix(xml, layer, "Training-mu", mean))
+					&& readMatrix(xml, layer, "Training-variance", variance) && readMatrix(xml, layer, "Gamma", gamma) && readMatrix(xml, layer, "Beta", beta);
+				if (!found || (Int_t) mean.size() != width || variance.size() != mean.size() || gamma.size() != mean.size() || beta.size() != mean.size()){
+					Error("NetworkUtils::readNetwork", "Unexpected batch normalization layer after %zu dense layers", network.layers.size());
+					ok = kFALSE;
+					break;
+				}
+				Double_t epsilon = std::atof(xml.GetAttr(layer, "Epsilon"));
+				if (scale.empty()){
+					scale.assign(width, 1);
+					shift.assign(width, 0);
+				}
+				// Composition with the batch normalization pending from the previous layer
+				for (Int_t i = 0; i < width; i++){
+					Double_t s = gamma[i]/std::sqrt(variance[i] + epsilon);
+					scale[i] *= s;
+					shift[i] = (shift[i] - mean[i])*s + beta[i];
+				}
+			} else if (type != "ReshapeLayer") {
+				Error("NetworkUtils::readNetwork", "Layer %s is not supported", type.Data());
+				ok = kFALSE;
+			}
+		}
+		if (!ok) break;
+		if (!scale.empty() || network.layers.empty() || width != 1 || (network.outputFunction != 'I' && network.outputFunction != 'S')){
+			Error("NetworkUtils::readNetwork", "Only networks ending with a dense layer with single output are supported");
+			ok = kFALSE;
+			break;
+		}
+		Info("NetworkUtils::readNetwork", "Read %zu dense layers from \"%s\"", network.layers.size(), weightFilePath);
+	} while (kFALSE);
+	xml.FreeDoc(doc);
+	return ok;
+}
+
+namespace {
+	const Int_t blockSize = 128;
+
+	Float_t getOutput(const Network& network, Float_t value){
+		return network.outputFunction == 'S' ? 1/(1 + std::exp(-value)) : value;
+	}
+
+	void evaluateInt8(const Network& network, const Float_t* inputs, Long64_t nEvents, Double_t* scores){
+		Int_t maxWidth = 0, maxInputs = 0, maxOutputs = 0;
+		for (size_t l = 0; l < network.layers.size(); l++){
+			maxWidth = std::max(maxWidth, network.layers[l].nOutputs);
+			maxInputs = std::max(maxInputs, network.quantizedLayers[l].nInputs);
+			maxOutputs = std::max(maxOutputs, network.quantizedLayers[l].nOutputs);
+		}
+		std::vector<Float_t> buffers[2] { std::vector<Float_t>(blockSize*maxWidth), std::vector<Float_t>(blockSize*maxWidth) };
+		std::vector<std::int8_t> quantizedInputs(blockSize*maxInputs, 0);
+		std::vector<Int_t> sums(blockSize*maxOutputs);
+
+		for (Long64_t start = 0; start < nEvents; start += blockSize){
+			Int_t n = (Int_t) std::min<Long64_t>(blockSize, nEvents - start);
+			const Float_t* in = inputs + start*network.variables.size();
+			for (size_t l = 0; l < network.layers.size(); l++){
+				const DenseLayer& layer = network.layers[l];
+				const QuantizedLayer& quantized = network.quantizedLayers[l];
+
+				// Round inputs to the calibrated steps, padding columns stay zero
+				Float_t inverseScale = 1/quantized.inputScale;
+				for (Int_t r = 0; r < n; r++){
+					const Float_t* x = in + (Long64_t)r*layer.nInputs;
+					std::int8_t* q = quantizedInputs.data() + (Long64_t)r*quantized.nInputs;
+					for (Int_t i = 0; i < layer.nInputs; i++){
+						Float_t value = std::nearbyint(x[i]*inverseScale);
+						q[i] = (std::int8_t) std::max(-127.f, std::min(127.f, value));
+					}
+					std::fill(q + layer.nInputs, q + quantized.nInputs, 0);
+				}
+				KernelUtils::denseInt8(quantizedInputs.data(), n, quantized.nInputs, quantized.weights.data(), quantized.nOutputs, sums.data());
+
+				// Back to float with the bias, activation in float
+				Float_t* out = buffers[l % 2].data();
+				Float_t scale = quantized.inputScale*quantized.weightScale;
+				for (Int_t r = 0; r < n; r++){
+					for (Int_t o = 0; o < layer.nOutputs; o++){
+						out[(Long64_t)r*layer.nOutputs + o] = sums[(Long64_t)r*quantized.nOutputs + o]*scale + layer.biases[o];
+					}
+				}
+				activate(out, (Long64_t) n*layer.nOutputs, layer.activation);
+				in = out;
+			}
+			for (Int_t i = 0; i < n; i++) scores[start + i] = getOutput(network, in[i]);
+		}
+	}
+}
+
+void NetworkUtils::evaluate(const Network& network, const Float_t* inputs, Long64_t nEvents, Double_t* scores){
+	if (!network.quantizedLayers.empty()){
+		evaluateInt8(network, inputs, nEvents, scores);
+		return;
+	}
+	Int_t maxWidth = 0;
+	for (const DenseLayer& layer : network.layers) maxWidth = std::max(maxWidth, layer.nOutputs);
+	std::vector<Float_t> buffers[2] { std::vector<Float_t>(blockSize*maxWidth), std::vector<Float_t>(blockSize*maxWidth) };
+
+	for (Long64_t start = 0; start < nEvents; start += blockSize){
+		Int_t n = (Int_t) std::min<Long64_t>(blockSize, nEvents - start);
+		const Float_t* in = inputs + start*network.variables.size();
+		for (size_t l = 0; l < network.layers.size(); l++){
+			const DenseLayer& layer = network.layers[l];
+			Float_t* out = buffers[l % 2].data();
+			KernelUtils::dense(in, n, layer.nInputs, layer.weights.data(), layer.biases.data(), layer.nOutputs, out);
+			activate(out, (Long64_t) n*layer.nOutputs, layer.activation);
+			in = out;
+		}
+		for (Int_t i = 0; i < n; i++) scores[start + i] = getOutput(network, in[i]);
+	}
+}
+
+std::vector<Float_t> NetworkUtils::calibrateInputScales(const Network& network, const Float_t* inputs, Long64_t nEvents){
+	std::vector<Float_t> maxValues(network.layers.size(), 0);
+	Int_t maxWidth = 0;
+	for (const DenseLayer& layer : network.layers) maxWidth = std::max(maxWidth, layer.nOutputs);
+	std::vector<Float_t> buffers[2] { std::vector<Float_t>(blockSize*maxWidth), std::vector<Float_t>(blockSize*maxWidth) };
+
+	// Float forward pass recording the range of the inputs of every layer
+	for (Long64_t start = 0; start < nEvents; start += blockSize){
+		Int_t n = (Int_t) std::min<Long64_t>(blockSize, nEvents - start);
+		const Float_t* in = inputs + start*network.variables.size();
+		for (size_t l = 0; l < network.layers.size(); l++){
+			const DenseLayer& layer = network.layers[l];
+			for (Long64_t i = 0; i < (Long64_t) n*layer.nInputs; i++) maxValues[l] = std::max(maxValues[l], std::fabs(in[i]));
+			Float_t* out = buffers[l % 2].data();
+			KernelUtils::dense(in, n, layer.nInputs, layer.weights.data(), layer.biases.data(), layer.nOutputs, out);
+			activate(out, (Long64_t) n*layer.nOutputs, layer.activation);
+			in = out;
+		}
+	}
+	std::vector<Float_t> inputScales;
+	for (Float_t maxValue : maxValues) inputScales.push_back(maxValue > 0 ? maxValue/127 : 1);
+	return inputScales;
+}
+
+void NetworkUtils::quantize(Network& network, const std::vector<Float_t>& inputScales){
+	network.quantizedLayers.clear();
+	for (size_t l = 0; l < network.layers.size(); l++){
+		const DenseLayer& layer = network.layers[l];
+		QuantizedLayer quantized;
+		quantized.nInputs = (layer.nInputs + 3)/4*4;
+		quantized.nOutputs = (layer.nOutputs + 7)/8*8;
+		quantized.inputScale = inputScales[l];
+
+		// Symmetric per-layer weight scale
+		Float_t maxWeight = 0;
+		for (Float_t weight : layer.weights) maxWeight = std::max(maxWeight, std::fabs(weight));
+		quantized.weightScale = maxWeight > 0 ? maxWeight/127 : 1;
+		quantized.weights.assign((Long64_t) quantized.nInputs*quantized.nOutputs, 0);
+		for (Int_t i = 0; i < layer.nInputs; i++){
+			for (Int_t o = 0; o < layer.nOutputs; o++){
+				Float_t value = std::nearbyint(layer.weights[(Long64_t)i*layer.nOutputs + o]/quantized.weightScale);
+				quantized.weights[((Long64_t)(i/4)*quantized.nOutputs + o)*4 + i%4] = (std::int8_t) std::max(-127.f, std::min(127.f, value));
+			}
+		}
+		network.quantizedLayers.push_back(quantized);
+	}
+}
+
+namespace {
+	// MD5 of the file contents, empty if the file cannot be read
+	TString getFileChecksum(const char* filePath){
+		TMD5* checksum = TMD5::FileChecksum(filePath);
+		if (!checksum) return "";
+		TString value = checksum->AsString();
+		delete checksum;
+		return value;
+	}
+}
+
+Bool_t NetworkUtils::writeInputScales(const char* filePath, const char* weightFilePath, const std::vector<Float_t>& inputScales){
+	TString checksum = getFileChecksum(weightFilePath);
+	std::ofstream file(filePath);
+	if (checksum.Length() == 0 || !file.is_open()){
+		Error("NetworkUtils::writeInputScales", "Cannot write \"%s\"", filePath);
+		return kFALSE;
+	}
+	file << "# Int8 input scales of the dense layers calibrated by the 'quantize-dnn' mode" << std::endl;
+	file << "weights " << checksum << std::endl;
+	file << std::setprecision(9);
+	for (size_t l = 0; l < inputScales.size(); l++){
+		file << "layer" << l << " " << inputScales[l] << std::endl;
+	}
+	return kTRUE;
+}
+
+Bool_t NetworkUtils::readInputScales(const char* filePath, const char* weightFilePath, std::vector<Float_t>& inputScales){
+	std::ifstream file(filePath);
+	if (!file.is_open()) return kFALSE;
+	inputScales.clear();
+	std::string line, checksum;
+	while (std::getline(file, line)){
+		// Skip comments and empty lines
+		line = line.substr(0, line.find('#'));
+		std::istringstream stream(line);
+		std::string name;
+		if (!(stream >> name)) continue;
+		if (name == "weights" && stream >> checksum) continue;
+		Float_t scale;
+		if (name != "layer" + std::to_string(inputScales.size()) || !(stream >> scale) || !(scale > 0)){
+			Error("NetworkUtils::readInputScales", "Unexpected line \"%s\" in \"%s\"", line.c_str(), filePath);
+			return kFALSE;
+		}
+		inputScales.push_back(scale);
+	}
+	// Weights of a network trained again would be quantized with the scales of the old one
+	if (checksum.empty() || checksum != getFileChecksum(weightFilePath).Data()){
+		Error("NetworkUtils::readInputScales", "\"%s\" was calibrated for another version of \"%s\", run 'quantize-dnn' again", filePath,
+			weightFilePath);
+		return kFALSE;
+	}
+	return kTRUE;
+}
+
+Bool_t NetworkUtils::writeSofieHeader(const Network& network, const char* modelName, Int_t batchSize, const char* headerFilePath){
+#ifndef HAS_TMVA_SOFIE
+	Error("NetworkUtils::writeSofieHeader", "Program is built without TMVA SOFIE");
+	return kFALSE;
+#else
+	using namespace TMVA::Experimental::SOFIE;
+	RModel model(modelName, "");
+	model.AddInputTensorInfo("input", ETensorType::FLOAT, std::vector<size_t> { (size_t) batchSize, network.variables.size() });
+	model.AddInputTensorName("input");
+
+	// Dense layer is Gemm with the weights transposed back to (nOutputs x nInputs)
+	std::string input = "input";
+	for (size_t l = 0; l < network.layers.size(); l++){
+		const DenseLayer& layer = network.layers[l];
+		std::string suffix = std::to_string(l);
+		std::shared_ptr<Float_t> weights(new Float_t[layer.weights.size()], std::default_delete<Float_t[]>());
+		std::shared_ptr<Float_t> biases(new Float_t[layer.nOutputs], std::default_delete<Float_t[]>());
+		for (Int_t o = 0; o < layer.nOutputs; o++){
+			for (Int_t i = 0; i < layer.nInputs; i++) weights.get()[o*layer.nInputs + i] = layer.weights[i*layer.nOutputs + o];
+			biases.get()[o] = layer.biases[o];
+		}
+		model.AddInitializedTensor("W" + suffix, ETensorType::FLOAT, { (size_t) layer.nOutputs, (size_t) layer.nInputs }, weights);
+		model.AddInitializedTensor("B" + suffix, ETensorType::FLOAT, { (size_t) layer.nOutputs }, biases);
+		model.AddOperator(std::make_unique<ROperator_Gemm<float>>(1.0, 1.0, 0, 1, input, "W" + suffix, "B" + suffix, "Z" + suffix));
+		input = "Z" + suffix;
+
+		std::string output = "A" + suffix;
+		switch ((TMVA::DNN::EActivationFunction) layer.activation){
+			case TMVA::DNN::EActivationFunction::kIdentity:
+				output = input;
+				break;
+			case TMVA::DNN::EActivationFunction::kRelu:
+				model.AddOperator(std::make_unique<ROperator_Relu<float>>(input, output));
+				break;
+			case TMVA::DNN::EActivationFunction::kSigmoid:
+				model.AddOperator(std::make_unique<ROperator_Sigmoid<float>>(input, output));
+				break;
+			case TMVA::DNN::EActivationFunction::kTanh:
+			case TMVA::DNN::EActivationFunction::kFastTanh:
+				model.AddOperator(std::make_unique<ROperator_Tanh<float>>(input, output));
+				break;
+			default:
+				Error("NetworkUtils::writeSofieHeader", "Activation %d of the layer %zu has no SOFIE operator", layer.activation, l);
+				return kFALSE;
+		}
+		input = output;
+	}
+	if (network.outputFunction == 'S'){
+		model.AddOperator(std::make_unique<ROperator_Sigmoid<float>>(input, "output"));
+		input = "output";
+	}
+	model.AddOutputTensorNameList({ input });
+
+	// Weights are written into the header, the plugin does not read any file at startup
+	model.Generate(Options::kNoWeightFile, batchSize);
+	model.OutputGenerated(headerFilePath);
+	return kTRUE;
+#endif
+}
+
+Bool_t NetworkUtils::writePluginSource(const Network& network, const char* modelName, Int_t batchSize, const char* headerFilePath,
+		const char* sourceFilePath, const char* comment){
+	std::ofstream file(sourceFilePath);
+	if (!file.is_open()){
+		Error("NetworkUtils::writePluginSource", "Cannot write \"%s\"", sourceFilePath);
+		return kFALSE;
+	}
+	Int_t nVariables = network.variables.size();
+	file << "// " << comment << std::endl;
+	file << "// Generated by dual-readout-tmva, do not edit" << std::endl;
+	file << std::endl << "#include \"" << headerFilePath << "\"" << std::endl;
+	file << std::endl << "#include <algorithm>" << std::endl << "#include <vector>" << std::endl << std::endl;
+	file << "namespace {" << std::endl;
+	file << "const char* variables[] = {";
+	for (Int_t i = 0; i < nVariables; i++){
+		file << (i % 8 == 0 ? "\n    " : " ") << "\"" << network.variables[i] << "\",";
+	}
+	file << std::endl << "};" << std::endl;
+	file << "}" << std::endl << std::endl;
+
+	file << "extern \"C\" int tmvaNVariables() {" << std::endl;
+	file << "    return " << nVariables << ";" << std::endl << "}" << std::endl << std::endl;
+	file << "extern \"C\" const char* tmvaVariable(int i) {" << std::endl;
+	file << "    return variables[i];" << std::endl << "}" << std::endl << std::endl;
+
+	// Session keeps the intermediate tensors, every worker thread gets its own. Last batch is padded with zeros
+	file << "extern \"C\" void tmvaEvaluate(const float* inputs, long long nEvents, double* scores) {" << std::endl;
+	file << "    const long long batchSize = " << batchSize << ", nVariables = " << nVariables << ";" << std::endl;
+	file << "    thread_local TMVA_SOFIE_" << modelName << "::Session session;" << std::endl;
+	file << "    thread_local std::vector<float> batch(batchSize*nVariables);" << std::endl;
+	file << "    for (long long start = 0; start < nEvents; start += batchSize) {" << std::endl;
+	file << "        long long n = std::min(batchSize, nEvents - start);" << std::endl;
+	file << "        std::copy(inputs + start*nVariables, inputs + (start + n)*nVariables, batch.begin());" << std::endl;
+	file << "        std::fill(batch.begin() + n*nVariables, batch.end(), 0.f);" << std::endl;
+	file << "        std::vector<float> output = session.infer(batch.data());" << std::endl;
+	file << "        std::copy(output.begin(), output.begin() + n, scores + start);" << std::endl;
+	file << "    }" << std::endl << "}" << std::endl;
+	return kTRUE;
+}
@@ -0,0 +1,70 @@
+#ifndef NetworkUtils_hh
+#define NetworkUtils_hh 1
+
+#include <TString.h>
+
+#include <cstdint>
+#include <vector>
+
+// Dense network of the TMVA deep learning (MethodDL) weight file prepared for batched float inference.
+// Batch normalization layers are folded into the weights of the next dense layer when the file is read
+
+namespace NetworkUtils {
+	// Dense layer followed by the activation. Weights are stored transposed (nInputs x nOutputs)
+	struct DenseLayer {
+		Int_t nInputs = 0;
+		Int_t nOutputs = 0;
+		std::vector<Float_t> weights;
+		std::vector<Float_t> biases;
+		Int_t activation = 0;         // TMVA::DNN::EActivationFunction
+	};
+
+	// Int8 copy of the dense layer weights for KernelUtils::denseInt8: weights/weightScale rounded to -127..127,
+	// grouped by four inputs ([nInputs/4][nOutputs][4]) and padded with zeros to multiples of 4 inputs and 8 outputs.
+	// Inputs are rounded to inputScale steps
+	struct QuantizedLayer {
+		Int_t nInputs = 0;
+		Int_t nOutputs = 0;
+		std::vector<std::int8_t> weights;
+		Float_t weightScale = 1;
+		Float_t inputScale = 1;
+	};
+
+	struct Network {
+		std::vector<TString> variables;
+		std::vector<DenseLayer> layers;
+		Char_t outputFunction = 'I';  // TMVA::DNN::EOutputFunction
+		std::vector<QuantizedLayer> quantizedLayers;  // used instead of the float weights if not empty
+	};
+
+	// Read network built of dense, batch normalization and reshape layers with single output and without variable
+	// transformations. Returns false for other layouts (e.g. convolutional networks)
+	Bool_t readNetwork(const char* weightFilePath, Network& network);
+
+	// Evaluate the network over nEvents input rows (nEvents x nVariables, row-major) with KernelUtils::dense, or
+	// with KernelUtils::denseInt8 if the network is quantized
+	void evaluate(const Network& network, const Float_t* inputs, Long64_t nEvents, Double_t* scores);
+
+	// Largest absolute input value of every layer over the calibration sample, divided by 127
+	std::vector<Float_t> calibrateInputScales(const Network& network, const Float_t* inputs, Long64_t nEvents);
+
+	// Post-training int8 quantization with per-layer weight scales and given per-layer input scales
+	void quantize(Network& network, const std::vector<Float_t>& inputScales);
+
+	// Save and restore the calibrated input scales ("layer<i> <scale>" lines). Scales are written with the MD5 of the
+	// weight file they were calibrated for ("weights <md5>" line), reading fails if the weight file has changed since
+	Bool_t writeInputScales(const char* filePath, const char* weightFilePath, const std::vector<Float_t>& inputScales);
+	Bool_t readInputScales(const char* filePath, const char* weightFilePath, std::vector<Float_t>& inputScales);
+
+	// Export the network through TMVA SOFIE into a standalone inference header (weights embedded) for fixed batch
+	// size. Generated namespace is TMVA_SOFIE_<modelName>. Sigmoid, ReLU, tanh and identity activations only.
+	// Returns false if the program is built without TMVA SOFIE (HAS_TMVA_SOFIE)
+	Bool_t writeSofieHeader(const Network& network, const char* modelName, Int_t batchSize, const char* headerFilePath);
+
+	// Write C++ source of the method plugin that evaluates the SOFIE session in batches (same entry points as
+	// ForestUtils::writeSource). Needs only the generated header, SOFIE_common.hxx and BLAS
+	Bool_t writePluginSource(const Network& network, const char* modelName, Int_t batchSize, const char* headerFilePath,
+		const char* sourceFilePath, const char* comment);
+}
+
+#endif
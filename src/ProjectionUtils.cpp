@@ -0,0 +1,114 @@
+#include "./ProjectionUtils.h"
+#include "./KernelUtils.h"
+#include "./StringUtils.h"
+
+#include <TPrincipal.h>
+#include <TROOT.h>
+#include <TError.h>
+
+#include <vector>
+
+using namespace ProjectionUtils;
+
+void ProjectionUtils::fitPCA(TList* trees, Int_t nBins, Int_t nComponents, TMatrixF& projection, TVectorF& offset,
+		const std::vector<std::vector<Long64_t>>* entries){
+	if (nComponents > nBins) nComponents = nBins;
+
+	// Option "" - do not normalize variables (all bins are in Volts) and do not store the input rows
+	TPrincipal principal(nBins, "");
+
+	Long64_t nEvents = 0;
+	Int_t treeIndex = 0;
+	for (TObject* obj : *trees) nEvents += entries ? (Long64_t) (*entries)[treeIndex++].size() : ((TTree*)obj)->GetEntries();
+
+	std::vector<Float_t> waveform(nBins);
+	std::vector<Double_t> row(nBins);
+	treeIndex = 0;
+	for (TObject* obj : *trees){
+		TTree* tree = (TTree*) obj;
+		const std::vector<Long64_t>* treeEntries = entries ? &(*entries)[treeIndex++] : nullptr;
+		for (Int_t i = 0; i < nBins; i++){
+			tree->SetBranchAddress(TString::Format("var%d", i).Data(), &waveform[i]);
+		}
+		Long64_t n = treeEntries ? (Long64_t) treeEntries->size() : tree->GetEntries();
+		for (Long64_t j = 0; j < n; j++){
+			tree->GetEntry(treeEntries ? (*treeEntries)[j] : j);
+			for (Int_t i = 0; i < nBins; i++) row[i] = waveform[i];
+			principal.AddRow(row.data());
+			StringUtils::writeProgress("Accumulating waveform covariance", nEvents);
+		}
+		tree->ResetBranchAddresses();
+	}
+	principal.MakePrincipals();
+
+	// Eigenvectors are stored in columns sorted by decreasing eigenvalue
+	const TMatrixD* eigenVectors = principal.GetEigenVectors();
+	const TVectorD* eigenValues = principal.GetEigenValues();
+	const TVectorD* meanValues = principal.GetMeanValues();
+
+	projection.ResizeTo(nComponents, nBins);
+	offset.ResizeTo(nComponents);
+	Double_t explained = 0;
+	Double_t total = eigenValues->Sum();
+	for (Int_t k = 0; k < nComponents; k++){
+		Double_t sum = 0;
+		for (Int_t i = 0; i < nBins; i++){
+			projection(k, i) = (*eigenVectors)(i, k);
+			sum += (*eigenVectors)(i, k)*(*meanValues)(i);
+		}
+		offset(k) = sum;
+		explained += (*eigenValues)(k);
+	}
+	Info("ProjectionUtils::fitPCA", "%d principal components explain %.2f%% of the waveform variance", nComponents, total > 0 ? explained/total*100 : 0.);
+}
+
+void ProjectionUtils::project(const TMatrixF& projection, const TVectorF& offset, const Float_t* waveform, Float_t* components){
+	KernelUtils::matVec(projection.GetMatrixArray(), waveform, offset.GetMatrixArray(), components, projection.GetNrows(), projection.GetNcols());
+}
+
+TTree* ProjectionUtils::projectTree(TTree* tree, const TMatrixF& projection, const TVectorF& offset, const char* treeName,
+		const std::vector<Long64_t>* entries){
+	Int_t nBins = projection.GetNcols();
+	Int_t nComponents = projection.GetNrows();
+
+	std::vector<Float_t> waveform(nBins);
+	for (Int_t i = 0; i < nBins; i++){
+		tree->SetBranchAddress(TString::Format("var%d", i).Data(), &waveform[i]);
+	}
+
+	// Keep projected tree in memory, not in the (read-only) input file
+	TDirectory::TContext context(gROOT);
+	TTree* projectedTree = new TTree(treeName, tree->GetTitle());
+	std::vector<Float_t> components(nComponents);
+	for (Int_t k = 0; k < nComponents; k++){
+		projectedTree->Branch(TString::Format("pc%d", k).Data(), &components[k], TString::Format("pc%d/F", k).Data());
+	}
+
+	Long64_t n = entries ? (Long64_t) entries->size() : tree->GetEntries();
+	for (Long64_t j = 0; j < n; j++){
+		tree->GetEntry(entries ? (*entries)[j] : j);
+		project(projection, offset, waveform.data(), components.data());
+		projectedTree->Fill();
+	}
+	tree->ResetBranchAddresses();
+	projectedTree->ResetBranchAddresses();
+
+	return projectedTree;
+}
+
+void ProjectionUtils::writeProjection(TDirectory* dir, const TMatrixF& projection, const TVectorF& offset){
+	dir->WriteObject(&projection, "projection");
+	dir->WriteObject(&offset, "offset");
+}
+
+Bool_t ProjectionUtils::readProjection(TDirectory* dir, TMatrixF& projection, TVectorF& offset){
+	if (!dir) return kFALSE;
+	TMatrixF* p = dir->Get<TMatrixF>("projection");
+	TVectorF* o = dir->Get<TVectorF>("offset");
+	if (!p || !o) return kFALSE;
+	projection.ResizeTo(*p);
+	projection = *p;
+	offset.ResizeTo(*o);
+	offset = *o;
+	return kTRUE;
+}
@@ -0,0 +1,34 @@
+#ifndef ProjectionUtils_hh
+#define ProjectionUtils_hh 1
+
+#include <TList.h>
+#include <TTree.h>
+#include <TMatrixF.h>
+#include <TVectorF.h>
+#include <TDirectory.h>
+
+#include <vector>
+
+// Linear dimensionality reduction of the waveforms. Projection is stored as a (nComponents x nBins) matrix
+// and an offset vector so that components = projection * waveform - offset
+
+namespace ProjectionUtils {
+	// Fit principal components on trees with "var0", "var1",... branches. If entry lists are passed (one per tree),
+	// only the listed entries are used, e.g. the training sample
+	void fitPCA(TList* trees, Int_t nBins, Int_t nComponents, TMatrixF& projection, TVectorF& offset,
+			const std::vector<std::vector<Long64_t>>* entries = nullptr);
+
+	// Project single waveform buffer onto components
+	void project(const TMatrixF& projection, const TVectorF& offset, const Float_t* waveform, Float_t* components);
+
+	// Create tree with projected waveforms written in "pc0", "pc1",... branches. If an entry list is passed, only the
+	// listed entries are projected
+	TTree* projectTree(TTree* tree, const TMatrixF& projection, const TVectorF& offset, const char* treeName,
+			const std::vector<Long64_t>* entries = nullptr);
+
+	// Save and restore projection (e.g. next to the TMVA weight files)
+	void writeProjection(TDirectory* dir, const TMatrixF& projection, const TVectorF& offset);
+	Bool_t readProjection(TDirectory* dir, TMatrixF& projection, TVectorF& offset);
+}
+
+#endif
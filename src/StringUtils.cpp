@@ -4,6 +4,7 @@
 #include <TObjString.h>
 #include <TObjArray.h>
 #include <TPRegexp.h>
+#include <TUUID.h>
 
 #include <iostream>
 #include <ostream>
@@ -22,6 +23,37 @@ TString StringUtils::stripExtension(const char *str) {
 	return s2;
 }
 
+TString StringUtils::setOption(const char* options, const char* key, const char* value, char separator){
+	TString result;
+	TString prefix = TString::Format("%s=", key);
+	Bool_t found = kFALSE;
+	TObjArray* tokens = TString(options).Tokenize(TString(separator));
+	for (TObject* obj : *tokens){
+		TString token = ((TObjString*)obj)->GetString();
+		if (token.BeginsWith(prefix, TString::kIgnoreCase)){
+			token = prefix + value;
+			found = kTRUE;
+		}
+		if (result.Length() > 0) result += separator;
+		result += token;
+	}
+	delete tokens;
+	if (!found){
+		if (result.Length() > 0) result += separator;
+		result += prefix + value;
+	}
+	return result;
+}
+
+TString StringUtils::getUniqueName(const char* name) {
+	TUUID uid = TUUID();
+	TString uidSuffix = uid.AsString();
+	TString uniqueName = name;
+	uniqueName += "_";
+	uniqueName += uidSuffix(0,4);
+	return uniqueName;
+}
+
 // TODO: move to some IO utils?
 void StringUtils::writeProgress(const char* s, Int_t nTimes){
     static Int_t counter = 0;
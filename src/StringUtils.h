@@ -8,6 +8,14 @@ namespace StringUtils {
 	// Extract filename from path
 	TString stripExtension(const char *str);
 
+	// Set "key=value" token in the option string with given separator (e.g. ':' in TMVA method options,
+	// ',' in the training strategy). Token is replaced if the key is present (case-insensitive), appended otherwise
+	TString setOption(const char* options, const char* key, const char* value, char separator = ':');
+
+	// Append a short random suffix (UUID characters) so that objects with the same base name do not replace each
+	// other in the ROOT directory
+	TString getUniqueName(const char* name);
+
 	// TODO: move to some IO utils?
 	void writeProgress(const char* s, Int_t nTimes);
 
@@ -0,0 +1,120 @@
+#include "./SystemUtils.h"
+
+#include <TSystem.h>
+#include <TROOT.h>
+#include <TString.h>
+#include <TError.h>
+#include <TMVA/Config.h>
+
+#include <iostream>
+#include <thread>
+#include <map>
+#include <dlfcn.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace SystemUtils;
+
+Int_t SystemUtils::getAvailableCores(){
+	// Batch system allocation (JLab farm runs Slurm)
+	const char* slurmCpus = gSystem->Getenv("SLURM_CPUS_PER_TASK");
+	if (slurmCpus && TString(slurmCpus).Atoi() > 0) return TString(slurmCpus).Atoi();
+
+	// Cores the process is allowed to run on
+	cpu_set_t mask;
+	if (sched_getaffinity(0, sizeof(mask), &mask) == 0) return CPU_COUNT(&mask);
+
+	return std::thread::hardware_concurrency();
+}
+
+namespace {
+	// Call thread-count setter of a threading runtime if it is loaded in the process. Environment variables are
+	// not enough because OpenBLAS and MKL read them once when the library is loaded
+	void setRuntimeThreads(const char* symbol, Int_t n){
+		typedef void (*SetThreadsFunc)(int);
+		SetThreadsFunc func = (SetThreadsFunc) dlsym(RTLD_DEFAULT, symbol);
+		if (func) func(n);
+	}
+}
+
+void SystemUtils::configureThreads(Int_t nThreads, Int_t nOmpThreads){
+	if (nThreads == 0) nThreads = getAvailableCores();
+	if (nOmpThreads <= 0) nOmpThreads = nThreads > 0 ? nThreads : 1;
+
+	// ROOT implicit multi-threading and the TMVA executor (used by the CPU deep learning architecture)
+	if (nThreads > 1) {
+		ROOT::EnableImplicitMT(nThreads);
+		TMVA::gConfig().EnableMT(nThreads);
+	} else {
+		if (ROOT::IsImplicitMTEnabled()) ROOT::DisableImplicitMT();
+		TMVA::gConfig().DisableMT();
+	}
+
+	// OpenMP and BLAS thread pools. Environment is inherited by any child process
+	TString n = TString::Format("%d", nOmpThreads);
+	gSystem->Setenv("OMP_NUM_THREADS", n.Data());
+	gSystem->Setenv("OPENBLAS_NUM_THREADS", n.Data());
+	gSystem->Setenv("MKL_NUM_THREADS", n.Data());
+	setRuntimeThreads("omp_set_num_threads", nOmpThreads);
+	setRuntimeThreads("openblas_set_num_threads", nOmpThreads);
+	setRuntimeThreads("MKL_Set_Num_Threads", nOmpThreads);
+
+	Info("SystemUtils::configureThreads", "Thread layout: %d cores available, ROOT IMT pool %u, TMVA executor %u, OpenMP/BLAS %d",
+		getAvailableCores(), ROOT::IsImplicitMTEnabled() ? ROOT::GetThreadPoolSize() : 1, TMVA::gConfig().GetNCpu(), nOmpThreads);
+}
+
+Int_t SystemUtils::runInWorkers(const std::vector<TString>& names, Int_t nParallel, std::function<void(Int_t)> task){
+	if (nParallel < 1) nParallel = 1;
+	std::map<pid_t, Int_t> running;
+	Int_t nFailed = 0;
+
+	// Wait for any worker to finish
+	auto waitWorker = [&](){
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid <= 0) return;
+		Int_t i = running[pid];
+		running.erase(pid);
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 0){
+			Info("SystemUtils::runInWorkers", "Worker \"%s\" finished", names[i].Data());
+		} else {
+			Error("SystemUtils::runInWorkers", "Worker \"%s\" failed, see \"%s.log\"", names[i].Data(), names[i].Data());
+			nFailed++;
+		}
+	};
+
+	for (Int_t i = 0; i < (Int_t)names.size(); i++){
+		while ((Int_t)running.size() >= nParallel) waitWorker();
+
+		std::cout << std::flush;
+		pid_t pid = fork();
+		if (pid < 0){
+			Error("SystemUtils::runInWorkers", "Cannot start worker \"%s\"", names[i].Data());
+			nFailed++;
+			continue;
+		}
+		if (pid == 0){
+			// Worker process
+			gSystem->RedirectOutput(TString::Format("%s.log", names[i].Data()).Data(), "w");
+			task(i);
+			gSystem->Exit(0);
+		}
+		Info("SystemUtils::runInWorkers", "Started worker \"%s\" (pid %d)", names[i].Data(), pid);
+		running[pid] = i;
+	}
+	while (!running.empty()) waitWorker();
+
+	return nFailed;
+}
+
+Bool_t SystemUtils::compileLibrary(const char* sourceFilePath, const char* libraryFilePath, const char* flags, const char* libraries){
+	const char* compiler = gSystem->Getenv("CXX");
+	TString command = TString::Format("%s %s -shared -fPIC -o \"%s\" \"%s\" %s", compiler ? compiler : "c++", flags, libraryFilePath, sourceFilePath, libraries);
+	Info("SystemUtils::compileLibrary", "%s", command.Data());
+	if (gSystem->Exec(command.Data()) != 0){
+		Error("SystemUtils::compileLibrary", "Cannot compile \"%s\"", sourceFilePath);
+		return kFALSE;
+	}
+	return kTRUE;
+}
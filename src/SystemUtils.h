@@ -0,0 +1,27 @@
+#ifndef SystemUtils_hh
+#define SystemUtils_hh 1
+
+#include <Rtypes.h>
+#include <TString.h>
+
+#include <functional>
+#include <vector>
+
+namespace SystemUtils {
+	// Number of cores available to the process (batch allocation, CPU affinity mask or hardware)
+	Int_t getAvailableCores();
+
+	// Configure ROOT implicit multi-threading, TMVA CPU executor and OpenMP/BLAS thread pools consistently.
+	// nThreads: 0 - all available cores, negative - sequential. nOmpThreads: 0 - same as nThreads
+	void configureThreads(Int_t nThreads, Int_t nOmpThreads = 0);
+
+	// Run tasks in forked worker processes, at most nParallel at a time. Output of every worker is redirected
+	// to "<name>.log". Must be called before any threads are started. Returns number of failed workers
+	Int_t runInWorkers(const std::vector<TString>& names, Int_t nParallel, std::function<void(Int_t)> task);
+
+	// Compile C++ source into a shared library with the system compiler ($CXX, default c++). Libraries are passed
+	// after the source file
+	Bool_t compileLibrary(const char* sourceFilePath, const char* libraryFilePath, const char* flags = "-O2", const char* libraries = "");
+}
+
+#endif
@@ -0,0 +1,356 @@
+#include "./TmvaUtils.h"
+
+#include <TFile.h>
+#include <TKey.h>
+#include <TTree.h>
+#include <TLeaf.h>
+#include <TClass.h>
+#include <TError.h>
+#include <TMD5.h>
+#include <TObjString.h>
+#include <TObjArray.h>
+#include <TVectorD.h>
+#include <TSystem.h>
+#include <TMVA/DataLoader.h>
+#include <TMVA/DataSetInfo.h>
+#include <TMVA/DataSet.h>
+#include <TMVA/Event.h>
+
+#include <set>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+using namespace TmvaUtils;
+
+namespace {
+	// Add float (or float array) branches that exist in the source tree only (e.g. response of another method) to the target tree
+	void addMissingBranches(TTree* source, TTree* target){
+		if (source->GetEntries() != target->GetEntries()){
+			Warning("TmvaUtils::mergeDirectory", "Tree \"%s\" has different number of entries in the merged files, skipping", source->GetName());
+			return;
+		}
+		for (TObject* obj : *source->GetListOfLeaves()){
+			TLeaf* leaf = (TLeaf*) obj;
+			if (target->GetBranch(leaf->GetName())) continue;
+			if (TString(leaf->GetTypeName()) != "Float_t"){
+				Warning("TmvaUtils::mergeDirectory", "Branch \"%s\" of type %s is not merged", leaf->GetName(), leaf->GetTypeName());
+				continue;
+			}
+			// Multiclass response is a fixed size array with one value per class
+			Int_t length = leaf->GetLenStatic();
+			std::vector<Float_t> values(length);
+			TString leafList = length > 1 ? TString::Format("%s[%d]/F", leaf->GetName(), length) : TString::Format("%s/F", leaf->GetName());
+			source->SetBranchStatus("*", 0);
+			source->SetBranchStatus(leaf->GetName(), 1);
+			source->SetBranchAddress(leaf->GetName(), values.data());
+			TBranch* branch = target->Branch(leaf->GetName(), values.data(), leafList.Data());
+			for (Long64_t i = 0; i < source->GetEntries(); i++){
+				source->GetEntry(i);
+				branch->Fill();
+			}
+			source->ResetBranchAddresses();
+			source->SetBranchStatus("*", 1);
+			target->ResetBranchAddresses();
+		}
+	}
+
+	// Dataset file signature and version
+	const char datasetMagic[8] = { 'D', 'R', 'T', 'M', 'V', 'A', '0', '1' };
+
+	const TMVA::Types::ETreeType treeTypes[2] = { TMVA::Types::kTraining, TMVA::Types::kTesting };
+	const char* classNames[2] = { "Signal", "Background" };
+}
+
+void TmvaUtils::mergeDirectory(TDirectory* source, TDirectory* target){
+	std::set<std::string> processed;
+	for (TObject* obj : *source->GetListOfKeys()){
+		TKey* key = (TKey*) obj;
+		// Only the latest cycle of every key
+		if (!processed.insert(key->GetName()).second) continue;
+		key = source->GetKey(key->GetName());
+
+		TClass* cl = TClass::GetClass(key->GetClassName());
+		if (!cl) continue;
+		if (cl->InheritsFrom(TDirectory::Class())){
+			TDirectory* sourceDir = source->GetDirectory(key->GetName());
+			TDirectory* targetDir = target->GetDirectory(key->GetName());
+			if (!targetDir) targetDir = target->mkdir(key->GetName(), key->GetTitle());
+			mergeDirectory(sourceDir, targetDir);
+		}
+		else if (cl->InheritsFrom(TTree::Class())){
+			TTree* tree = source->Get<TTree>(key->GetName());
+			TTree* targetTree = target->Get<TTree>(key->GetName());
+			target->cd();
+			if (!targetTree){
+				targetTree = tree->CloneTree(-1, "fast");
+			} else {
+				addMissingBranches(tree, targetTree);
+			}
+			targetTree->Write("", TObject::kOverwrite);
+		}
+		else if (!target->GetKey(key->GetName())){
+			TObject* object = key->ReadObj();
+			target->cd();
+			object->Write(key->GetName());
+		}
+	}
+}
+
+Bool_t TmvaUtils::mergeTrainingOutputs(const std::vector<TString>& inputFilePaths, const char* outputFilePath){
+	TDirectory::TContext context;
+	TFile* outputFile = TFile::Open(outputFilePath, "RECREATE");
+	if (!outputFile || outputFile->IsZombie()) return kFALSE;
+
+	for (const TString& inputFilePath : inputFilePaths){
+		TFile* inputFile = TFile::Open(inputFilePath.Data());
+		if (!inputFile || inputFile->IsZombie()){
+			Error("TmvaUtils::mergeTrainingOutputs", "Cannot open \"%s\"", inputFilePath.Data());
+			outputFile->Close();
+			return kFALSE;
+		}
+		mergeDirectory(inputFile, outputFile);
+		inputFile->Close();
+	}
+	outputFile->Close();
+	Info("TmvaUtils::mergeTrainingOutputs", "Merged %d training outputs into \"%s\"", (Int_t)inputFilePaths.size(), outputFilePath);
+	return kTRUE;
+}
+
+void TmvaUtils::writeVariables(TDirectory* dir, const std::vector<Int_t>& variables){
+	TVectorD v(variables.size());
+	for (size_t i = 0; i < variables.size(); i++) v[i] = variables[i];
+	dir->WriteObject(&v, "variables");
+}
+
+Bool_t TmvaUtils::readVariables(TDirectory* dir, std::vector<Int_t>& variables){
+	TVectorD* v = dir->Get<TVectorD>("variables");
+	variables.clear();
+	if (!v) return kFALSE;
+	for (Int_t i = 0; i < v->GetNrows(); i++) variables.push_back((Int_t)(*v)[i]);
+	return kTRUE;
+}
+
+void TmvaUtils::writeClasses(TDirectory* dir, const std::vector<TString>& classes){
+	TString names;
+	for (const TString& name : classes){
+		if (names.Length() > 0) names += ",";
+		names += name;
+	}
+	TObjString s(names);
+	dir->WriteObject(&s, "classes");
+}
+
+Bool_t TmvaUtils::readClasses(TDirectory* dir, std::vector<TString>& classes){
+	TObjString* s = dir->Get<TObjString>("classes");
+	classes.clear();
+	if (!s) return kFALSE;
+	TObjArray* tokens = s->GetString().Tokenize(",");
+	for (TObject* obj : *tokens) classes.push_back(((TObjString*)obj)->GetString());
+	delete tokens;
+	return kTRUE;
+}
+
+Long64_t TmvaUtils::countLayoutParameters(const char* layout, Int_t nInputs){
+	// Shape of the layer output: depth x height x width
+	Long64_t depth = 1, height = 1, width = nInputs;
+	Long64_t nParameters = 0;
+	TObjArray* layers = TString(layout).Tokenize(",");
+	for (TObject* obj : *layers){
+		TObjArray* fields = ((TObjString*)obj)->GetString().Tokenize("|");
+		auto field = [&](Int_t i){
+			return i < fields->GetEntriesFast() ? ((TObjString*)fields->At(i))->GetString().Atoi() : 0;
+		};
+		TString type = ((TObjString*)fields->At(0))->GetString();
+		type.ToUpper();
+		if (type == "DENSE"){
+			Long64_t n = field(1);
+			nParameters += depth*height*width*n + n;
+			depth = 1;
+			height = 1;
+			width = n;
+		} else if (type == "CONV"){
+			// CONV|depth|filter height|filter width|stride rows|stride cols|padding height|padding width|activation
+			Long64_t n = field(1);
+			nParameters += n*depth*field(2)*field(3) + n;
+			height = (height - field(2) + 2*field(6))/std::max(1, field(4)) + 1;
+			width = (width - field(3) + 2*field(7))/std::max(1, field(5)) + 1;
+			depth = n;
+		} else if (type == "MAXPOOL"){
+			// MAXPOOL|filter height|filter width|stride rows|stride cols
+			height = (height - field(1))/std::max(1, field(3)) + 1;
+			width = (width - field(2))/std::max(1, field(4)) + 1;
+		} else if (type == "RESHAPE"){
+			width = depth*height*width;
+			depth = 1;
+			height = 1;
+		} else if (type == "BNORM"){
+			// Scale and shift per feature (dense) or per channel (convolution)
+			nParameters += 2*((depth == 1 && height == 1) ? width : depth);
+		} else {
+			Warning("TmvaUtils::countLayoutParameters", "Layer \"%s\" is not counted", ((TObjString*)obj)->GetString().Data());
+		}
+		delete fields;
+	}
+	delete layers;
+	return nParameters;
+}
+
+TString TmvaUtils::getDatasetKey(const char* inputFilePath, const char* description){
+	TMD5* fileChecksum = TMD5::FileChecksum(inputFilePath);
+	if (!fileChecksum) return "";
+	TString key = TString(fileChecksum->AsString()) + description;
+	delete fileChecksum;
+
+	TMD5 md5;
+	md5.Update((const UChar_t*) key.Data(), key.Length());
+	md5.Final();
+	return md5.AsString();
+}
+
+Bool_t TmvaUtils::readOutputSamples(TDirectory* datasetDir, const char* treeName, const std::vector<TString>& variables, DatasetSample samples[2]){
+	TTree* tree = datasetDir ? datasetDir->Get<TTree>(treeName) : nullptr;
+	if (!tree){
+		Error("TmvaUtils::readOutputSamples", "Training output has no \"%s\" tree", treeName);
+		return kFALSE;
+	}
+	// Signal is the first class of the DataLoader, other classes (e.g. baseline) are skipped
+	Int_t classID = 0;
+	Float_t weight = 1;
+	Int_t nVars = variables.size();
+	std::vector<Float_t> values(nVars);
+	Bool_t ok = tree->SetBranchAddress("classID", &classID) >= 0 && tree->SetBranchAddress("weight", &weight) >= 0;
+	for (Int_t i = 0; ok && i < nVars; i++){
+		ok = tree->SetBranchAddress(variables[i].Data(), &values[i]) >= 0;
+	}
+	if (!ok){
+		Error("TmvaUtils::readOutputSamples", "Tree \"%s\" has no branches of the input variables", treeName);
+		tree->ResetBranchAddresses();
+		return kFALSE;
+	}
+	for (Int_t c = 0; c < 2; c++){
+		samples[c].values.clear();
+		samples[c].weights.clear();
+	}
+	for (Long64_t i = 0; i < tree->GetEntries(); i++){
+		tree->GetEntry(i);
+		if (classID < 0 || classID > 1) continue;
+		samples[classID].values.insert(samples[classID].values.end(), values.begin(), values.end());
+		samples[classID].weights.push_back(weight);
+	}
+	tree->ResetBranchAddresses();
+	return kTRUE;
+}
+
+void TmvaUtils::extractDataset(TMVA::DataLoader* loader, Dataset& dataset){
+	TMVA::DataSetInfo& info = loader->GetDataSetInfo();
+	TMVA::DataSet* data = info.GetDataSet();
+	UInt_t signalClass = info.GetClassInfo(classNames[0])->GetNumber();
+
+	dataset.variables.clear();
+	for (UInt_t i = 0; i < info.GetNVariables(); i++){
+		dataset.variables.push_back(info.GetVariableInfo(i).GetExpression());
+	}
+	for (Int_t t = 0; t < 2; t++){
+		for (Int_t c = 0; c < 2; c++){
+			dataset.samples[c][t].values.clear();
+			dataset.samples[c][t].weights.clear();
+		}
+		for (Long64_t i = 0; i < data->GetNEvents(treeTypes[t]); i++){
+			const TMVA::Event* event = data->GetEvent(i, treeTypes[t]);
+			DatasetSample& sample = dataset.samples[event->GetClass() == signalClass ? 0 : 1][t];
+			const std::vector<Float_t>& values = event->GetValues();
+			sample.values.insert(sample.values.end(), values.begin(), values.end());
+			sample.weights.push_back(event->GetOriginalWeight());
+		}
+	}
+}
+
+void TmvaUtils::fillDataLoader(const Dataset& dataset, TMVA::DataLoader* loader){
+	for (const TString& variable : dataset.variables){
+		loader->AddVariable(variable);
+	}
+	Int_t nVars = dataset.variables.size();
+	std::vector<Double_t> event(nVars);
+	for (Int_t c = 0; c < 2; c++){
+		for (Int_t t = 0; t < 2; t++){
+			const DatasetSample& sample = dataset.samples[c][t];
+			for (size_t i = 0; i < sample.weights.size(); i++){
+				const Float_t* values = &sample.values[i*nVars];
+				for (Int_t j = 0; j < nVars; j++) event[j] = values[j];
+				loader->AddEvent(classNames[c], treeTypes[t], event, sample.weights[i]);
+			}
+		}
+	}
+}
+
+Bool_t TmvaUtils::writeDataset(const char* filePath, const Dataset& dataset){
+	TString tmpFilePath = TString::Format("%s.%d", filePath, gSystem->GetPid());
+	FILE* file = fopen(tmpFilePath.Data(), "wb");
+	if (!file) return kFALSE;
+
+	// Header: signature, variable names
+	fwrite(datasetMagic, 1, sizeof(datasetMagic), file);
+	Int_t nVars = dataset.variables.size();
+	fwrite(&nVars, sizeof(Int_t), 1, file);
+	for (const TString& variable : dataset.variables){
+		Int_t length = variable.Length();
+		fwrite(&length, sizeof(Int_t), 1, file);
+		fwrite(variable.Data(), 1, length, file);
+	}
+
+	// Samples: number of events, values, weights
+	for (Int_t c = 0; c < 2; c++){
+		for (Int_t t = 0; t < 2; t++){
+			const DatasetSample& sample = dataset.samples[c][t];
+			Long64_t nEvents = sample.weights.size();
+			fwrite(&nEvents, sizeof(Long64_t), 1, file);
+			fwrite(sample.values.data(), sizeof(Float_t), sample.values.size(), file);
+			fwrite(sample.weights.data(), sizeof(Float_t), sample.weights.size(), file);
+		}
+	}
+
+	Bool_t ok = !ferror(file);
+	ok = (fclose(file) == 0) && ok;
+	if (ok) ok = (gSystem->Rename(tmpFilePath.Data(), filePath) == 0);
+	if (!ok){
+		gSystem->Unlink(tmpFilePath.Data());
+		Error("TmvaUtils::writeDataset", "Cannot write \"%s\"", filePath);
+	}
+	return ok;
+}
+
+Bool_t TmvaUtils::readDataset(const char* filePath, Dataset& dataset){
+	FILE* file = fopen(filePath, "rb");
+	if (!file) return kFALSE;
+
+	Bool_t ok = kTRUE;
+	char magic[sizeof(datasetMagic)];
+	Int_t nVars = 0;
+	ok = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, datasetMagic, sizeof(magic)) == 0;
+	ok = ok && fread(&nVars, sizeof(Int_t), 1, file) == 1 && nVars > 0;
+	dataset.variables.clear();
+	for (Int_t i = 0; ok && i < nVars; i++){
+		Int_t length = 0;
+		ok = fread(&length, sizeof(Int_t), 1, file) == 1 && length > 0;
+		std::string name(ok ? length : 0, ' ');
+		ok = ok && fread(&name[0], 1, length, file) == (size_t) length;
+		dataset.variables.push_back(name.c_str());
+	}
+	for (Int_t c = 0; ok && c < 2; c++){
+		for (Int_t t = 0; ok && t < 2; t++){
+			DatasetSample& sample = dataset.samples[c][t];
+			Long64_t nEvents = 0;
+			ok = fread(&nEvents, sizeof(Long64_t), 1, file) == 1 && nEvents >= 0;
+			if (!ok) break;
+			sample.values.resize(nEvents*nVars);
+			sample.weights.resize(nEvents);
+			ok = fread(sample.values.data(), sizeof(Float_t), sample.values.size(), file) == sample.values.size();
+			ok = ok && fread(sample.weights.data(), sizeof(Float_t), sample.weights.size(), file) == sample.weights.size();
+		}
+	}
+	fclose(file);
+	if (!ok) Warning("TmvaUtils::readDataset", "Dataset file \"%s\" is corrupted", filePath);
+	return ok;
+}
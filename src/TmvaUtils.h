@@ -0,0 +1,67 @@
+#ifndef TmvaUtils_hh
+#define TmvaUtils_hh 1
+
+#include <TDirectory.h>
+#include <TString.h>
+
+#include <vector>
+
+namespace TMVA {
+	class DataLoader;
+}
+
+// Helpers for the TMVA training output, weight files and datasets
+
+namespace TmvaUtils {
+	// Merge output files of the TMVA factories that trained different methods on the same dataset.
+	// Method directories are copied, response branches of TestTree/TrainTree are joined column-wise
+	Bool_t mergeTrainingOutputs(const std::vector<TString>& inputFilePaths, const char* outputFilePath);
+
+	// Recursively copy objects missing in the target directory
+	void mergeDirectory(TDirectory* source, TDirectory* target);
+
+	// Save and restore indices of the waveform bins used as input variables (pruned variable list)
+	void writeVariables(TDirectory* dir, const std::vector<Int_t>& variables);
+	Bool_t readVariables(TDirectory* dir, std::vector<Int_t>& variables);
+
+	// Save and restore names of the classes of the multiclass training (e.g. "Signal", "Background", "Baseline")
+	void writeClasses(TDirectory* dir, const std::vector<TString>& classes);
+	Bool_t readClasses(TDirectory* dir, std::vector<TString>& classes);
+
+	// Number of trainable parameters of the TMVA deep learning layout ("DENSE|100|RELU,BNORM,..." or "CONV|...")
+	// applied to the 1 x nInputs waveform image
+	Long64_t countLayoutParameters(const char* layout, Int_t nInputs);
+
+	// Events of one class in the training or test sample. Values are stored row-major (nEvents x nVariables)
+	struct DatasetSample {
+		std::vector<Float_t> values;
+		std::vector<Float_t> weights;
+	};
+
+	// Prepared (split) dataset of the DataLoader
+	struct Dataset {
+		std::vector<TString> variables;
+		DatasetSample samples[2][2];    // [signal, background][training, test]
+	};
+
+	// Events of the signal and background class in the TrainTree or TestTree of the training output directory
+	// ("dataset"), values of the given variables in their order. Returns false if the tree or a branch is missing
+	Bool_t readOutputSamples(TDirectory* datasetDir, const char* treeName, const std::vector<TString>& variables, DatasetSample samples[2]);
+
+	// Dataset cache key: MD5 of the input file combined with the dataset description (variables, split options).
+	// Empty if the input file cannot be read
+	TString getDatasetKey(const char* inputFilePath, const char* description);
+
+	// Copy events of the training and test samples from the DataLoader (builds the dataset if needed)
+	void extractDataset(TMVA::DataLoader* loader, Dataset& dataset);
+
+	// Declare variables and add events to the DataLoader keeping their training/test assignment
+	void fillDataLoader(const Dataset& dataset, TMVA::DataLoader* loader);
+
+	// Compact binary dataset file. File is written under a temporary name and renamed, so concurrent
+	// runs never read a partially written file
+	Bool_t writeDataset(const char* filePath, const Dataset& dataset);
+	Bool_t readDataset(const char* filePath, Dataset& dataset);
+}
+
+#endif
@@ -8,69 +8,185 @@
 #include <TH1.h>
 #include <TLeaf.h>
 #include <TVectorD.h>
+#include <TMatrixF.h>
+#include <TVectorF.h>
 #include <TMacro.h>
 #include <TList.h>
 #include <TError.h>
 #include <TROOT.h>
 #include <TObjString.h>
 #include <TString.h>
+#include <TStopwatch.h>
+#include <TRegexp.h>
+#include <TRandom3.h>
+
+#include <ROOT/TThreadExecutor.hxx>
+#include <ROOT/TSeq.hxx>
 
 #include <TMVA/Types.h>
 #include <TMVA/DataLoader.h>
 #include <TMVA/Factory.h>
+#include <TMVA/CrossValidation.h>
 #include <TMVA/TMVAGui.h>
 #include <TMVA/Reader.h>
 #include <TMVA/Tools.h>
+#include <TMVA/Config.h>
+#include <TMVA/MethodBase.h>
 #include <TMVA/PyMethodBase.h>
 // #include "tinyfiledialogs.h"
+#include "./AnalysisUtils.h"
+#include "./BundleUtils.h"
 #include "./FileUtils.h"
+#include "./ForestUtils.h"
 #include "./HistUtils.h"
+#include "./InferenceUtils.h"
+#include "./KernelUtils.h"
+#include "./NetworkUtils.h"
+#include "./ProjectionUtils.h"
 #include "./StringUtils.h"
+#include "./SystemUtils.h"
+#include "./TmvaUtils.h"
 #include "./UiUtils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <iomanip>
+#include <map>
+#include <mutex>
 #include <set>
+#include <thread>
 #include <vector>
 #include "cxxopts.hpp"
 
 #define N_BINS 10000
-#define VOLTAGE_THRESHOLD -0.03
-#define MIN_PEAK_POS -1E-8
-#define MAX_PEAK_POS 2E-8
+
+// Noise cuts (HistUtils::voltageThreshold and peak window) are loaded from this file if it exists
+#define NOISE_CUTS_FILE_NAME "noise-cuts.txt"
+
+// Pile-up detection: pulses above a fraction of the main pulse (and above the voltage threshold), at least
+// PILEUP_MIN_DISTANCE apart and separated by a valley below PILEUP_VALLEY_FRACTION of the lower pulse
+#define PILEUP_PEAK_FRACTION 0.2
+#define PILEUP_MIN_DISTANCE 2E-9
+#define PILEUP_VALLEY_FRACTION 0.7
+
+// File stored next to the TMVA weight files with the waveform preprocessing parameters (projection etc.)
+#define PREPROCESSING_FILE_NAME "TMVA_CNN_Classification_Preprocessing.root"
+
+// BLAS libraries the 'compile-dnn' plugins are linked with, CMake passes the detected BLAS ($BLAS_LIBS overrides)
+#ifndef SOFIE_BLAS_LIBS
+#define SOFIE_BLAS_LIBS "-lblas"
+#endif
 
 // Function imports all Tektronix waveforms from a directory and filters out the "bad" (noise) waveforms.
-// Returns TList of "good" TH1* histograms
+// Returns TList of "good" TH1* histograms. If baselineHists is given, noise waveforms are moved there
+// (baseline class of the multiclass training) instead of being dropped. Without noise cuts (multiclass classification)
+// only the waveforms with pile-up or unexpected number of bins are removed
 
-TList* getGoodHistogramsList(const char *dirPath, bool saveWaveformImages = kFALSE) {
+TList* getGoodHistogramsList(const char *dirPath, bool saveWaveformImages = kFALSE, TList *baselineHists = nullptr, Bool_t applyNoiseCuts = kTRUE) {
     // Obtain Cerenkov waveform paths from a directory
     TList *waveformFilenames = FileUtils::getFilePathsInDirectory(dirPath, ".csv");
 
-    // Compose list of histograms
-    TList *hists = new TList();
-//    Int_t counter = 0;
-//    Int_t nHists = ;
+    // Parsed waveform and its pulses (filled by the parallel workers)
+    struct ParsedWaveform {
+        Bool_t ok = kFALSE;
+        std::vector<double> time;
+        std::vector<double> voltage;
+        Int_t nPeaks = 0;
+        Double_t peakSeparation = 0;
+    };
+
+    // Worker: parse CSV file and count pulses on the contiguous inverted buffer
+    std::vector<std::string> paths;
     for (TObject *obj : *waveformFilenames) {
-        StringUtils::writeProgress("Converting waveforms to ROOT histograms", waveformFilenames->GetSize());
-//        std::cout << "\r: " progress*100 << "% (" << counter << "/" << nHists << ") ";
-        //        std::cout << "\rConverting waveforms to ROOT histograms: " progress*100 << "% (" << counter << "/" << nHists << ") ";
-        TObjString *waveformCsvPath = (TObjString*) obj;
-
-        // Import CSV waveform into histogram
-        TH1 *hist = FileUtils::tekWaveformToHist(waveformCsvPath->String().Data());
-        if (!hist)
-            continue;
+        paths.push_back(((TObjString*) obj)->String().Data());
+    }
+    auto parse = [&paths](UInt_t i) {
+        ParsedWaveform w;
+        w.ok = FileUtils::readTekWaveform(paths[i].c_str(), w.time, w.voltage);
+        if (!w.ok || w.time.size() <= 2)
+            return w;
+
+        Int_t n = w.voltage.size();
+        std::vector<Float_t> buffer(n);
+        Float_t maximum = 0;
+        for (Int_t j = 0; j < n; j++) {
+            buffer[j] = w.voltage[j] < 0 ? -w.voltage[j] : 0;
+            maximum = std::max(maximum, buffer[j]);
+        }
+        Double_t binWidth = w.time[1] - w.time[0];
+        Float_t threshold = std::max(PILEUP_PEAK_FRACTION * maximum, -HistUtils::voltageThreshold);
+        Int_t minDistance = std::max(1, (Int_t) (PILEUP_MIN_DISTANCE / binWidth));
+        Int_t peaks[16];
+        w.nPeaks = KernelUtils::findPeaks(buffer.data(), n, threshold, minDistance, PILEUP_VALLEY_FRACTION, peaks, 16);
+
+        // Distance between the two highest pulses
+        if (w.nPeaks > 1) {
+            Int_t first = 0, second = -1;
+            for (Int_t j = 1; j < std::min(w.nPeaks, 16); j++) {
+                if (buffer[peaks[j]] > buffer[peaks[first]]) {
+                    second = first;
+                    first = j;
+                } else if (second < 0 || buffer[peaks[j]] > buffer[peaks[second]]) {
+                    second = j;
+                }
+            }
+            w.peakSeparation = std::abs(peaks[first] - peaks[second]) * binWidth;
+        }
+        return w;
+    };
 
-        // Add waveform to list of histograms that were able to read
-        hists->Add(hist);
+    // Compose list of histograms. Files are parsed in parallel batches, ROOT histograms are created sequentially
+    TList *hists = new TList();
+    std::map<TObject*, std::pair<Int_t, Double_t>> histPeaks;
+    ROOT::TThreadExecutor executor;
+    const UInt_t batchSize = 64 * executor.GetPoolSize();
+    for (UInt_t batchStart = 0; batchStart < paths.size(); batchStart += batchSize) {
+        UInt_t batchEnd = std::min<UInt_t>(paths.size(), batchStart + batchSize);
+        std::vector<ParsedWaveform> parsed = executor.Map(parse, ROOT::TSeqU(batchStart, batchEnd));
+
+        for (UInt_t i = batchStart; i < batchEnd; i++) {
+            StringUtils::writeProgress("Converting waveforms to ROOT histograms", waveformFilenames->GetSize());
+            ParsedWaveform &w = parsed[i - batchStart];
+            if (!w.ok) {
+                exit(1);
+            }
+
+            // Import CSV waveform into histogram
+            TH1 *hist = FileUtils::waveformToHist(paths[i].c_str(), w.time, w.voltage);
+            if (!hist)
+                continue;
+
+            // Add waveform to list of histograms that were able to read
+            hists->Add(hist);
+            histPeaks[hist] = std::make_pair(w.nPeaks, w.peakSeparation);
+
+            // Optionally: save waveforms as images
+            TString waveformImgPath("");
+            waveformImgPath = StringUtils::stripExtension(paths[i].c_str());
+            waveformImgPath += ".png";
+            if (saveWaveformImages){
+                UiUtils::saveHistogramAsImage(hist, waveformImgPath.Data());
+            }
+        }
+    }
 
-        // Optionally: save waveforms as images
-        TString waveformImgPath("");
-        waveformImgPath = StringUtils::stripExtension(waveformCsvPath->String().Data());
-        waveformImgPath += ".png";
-        if (saveWaveformImages){
-            UiUtils::saveHistogramAsImage(hist, waveformImgPath.Data());
+    // Without noise cuts (multiclass classification) only the pile-up and the number of bins are checked
+    if (!applyNoiseCuts) {
+        for (TObject *obj : *hists) {
+            if (((TH1*) obj)->GetNbinsX() != N_BINS || (HistUtils::rejectPileup && histPeaks[obj].first > 1)) {
+                hists->Remove(obj);
+            }
         }
+        Info("getGoodHistogramsList", "Noise cuts are not applied, %d of %d waveforms kept", hists->GetSize(), waveformFilenames->GetSize());
+        return hists;
     }
 
     // Compose a tree with waveform parameters
@@ -87,6 +203,10 @@ TList* getGoodHistogramsList(const char *dirPath, bool saveWaveformImages = kFAL
     waveformsTree->Branch("minV", &minV, "minV/D");
     double peakPos;
     waveformsTree->Branch("peakPos", &peakPos, "peakPos/D");
+    int nPeaks;
+    waveformsTree->Branch("nPeaks", &nPeaks, "nPeaks/I");
+    double peakSeparation;
+    waveformsTree->Branch("peakSeparation", &peakSeparation, "peakSeparation/D");
     // double mean;
     // waveformsTree->Branch("m", &mean, "mean/D");
     // double sigma;
@@ -102,6 +222,8 @@ TList* getGoodHistogramsList(const char *dirPath, bool saveWaveformImages = kFAL
         // meanV = HistUtils::getMeanY(hist);
         minV = hist->GetMinimum();
         peakPos = hist->GetXaxis()->GetBinCenter(hist->GetMinimumBin());
+        nPeaks = histPeaks[hist].first;
+        peakSeparation = histPeaks[hist].second;
 
         // hist->Fit("gaus");
         // mean = hist->GetFunction("gaus")->GetParameter(1);
@@ -120,7 +242,7 @@ TList* getGoodHistogramsList(const char *dirPath, bool saveWaveformImages = kFAL
     canvas->Divide(2, 1);
     TString canvasTitle = TString::Format("Waveforms Parameters in \"%s\"", dirPath);
     TString canvasSubTitle = TString::Format("\"Good\" waveform criteria: peakVoltage < %.2f V && peakPosition > %.2e s && peakPosition < %.2e s",
-    VOLTAGE_THRESHOLD, MIN_PEAK_POS, MAX_PEAK_POS);
+    HistUtils::voltageThreshold, HistUtils::minPeakSeconds, HistUtils::maxPeakSeconds);
     UiUtils::addCanvasTitle(canvas, canvasTitle.Data(), canvasSubTitle.Data());
 
     {
@@ -146,20 +268,33 @@ TList* getGoodHistogramsList(const char *dirPath, bool saveWaveformImages = kFAL
 
     // Apply cut to spectra and filter out ones
     Int_t nHists = hists->GetSize();
+    Int_t nPileup = 0;
+    Int_t nBaseline = baselineHists ? baselineHists->GetSize() : 0;
     for (TObject *obj : *hists) {
         TH1 *hist = (TH1*) obj;
 
-        // Set minimum voltage threshold to -0.03 V and peak position -1E-8 ... 2E-8
+        // Minimum voltage below the threshold inside the peak window (see NOISE_CUTS_FILE_NAME)
         Double_t minVoltage = hist->GetMinimum();
         Double_t peakPosition = hist->GetXaxis()->GetBinCenter(hist->GetMinimumBin());
         Int_t nBins = hist->GetNbinsX();
-        if (minVoltage > VOLTAGE_THRESHOLD || peakPosition < MIN_PEAK_POS || peakPosition > MAX_PEAK_POS || nBins != N_BINS) {
+        Bool_t isPileup = HistUtils::rejectPileup && histPeaks[hist].first > 1;
+        if (isPileup) nPileup++;
+        if (nBins != N_BINS || isPileup) {
             hists->Remove(obj);
+        } else if (minVoltage > HistUtils::voltageThreshold || peakPosition < HistUtils::minPeakSeconds || peakPosition > HistUtils::maxPeakSeconds) {
+            hists->Remove(obj);
+            if (baselineHists) baselineHists->Add(obj);
         }
         StringUtils::writeProgress("Identifying \"noise\" waveforms", nHists);
     }
+    if (HistUtils::rejectPileup) {
+        Info("getGoodHistogramsList", "Rejected %d waveforms with more than one pulse (pile-up)", nPileup);
+    }
     Int_t goodPercent = hists->GetSize()*100/waveformFilenames->GetSize();
     Info("getGoodHistogramsList", "Identified %d%% \"good\" waveforms (%d files), %d%% noise waveforms (%d files).", goodPercent, hists->GetSize(), 100-goodPercent, waveformFilenames->GetSize() - hists->GetSize());
+    if (baselineHists) {
+        Info("getGoodHistogramsList", "Kept %d noise waveforms for the baseline class", baselineHists->GetSize() - nBaseline);
+    }
     // Debug: save good waveforms under ../*-good/ folder
     //if (saveWaveformImages) {
     //    for (TObject *obj : *hists) {
@@ -181,13 +316,108 @@ TList* getGoodHistogramsList(const char *dirPath, bool saveWaveformImages = kFAL
     return hists;
 }
 
+// Function builds per-class mean and variance waveforms over a sample of files and sets the crop window
+// to the smallest time range that holds given fraction of the total signal/background separation power
+
+void detectSignalWindow(const char *cherPath, const char *cherScintPath, Int_t nSampleFiles, Double_t separationFraction) {
+    TList *backgroundFiles = FileUtils::getFilePathsInDirectory(cherPath, ".csv");
+    TList *signalFiles = FileUtils::getFilePathsInDirectory(cherScintPath, ".csv");
+
+    std::vector<Double_t> meanB, varianceB, timeB;
+    std::vector<Double_t> meanS, varianceS, timeS;
+    Long64_t nB = AnalysisUtils::computeMeanVariance(backgroundFiles, nSampleFiles, HistUtils::voltageThreshold, HistUtils::minPeakSeconds,
+            HistUtils::maxPeakSeconds, meanB, varianceB, timeB);
+    Long64_t nS = AnalysisUtils::computeMeanVariance(signalFiles, nSampleFiles, HistUtils::voltageThreshold, HistUtils::minPeakSeconds,
+            HistUtils::maxPeakSeconds, meanS, varianceS, timeS);
+    if (nB == 0 || nS == 0 || timeB.size() != timeS.size()) {
+        Error("detectSignalWindow", "Cannot compare background and signal waveforms, keeping default window");
+        return;
+    }
+
+    std::vector<Double_t> separation = AnalysisUtils::getSeparation(meanS, varianceS, meanB, varianceB);
+    Int_t first, last;
+    AnalysisUtils::findSmallestWindow(separation, separationFraction, first, last);
+
+    HistUtils::leftEdgeSeconds = timeB[first];
+    HistUtils::rightEdgeSeconds = timeB[last];
+    Info("detectSignalWindow", "Window %.3e ... %.3e s (%d samples) holds %.1f%% of separation power", HistUtils::leftEdgeSeconds, HistUtils::rightEdgeSeconds,
+            last - first + 1, separationFraction * 100);
+}
+
+// Function reads minimum voltage and peak position of every waveform in a directory from the waveform parameters
+// tree. The tree is built by getGoodHistogramsList() if the directory was not processed before
+
+void readWaveformParameters(const char *dirPath, std::vector<Double_t> &minVoltage, std::vector<Double_t> &peakPosition) {
+    TString filePath = gSystem->ConcatFileName(dirPath, "waveforms-parameters.root");
+    if (gSystem->AccessPathName(filePath.Data())) {
+        delete getGoodHistogramsList(dirPath);
+    }
+
+    TDirectory::TContext context;
+    TFile *file = TFile::Open(filePath.Data());
+    TTree *tree = file ? file->Get<TTree>("tree_waveforms") : nullptr;
+    if (!tree) {
+        Error("readWaveformParameters", "Cannot read waveform parameters from \"%s\"", filePath.Data());
+        exit(1);
+    }
+    Double_t minV, peakPos;
+    tree->SetBranchAddress("minV", &minV);
+    tree->SetBranchAddress("peakPos", &peakPos);
+    for (Long64_t i = 0; i < tree->GetEntries(); i++) {
+        tree->GetEntry(i);
+        minVoltage.push_back(minV);
+        peakPosition.push_back(peakPos);
+    }
+    file->Close();
+}
+
+// Function finds the noise cuts (voltage threshold and peak window) on a labelled sample: a directory of "good"
+// waveforms and a directory of noise waveforms. Cuts keep at least minEfficiency of the good waveforms and pass the
+// smallest fraction of the noise. Cuts are written to the config file loaded by the 'prepare' and 'classify' modes
+
+void optimizeNoiseCuts(const char *goodDirPath, const char *noiseDirPath, Double_t minEfficiency, Int_t nSteps, const char *cutsFilePath) {
+    std::vector<Double_t> minVGood, peakPosGood, minVNoise, peakPosNoise;
+    readWaveformParameters(goodDirPath, minVGood, peakPosGood);
+    readWaveformParameters(noiseDirPath, minVNoise, peakPosNoise);
+
+    // Fraction of waveforms passing the current cuts, for comparison
+    auto getEfficiency = [](const std::vector<Double_t> &minV, const std::vector<Double_t> &peakPos) {
+        Long64_t nPassed = 0;
+        for (size_t i = 0; i < minV.size(); i++) {
+            if (minV[i] <= HistUtils::voltageThreshold && peakPos[i] >= HistUtils::minPeakSeconds && peakPos[i] <= HistUtils::maxPeakSeconds) nPassed++;
+        }
+        return minV.size() > 0 ? (Double_t) nPassed / minV.size() : 0.;
+    };
+    Info("optimizeNoiseCuts", "Current cuts: %.2f%% of good and %.2f%% of noise waveforms pass", getEfficiency(minVGood, peakPosGood) * 100,
+            getEfficiency(minVNoise, peakPosNoise) * 100);
+
+    AnalysisUtils::RectangularCut cut;
+    if (!AnalysisUtils::optimizeRectangularCut(minVGood, peakPosGood, minVNoise, peakPosNoise, minEfficiency, nSteps, cut)) {
+        Error("optimizeNoiseCuts", "No cut keeps %.2f%% of the good waveforms", minEfficiency * 100);
+        exit(1);
+    }
+    HistUtils::voltageThreshold = cut.xMax;
+    HistUtils::minPeakSeconds = cut.yMin;
+    HistUtils::maxPeakSeconds = cut.yMax;
+    Info("optimizeNoiseCuts", "Optimized cuts: minimum voltage < %.4f V, peak position %.3e ... %.3e s", cut.xMax, cut.yMin, cut.yMax);
+    Info("optimizeNoiseCuts", "Optimized cuts: %.2f%% of good and %.2f%% of noise waveforms pass", cut.goodEfficiency * 100, cut.noiseEfficiency * 100);
+    if (!HistUtils::writeNoiseCuts(cutsFilePath)) {
+        exit(1);
+    }
+    Info("optimizeNoiseCuts", "Noise cuts written to \"%s\"", cutsFilePath);
+}
+
 enum class MLFileType {
     Linear,    // https://root.cern/doc/master/TMVA__CNN__Classification_8C.html
     PonitsXY,  // https://root.cern/doc/master/TMVAMinimalClassification_8C.html
     PDF         // https://root.cern/doc/master/TMVAClassification_8C.html
 };
 
-void createROOTFileForLearning(const char *cherPath, const char *cherScintPath, Bool_t saveWaveformImages = kFALSE, MLFileType rootFileType = MLFileType::Linear) {
+// Function writes signal and background trees for the training. With multiclass option noise waveforms of both
+// directories are written to the third (baseline) tree instead of being dropped
+
+void createROOTFileForLearning(const char *cherPath, const char *cherScintPath, Bool_t saveWaveformImages = kFALSE, Bool_t multiclass = kFALSE,
+        MLFileType rootFileType = MLFileType::Linear) {
     // TinyFileDialogs approach
     // tinyfd_forceConsole = 0; /* default is 0 */
     // tinyfd_assumeGraphicDisplay = 0; /* default is 0 */
@@ -203,7 +433,8 @@ void createROOTFileForLearning(const char *cherPath, const char *cherScintPath,
     }
 
     // Obtain "good" Cerenkov waveforms for TMVA
-    TList *goodCherHists = getGoodHistogramsList(cherWaveformsDirPath.Data(), saveWaveformImages);
+    TList *baselineHists = multiclass ? new TList() : nullptr;
+    TList *goodCherHists = getGoodHistogramsList(cherWaveformsDirPath.Data(), saveWaveformImages, baselineHists);
     TList *goodCherHistsPrepared = HistUtils::prepHistsForTMVA(goodCherHists);
     Info("createROOTFileForLearning", "\"Good\" background histograms processed (invert, crop)");
 
@@ -215,18 +446,34 @@ void createROOTFileForLearning(const char *cherPath, const char *cherScintPath,
     }
 
     // Obtain "good" Cerenkov and Scintillation waveforms for TMVA
-    TList *goodCherScintHists = getGoodHistogramsList(cherScintWaveformsDirPath.Data(), saveWaveformImages);
+    TList *goodCherScintHists = getGoodHistogramsList(cherScintWaveformsDirPath.Data(), saveWaveformImages, baselineHists);
     TList *goodCherScintHistsPrepared = HistUtils::prepHistsForTMVA(goodCherScintHists);
     Info("createROOTFileForLearning", "\"Good\" signal histograms processed (invert, crop)");
 
+    // Noise waveforms of both directories form the baseline class
+    TList *baselineHistsPrepared = nullptr;
+    if (multiclass) {
+        if (baselineHists->GetSize() > 0) {
+            baselineHistsPrepared = HistUtils::prepHistsForTMVA(baselineHists);
+            Info("createROOTFileForLearning", "Baseline histograms processed (invert, crop)");
+        } else {
+            Warning("createROOTFileForLearning", "No noise waveforms found, baseline tree is not written");
+        }
+    }
+
     // Prepare trees
     TTree *treeBackground;
     TTree *treeSignal;
+    TTree *treeBaseline = nullptr;
     if (rootFileType == MLFileType::Linear) {
         treeBackground = HistUtils::histsToTreeLin(goodCherHistsPrepared, "treeB", "Background Tree - Cerenkov");
         Info("createROOTFileForLearning", "Background Tree Created");
         treeSignal = HistUtils::histsToTreeLin(goodCherScintHistsPrepared, "treeS", "Signal Tree - Cerenkov and scintillation");
         Info("createROOTFileForLearning", "Signal Tree Created");
+        if (baselineHistsPrepared) {
+            treeBaseline = HistUtils::histsToTreeLin(baselineHistsPrepared, "treeN", "Baseline Tree - noise");
+            Info("createROOTFileForLearning", "Baseline Tree Created");
+        }
     }
 //	else if (rootFileType == MLFileType::PDF){
 //		treeBackground = HistUtils::histsToTree(goodCherHistsPrepared, "treeB", "Background Tree - Cerenkov");
@@ -243,6 +490,9 @@ void createROOTFileForLearning(const char *cherPath, const char *cherScintPath,
     TFile *tmvaFile = new TFile(tmvaFileNamePath.Data(), "RECREATE");
     treeBackground->Write();
     treeSignal->Write();
+    if (treeBaseline) {
+        treeBaseline->Write();
+    }
 
     // Write histograms number of bins - need for TMVA reading later if waveforms
     // are written in series
@@ -253,10 +503,17 @@ void createROOTFileForLearning(const char *cherPath, const char *cherScintPath,
         std::cout << "Signal bins not equal to background bins." << std::endl;
         exit(1);
     }
-    TVectorD bins(1);
+    // Axis range is compared with the prepared waveforms at the classification
+    TH1 *preparedHist = (TH1*) goodCherHistsPrepared->At(0);
+    TVectorD bins(3);
     bins[0] = backgroundBins;
+    bins[1] = preparedHist->GetXaxis()->GetXmin();
+    bins[2] = preparedHist->GetXaxis()->GetXmax();
     bins.Write("bins");
 
+    // Write preprocessing parameters (crop window, decimation factor) next to the number of bins
+    HistUtils::writeParameters(tmvaFile);
+
     tmvaFile->Close();
     Info("createROOTFileForLearning", "File \"%s\" created", tmvaFileNamePath.Data());
 }
@@ -371,48 +628,79 @@ void createROOTFileForLearning(const char *cherPath, const char *cherScintPath,
  }
  */
 
-void trainTMVA_CNN(const char *trainingFileURI, std::set<TMVA::Types::EMVA> tmvaMethodOnly) {
-    // Petr Stepanov: refer to: https://root.cern/doc/master/TMVA__CNN__Classification_8C.html
-
-    int num_threads = 0;    // use default threads
-    TMVA::Tools::Instance();
-    // Enable MT running
-    if (num_threads >= 0) {
-        ROOT::EnableImplicitMT(num_threads);
-        if (num_threads > 0)
-            gSystem->Setenv("OMP_NUM_THREADS", TString::Format("%d", num_threads));
-    } else {
-        gSystem->Setenv("OMP_NUM_THREADS", "1");
-    }
-    std::cout << "Running with nthreads  = " << ROOT::GetThreadPoolSize() << std::endl;
-
-    // Open output file
-    TFile *outputFile = nullptr;
-    outputFile = TFile::Open("TMVA_CNN_ClassificationOutput.root", "RECREATE");
-
-    /***
-     ## Create TMVA Factory
+// Methods booked by the training. Both networks are TMVA deep learning methods (TMVA::Types::kDL)
+enum class TrainMethod {
+    BDT,
+    DNN,       // dense network
+    CNN        // 1D convolutional network
+};
 
-     Create the Factory class. Later you can choose the methods
-     whose performance you'd like to investigate.
+// Training configuration collected from the command-line parameters
+struct TrainOptions {
+    std::set<TrainMethod> methods { };        // methods to book, empty - all implemented methods except CNN
+    Int_t nComponents = 0;                    // number of principal components, 0 - train on all bins
+    Bool_t multiclass = kFALSE;               // three classes: signal, background and baseline (noise) waveforms
+    std::vector<Int_t> variables { };         // waveform bins used as input variables (pruned list), empty - all bins
+    Int_t nThreads = 0;                       // ROOT IMT and TMVA threads, 0 - all available cores, negative - sequential
+    Int_t nOmpThreads = 0;                    // OpenMP/BLAS threads, 0 - same as nThreads
+    Bool_t parallelMethods = kFALSE;          // train every method in a separate worker process
+    Bool_t skipFinished = kFALSE;             // skip methods finished by a previous (interrupted) run
+    TString outputFileName = "TMVA_CNN_ClassificationOutput.root";
+    Bool_t writePreprocessing = kTRUE;        // (re)write preprocessing file in the weights folder
+    TFile *inputFile = nullptr;               // preloaded training file (shared by forked workers), nullptr - open the URI
+    TString summaryFileName = "";             // write ROC-AUC, training and inference cost of every method to a text file
+    TString cacheDir = "";                    // folder with the prepared (split) datasets, empty - no cache
+
+    // BDT options
+    TString bdtOptions = "!V:NTrees=400:MinNodeSize=2.5%:MaxDepth=2:BoostType=AdaBoost:AdaBoostBeta=0.5:"
+            "UseBaggedBoost:BaggedSampleFraction=0.5:SeparationType=GiniIndex:nCuts=20";
+
+    // DNN layers and training strategy. One can catenate several training strings with different parameters
+    // (e.g. learning rates or regularizations parameters) with the `|` delimiter
+    TString dnnLayout = "DENSE|100|RELU,BNORM,DENSE|100|RELU,BNORM,DENSE|100|RELU,BNORM,DENSE|100|RELU,DENSE|1|LINEAR";
+    // CNN layers: 1D convolution and pooling front end over the 1 x nVars waveform image. Training strategy is shared with DNN
+    TString cnnLayout = "CONV|8|1|9|1|1|0|4|RELU,MAXPOOL|1|4|1|4,CONV|16|1|5|1|1|0|2|RELU,MAXPOOL|1|4|1|4,RESHAPE|FLAT,"
+            "DENSE|32|RELU,DENSE|1|LINEAR";
+    TString dnnTraining = "LearningRate=1e-3,Momentum=0.9,Repetitions=1,"
+            "ConvergenceSteps=5,BatchSize=100,TestRepetitions=1,"
+            "MaxEpochs=20,WeightDecay=1e-4,Regularization=None,"
+            "Optimizer=ADAM,DropConfig=0.0+0.0+0.0+0.";
+};
 
-     The factory is the major TMVA object you have to interact with. Here is the list of parameters you need to pass
+// Function returns names of the training classes, the multiclass training adds the baseline (noise) waveforms
 
-     - The first argument is the base of the name of all the output
-     weightfiles in the directory weight/ that will be created with the
-     method parameters
+std::vector<TString> getClassNames(const TrainOptions &options) {
+    if (options.multiclass) {
+        return { "Signal", "Background", "Baseline" };
+    }
+    return { "Signal", "Background" };
+}
 
-     - The second argument is the output file for the training results
+// Function splits tree entries into the training and test samples with a fixed seed. Number of training entries
+// is truncated the same way as in the nTrain_* options of the DataLoader
 
-     - The third argument is a string option defining some general configuration for the TMVA session.
-     For example all TMVA output can be suppressed by removing the "!" (not) in front of the "Silent" argument in the
-     option string
+void splitEntries(Long64_t nEntries, Double_t trainFraction, std::vector<Long64_t> &trainEntries, std::vector<Long64_t> &testEntries) {
+    std::vector<Long64_t> entries(nEntries);
+    for (Long64_t i = 0; i < nEntries; i++) entries[i] = i;
+    TRandom3 random(100);
+    for (Long64_t i = nEntries - 1; i > 0; i--) {
+        std::swap(entries[i], entries[random.Integer(i + 1)]);
+    }
+    Long64_t nTrain = (int) (trainFraction * nEntries);
+    trainEntries.assign(entries.begin(), entries.begin() + nTrain);
+    testEntries.assign(entries.begin() + nTrain, entries.end());
+    std::sort(trainEntries.begin(), trainEntries.end());
+    std::sort(testEntries.begin(), testEntries.end());
+}
 
-     - note that we disable any pre-transformation of the input variables and we avoid computing correlations between
-     input variables
-     ***/
+// Function creates the DataLoader with signal and background trees and input variables (waveform bins or their
+// principal components). Preprocessing parameters are saved next to the weight files of the loader. With principal
+// components and 'trainFraction' > 0 the events are split here and the components are fitted on the training sample
+// only; trees are registered as training and test trees. Otherwise the DataLoader splits the events
 
-    TMVA::Factory factory("TMVA_CNN_Classification", outputFile, "!V:ROC:!Silent:Color:AnalysisType=Classification:Transformations=None:!Correlations");
+TMVA::DataLoader *createDataLoader(const char *loaderName, const char *trainingFileURI, const TrainOptions &options, Int_t &nEventsSig,
+        Int_t &nEventsBkg, Int_t *nEventsBaseline = nullptr, Double_t trainFraction = 0) {
+    Int_t nComponents = options.nComponents;
 
     /***
 
@@ -427,7 +715,7 @@ void trainTMVA_CNN(const char *trainingFileURI, std::set<TMVA::Types::EMVA> tmva
 
      **/
 
-    TMVA::DataLoader *loader = new TMVA::DataLoader("dataset");
+    TMVA::DataLoader *loader = new TMVA::DataLoader(loaderName);
 
     /***
 
@@ -437,10 +725,10 @@ void trainTMVA_CNN(const char *trainingFileURI, std::set<TMVA::Types::EMVA> tmva
 
      **/
 
-    // Open teaching ROOT file and extract signal and backgroud trees
-    TFile *inputFile = TFile::Open(trainingFileURI);
+    // Open teaching ROOT file (unless preloaded) and extract signal and backgroud trees
+    TFile *inputFile = options.inputFile ? options.inputFile : TFile::Open(trainingFileURI);
     if (!inputFile) {
-        Error("trainTMVA_CNN", "Input file %s not found", trainingFileURI);
+        Error("createDataLoader", "Input file %s not found", trainingFileURI);
         exit(1);
     }
 
@@ -449,20 +737,99 @@ void trainTMVA_CNN(const char *trainingFileURI, std::set<TMVA::Types::EMVA> tmva
     TTree *signalTree = (TTree*) inputFile->Get("treeS");
     TTree *backgroundTree = (TTree*) inputFile->Get("treeB");
 
-    int nEventsSig = signalTree->GetEntries();
-    int nEventsBkg = backgroundTree->GetEntries();
+    nEventsSig = signalTree->GetEntries();
+    nEventsBkg = backgroundTree->GetEntries();
+
+    // Noise waveforms form the third class of the multiclass training
+    TTree *baselineTree = nullptr;
+    if (options.multiclass) {
+        baselineTree = (TTree*) inputFile->Get("treeN");
+        if (!baselineTree) {
+            Error("createDataLoader", "Input file %s has no baseline tree, run 'prepare' with --multiclass", trainingFileURI);
+            exit(1);
+        }
+        if (nEventsBaseline) *nEventsBaseline = baselineTree->GetEntries();
+    }
+
+    // Read histogram size from file
+    TVectorD *bins = inputFile->Get<TVectorD>("bins");
+    Double_t b = (*bins)[0];
+    HistUtils::readParameters(inputFile);
+
+    // Optionally reduce waveforms to principal components. Projection is saved next to the weight files
+    // so the classification stage applies the same transform
+    TMatrixF projection;
+    TVectorF offset;
+    TTree *signalTestTree = nullptr, *backgroundTestTree = nullptr, *baselineTestTree = nullptr;
+    if (nComponents > 0) {
+        TList trees;
+        trees.Add(signalTree);
+        trees.Add(backgroundTree);
+        if (baselineTree) trees.Add(baselineTree);
+        if (trainFraction > 0) {
+            // Test events must not take part in the fit, so the split is done before the projection
+            std::vector<std::vector<Long64_t>> trainEntries(trees.GetSize()), testEntries(trees.GetSize());
+            for (Int_t i = 0; i < trees.GetSize(); i++) {
+                splitEntries(((TTree*) trees.At(i))->GetEntries(), trainFraction, trainEntries[i], testEntries[i]);
+            }
+            ProjectionUtils::fitPCA(&trees, (Int_t) b, nComponents, projection, offset, &trainEntries);
+            signalTestTree = ProjectionUtils::projectTree(signalTree, projection, offset, "treeS_pca_test", &testEntries[0]);
+            signalTree = ProjectionUtils::projectTree(signalTree, projection, offset, "treeS_pca", &trainEntries[0]);
+            backgroundTestTree = ProjectionUtils::projectTree(backgroundTree, projection, offset, "treeB_pca_test", &testEntries[1]);
+            backgroundTree = ProjectionUtils::projectTree(backgroundTree, projection, offset, "treeB_pca", &trainEntries[1]);
+            if (baselineTree) {
+                baselineTestTree = ProjectionUtils::projectTree(baselineTree, projection, offset, "treeN_pca_test", &testEntries[2]);
+                baselineTree = ProjectionUtils::projectTree(baselineTree, projection, offset, "treeN_pca", &trainEntries[2]);
+            }
+        } else {
+            ProjectionUtils::fitPCA(&trees, (Int_t) b, nComponents, projection, offset);
+            signalTree = ProjectionUtils::projectTree(signalTree, projection, offset, "treeS_pca");
+            backgroundTree = ProjectionUtils::projectTree(backgroundTree, projection, offset, "treeB_pca");
+            if (baselineTree) baselineTree = ProjectionUtils::projectTree(baselineTree, projection, offset, "treeN_pca");
+        }
+        Info("createDataLoader", "Waveforms projected onto %d principal components", projection.GetNrows());
+    }
+    TString weightDirPath = TString(loader->GetName()) + "/" + TMVA::gConfig().GetIONames().fWeightFileDir;
+    gSystem->mkdir(weightDirPath.Data(), kTRUE);
+    TString preprocessingFilePath = gSystem->ConcatFileName(weightDirPath.Data(), PREPROCESSING_FILE_NAME);
+    if (options.writePreprocessing) {
+        TDirectory::TContext context;
+        TFile *preprocessingFile = TFile::Open(preprocessingFilePath.Data(), "RECREATE");
+        HistUtils::writeParameters(preprocessingFile);
+        preprocessingFile->WriteObject(bins, "bins");
+        if (nComponents > 0) {
+            ProjectionUtils::writeProjection(preprocessingFile, projection, offset);
+        }
+        if (options.variables.size() > 0) {
+            TmvaUtils::writeVariables(preprocessingFile, options.variables);
+        }
+        if (options.multiclass) {
+            TmvaUtils::writeClasses(preprocessingFile, getClassNames(options));
+        }
+        preprocessingFile->Close();
+    }
 
     // global event weights per tree (see below for setting event-wise weights)
     Double_t signalWeight = 1.0;
     Double_t backgroundWeight = 1.0;
 
     // You can add an arbitrary number of signal or background trees
-    loader->AddSignalTree(signalTree, signalWeight);
-    loader->AddBackgroundTree(backgroundTree, backgroundWeight);
-
-    // Read histogram size from file
-    TVectorD *bins = inputFile->Get<TVectorD>("bins");
-    Double_t b = (*bins)[0];
+    if (signalTestTree) {
+        loader->AddSignalTree(signalTree, signalWeight, TMVA::Types::kTraining);
+        loader->AddSignalTree(signalTestTree, signalWeight, TMVA::Types::kTesting);
+        loader->AddBackgroundTree(backgroundTree, backgroundWeight, TMVA::Types::kTraining);
+        loader->AddBackgroundTree(backgroundTestTree, backgroundWeight, TMVA::Types::kTesting);
+        if (baselineTree) {
+            loader->AddTree(baselineTree, "Baseline", 1.0, "", TMVA::Types::kTraining);
+            loader->AddTree(baselineTestTree, "Baseline", 1.0, "", TMVA::Types::kTesting);
+        }
+    } else {
+        loader->AddSignalTree(signalTree, signalWeight);
+        loader->AddBackgroundTree(backgroundTree, backgroundWeight);
+        if (baselineTree) {
+            loader->AddTree(baselineTree, "Baseline");
+        }
+    }
 
     // add event variables (image)
     // use new method (from ROOT 6.20 to add a variable array for all image data)
@@ -470,39 +837,200 @@ void trainTMVA_CNN(const char *trainingFileURI, std::set<TMVA::Types::EMVA> tmva
     // loader->AddVariablesArray("vars", (Int_t)b);
 
     // Petr Stepanov: need to revert to old method becauyse of the issue above
-    for (int i = 0; i < b; i++) {
-        TString expression = "var";
-        expression += i;
-        loader->AddVariable(expression);
+    if (nComponents > 0) {
+        for (int i = 0; i < std::min(nComponents, (Int_t) b); i++) {
+            loader->AddVariable(TString::Format("pc%d", i));
+        }
+    } else if (options.variables.size() > 0) {
+        for (Int_t i : options.variables) {
+            loader->AddVariable(TString::Format("var%d", i));
+        }
+        Info("createDataLoader", "Using %d of %d waveform bins", (Int_t) options.variables.size(), (Int_t) b);
+    } else {
+        for (int i = 0; i < b; i++) {
+            TString expression = "var";
+            expression += i;
+            loader->AddVariable(expression);
+        }
     }
 
-    // TODO: try old method with vars[0] ?
+    return loader;
+}
 
-    // Set individual event weights (the variables must exist in the original TTree)
-    //    for signal    : factory->SetSignalWeightExpression    ("weight1*weight2");
-    //    for background: factory->SetBackgroundWeightExpression("weight1*weight2");
-    // loader->SetBackgroundWeightExpression( "weight" );
+// Function returns title of the booked method
 
-    // Apply additional cuts on the signal and background samples (can be different)
-    TCut mycuts = "";    // for example: TCut mycuts = "abs(var1)<0.5 && abs(var2-0.5)<1";
-    TCut mycutb = "";    // for example: TCut mycutb = "abs(var1)<0.5";
+TString getMethodTitle(TrainMethod method) {
+    switch (method) {
+        case TrainMethod::BDT:
+            return "BDT";
+        case TrainMethod::DNN:
+            return "DNN";
+        case TrainMethod::CNN:
+            return "CNN";
+    }
+    return "";
+}
 
-    // Tell the factory how to use the training and testing events
-    //
-    // If no numbers of events are given, half of the events in the tree are used
-    // for training, and the other half for testing:
-    //    loader->PrepareTrainingAndTestTree( mycut, "SplitMode=random:!V" );
-    // It is possible also to specify the number of training and testing events,
-    // note we disable the computation of the correlation matrix of the input variables
+// Function returns the deep learning layout with one output unit per class for the multiclass training
+
+TString getOutputLayout(const TrainOptions &options, const TString &layout) {
+    Ssiz_t outputStart = layout.Last(',') + 1;
+    TString outputLayer = layout(outputStart, layout.Length() - outputStart);
+    if (!options.multiclass || !outputLayer.BeginsWith("DENSE|1|")) {
+        return layout;
+    }
+    outputLayer.Replace(0, 8, TString::Format("DENSE|%zu|", getClassNames(options).size()));
+    return TString(layout(0, outputStart)) + outputLayer;
+}
+
+// Function builds the deep learning method option string for given layout
 
-    int nTrainSig = 0.8 * nEventsSig;
-    int nTrainBkg = 0.8 * nEventsBkg;
+TString getDLOptions(const TrainOptions &options, const TString &layout) {
+    TString layoutString("Layout=");
+    layoutString += getOutputLayout(options, layout);
 
-    // build the string options for DataLoader::PrepareTrainingAndTestTree
-    TString prepareOptions = TString::Format("nTrain_Signal=%d:nTrain_Background=%d:SplitMode=Random:SplitSeed=100:NormMode=NumEvents:!V:!CalcCorrelations",
-            nTrainSig, nTrainBkg);
+    // Training strategies
+    TString trainingStrategyString("TrainingStrategy=");
+    trainingStrategyString += options.dnnTraining;
 
-    loader->PrepareTrainingAndTestTree(mycuts, mycutb, prepareOptions);
+    // Build now the full DL Option string
+
+    // Softmax over the classes for the multiclass training
+    TString dnnOptions("!H:V:VarTransform=None:WeightInitialization=XAVIER");
+    dnnOptions += options.multiclass ? ":ErrorStrategy=MUTUALEXCLUSIVE" : ":ErrorStrategy=CROSSENTROPY";
+    dnnOptions.Append(":");
+    dnnOptions.Append(layoutString);
+    dnnOptions.Append(":");
+    dnnOptions.Append(trainingStrategyString);
+
+    // use GPU if available
+#ifdef R__HAS_TMVAGPU
+    dnnOptions += ":Architecture=GPU";
+#elif defined(R__HAS_TMVACPU)
+    dnnOptions += ":Architecture=CPU";
+#endif
+    return dnnOptions;
+}
+
+void trainTMVA_CNN(const char *trainingFileURI, const TrainOptions &options) {
+    // Petr Stepanov: refer to: https://root.cern/doc/master/TMVA__CNN__Classification_8C.html
+    std::set<TrainMethod> tmvaMethodOnly = options.methods;
+
+    TMVA::Tools::Instance();
+    // Enable MT running
+    SystemUtils::configureThreads(options.nThreads, options.nOmpThreads);
+
+    // Open output file
+    TFile *outputFile = nullptr;
+    outputFile = TFile::Open(options.outputFileName, "RECREATE");
+
+    /***
+     ## Create TMVA Factory
+
+     Create the Factory class. Later you can choose the methods
+     whose performance you'd like to investigate.
+
+     The factory is the major TMVA object you have to interact with. Here is the list of parameters you need to pass
+
+     - The first argument is the base of the name of all the output
+     weightfiles in the directory weight/ that will be created with the
+     method parameters
+
+     - The second argument is the output file for the training results
+
+     - The third argument is a string option defining some general configuration for the TMVA session.
+     For example all TMVA output can be suppressed by removing the "!" (not) in front of the "Silent" argument in the
+     option string
+
+     - note that we disable any pre-transformation of the input variables and we avoid computing correlations between
+     input variables
+     ***/
+
+    TString analysisType = options.multiclass ? "Multiclass" : "Classification";
+    TMVA::Factory factory("TMVA_CNN_Classification", outputFile,
+            "!V:ROC:!Silent:Color:AnalysisType=" + analysisType + ":Transformations=None:!Correlations");
+
+    // Prepared (split) dataset is cached between the runs with the same input file, variables and split.
+    // Cached datasets hold signal and background classes only
+    TString cacheFilePath;
+    if (options.cacheDir.Length() > 0 && options.multiclass) {
+        Info("trainTMVA_CNN", "Dataset cache is not used for the multiclass training");
+    } else if (options.cacheDir.Length() > 0) {
+        TString description = TString::Format("Components=%d:TrainFraction=0.8:SplitMode=Random:SplitSeed=100", options.nComponents);
+        if (options.nComponents > 0) {
+            // Components are fitted on the training sample (datasets cached before hold a projection fitted on all events)
+            description += ":ProjectionFit=Training";
+        }
+        if (options.variables.size() > 0) {
+            description += ":Variables=";
+            for (Int_t i : options.variables) {
+                description += TString::Format("%d,", i);
+            }
+        }
+        TString key = TmvaUtils::getDatasetKey(trainingFileURI, description);
+        if (key.Length() > 0) {
+            gSystem->mkdir(options.cacheDir.Data(), kTRUE);
+            cacheFilePath = gSystem->ConcatFileName(options.cacheDir.Data(), key.Data());
+        }
+    }
+
+    TMVA::DataLoader *loader = nullptr;
+    TmvaUtils::Dataset dataset;
+    if (cacheFilePath.Length() > 0 && TmvaUtils::readDataset(cacheFilePath + ".dat", dataset)) {
+        Info("trainTMVA_CNN", "Prepared dataset loaded from cache \"%s.dat\"", cacheFilePath.Data());
+        loader = new TMVA::DataLoader("dataset");
+        TmvaUtils::fillDataLoader(dataset, loader);
+        if (options.writePreprocessing) {
+            TString weightDirPath = TString(loader->GetName()) + "/" + TMVA::gConfig().GetIONames().fWeightFileDir;
+            gSystem->mkdir(weightDirPath.Data(), kTRUE);
+            gSystem->CopyFile(cacheFilePath + ".root", gSystem->ConcatFileName(weightDirPath.Data(), PREPROCESSING_FILE_NAME), kTRUE);
+        }
+        loader->PrepareTrainingAndTestTree("", "", "SplitMode=Block:NormMode=NumEvents:!V:!CalcCorrelations");
+    } else {
+        Int_t nEventsSig, nEventsBkg, nEventsBaseline = 0;
+        loader = createDataLoader("dataset", trainingFileURI, options, nEventsSig, nEventsBkg, &nEventsBaseline, 0.8);
+
+        // TODO: try old method with vars[0] ?
+
+        // Set individual event weights (the variables must exist in the original TTree)
+        //    for signal    : factory->SetSignalWeightExpression    ("weight1*weight2");
+        //    for background: factory->SetBackgroundWeightExpression("weight1*weight2");
+        // loader->SetBackgroundWeightExpression( "weight" );
+
+        // Apply additional cuts on the signal and background samples (can be different)
+        TCut mycuts = "";    // for example: TCut mycuts = "abs(var1)<0.5 && abs(var2-0.5)<1";
+        TCut mycutb = "";    // for example: TCut mycutb = "abs(var1)<0.5";
+
+        // Tell the factory how to use the training and testing events
+        //
+        // If no numbers of events are given, half of the events in the tree are used
+        // for training, and the other half for testing:
+        //    loader->PrepareTrainingAndTestTree( mycut, "SplitMode=random:!V" );
+        // It is possible also to specify the number of training and testing events,
+        // note we disable the computation of the correlation matrix of the input variables
+
+        int nTrainSig = 0.8 * nEventsSig;
+        int nTrainBkg = 0.8 * nEventsBkg;
+
+        // build the string options for DataLoader::PrepareTrainingAndTestTree
+        TString prepareOptions = TString::Format("nTrain_Signal=%d:nTrain_Background=%d:SplitMode=Random:SplitSeed=100:NormMode=NumEvents:!V:!CalcCorrelations",
+                nTrainSig, nTrainBkg);
+        if (options.multiclass) {
+            prepareOptions += TString::Format(":nTrain_Baseline=%d", (int) (0.8 * nEventsBaseline));
+        }
+
+        loader->PrepareTrainingAndTestTree(mycuts, mycutb, prepareOptions);
+
+        // Save prepared dataset and preprocessing parameters to the cache
+        if (cacheFilePath.Length() > 0 && options.writePreprocessing) {
+            TString weightDirPath = TString(loader->GetName()) + "/" + TMVA::gConfig().GetIONames().fWeightFileDir;
+            gSystem->CopyFile(gSystem->ConcatFileName(weightDirPath.Data(), PREPROCESSING_FILE_NAME), cacheFilePath + ".root", kTRUE);
+            TmvaUtils::extractDataset(loader, dataset);
+            if (TmvaUtils::writeDataset(cacheFilePath + ".dat", dataset)) {
+                Info("trainTMVA_CNN", "Prepared dataset saved to cache \"%s.dat\"", cacheFilePath.Data());
+            }
+        }
+    }
 
     /***
 
@@ -523,11 +1051,16 @@ void trainTMVA_CNN(const char *trainingFileURI, std::set<TMVA::Types::EMVA> tmva
 
      **/
 
+    // Titles of the booked methods (for the ROC-AUC summary)
+    std::vector<TString> bookedMethods;
+
     // Boosted Decision Trees
-    if (tmvaMethodOnly.size() == 0 || tmvaMethodOnly.count(TMVA::Types::kBDT)) {
+    if (tmvaMethodOnly.size() == 0 || tmvaMethodOnly.count(TrainMethod::BDT)) {
         TString methodTitle = TMVA::Types::Instance().GetMethodName(TMVA::Types::kBDT);
-        factory.BookMethod(loader, TMVA::Types::kBDT, methodTitle, "!V:NTrees=400:MinNodeSize=2.5%:MaxDepth=2:BoostType=AdaBoost:AdaBoostBeta=0.5:"
-                "UseBaggedBoost:BaggedSampleFraction=0.5:SeparationType=GiniIndex:nCuts=20");
+        // AdaBoost is implemented for two classes only
+        TString bdtOptions = options.multiclass ? StringUtils::setOption(options.bdtOptions, "BoostType", "Grad") : options.bdtOptions;
+        factory.BookMethod(loader, TMVA::Types::kBDT, methodTitle, bdtOptions);
+        bookedMethods.push_back(methodTitle);
     }
     /**
 
@@ -542,45 +1075,18 @@ void trainTMVA_CNN(const char *trainingFileURI, std::set<TMVA::Types::EMVA> tmva
 #ifndef R__HAS_TMVACPU
 #ifndef R__HAS_TMVAGPU
     Warning("trainTMVA_CNN", "TMVA is not build with GPU or CPU multi-thread support. Cannot use TMVA Deep Learning for Convolutional Neural Network (CNN)");
-    tmvaMethodOnly.erase(TMVA::Types::kDNN);
+    tmvaMethodOnly.erase(TrainMethod::DNN);
+    tmvaMethodOnly.erase(TrainMethod::CNN);
 #endif
 #endif
 
-    if (tmvaMethodOnly.size() == 0 || tmvaMethodOnly.count(TMVA::Types::kDNN)) {
-
-        TString layoutString("Layout=DENSE|100|RELU,BNORM,DENSE|100|RELU,BNORM,DENSE|100|RELU,BNORM,DENSE|100|RELU,DENSE|1|LINEAR");
-
-        // Training strategies
-        // one can catenate several training strings with different parameters (e.g. learning rates or regularizations
-        // parameters) The training string must be concatenates with the `|` delimiter
-        TString trainingString1("LearningRate=1e-3,Momentum=0.9,Repetitions=1,"
-                "ConvergenceSteps=5,BatchSize=100,TestRepetitions=1,"
-                "MaxEpochs=20,WeightDecay=1e-4,Regularization=None,"
-                "Optimizer=ADAM,DropConfig=0.0+0.0+0.0+0.");
-
-        TString trainingStrategyString("TrainingStrategy=");
-        trainingStrategyString += trainingString1;        // + "|" + trainingString2 + ....
-
-        // Build now the full DNN Option string
-
-        TString dnnOptions("!H:V:ErrorStrategy=CROSSENTROPY:VarTransform=None:"
-                "WeightInitialization=XAVIER");
-        dnnOptions.Append(":");
-        dnnOptions.Append(layoutString);
-        dnnOptions.Append(":");
-        dnnOptions.Append(trainingStrategyString);
+    Int_t nVars = loader->GetDataSetInfo().GetNVariables();
+    if (tmvaMethodOnly.size() == 0 || tmvaMethodOnly.count(TrainMethod::DNN)) {
 
-        TString methodTitle = TMVA::Types::Instance().GetMethodName(TMVA::Types::kDNN);
-        // use GPU if available
-#ifdef R__HAS_TMVAGPU
-        dnnOptions += ":Architecture=GPU";
-        // dnnMethodName += "_GPU";
-#elif defined(R__HAS_TMVACPU)
-        dnnOptions += ":Architecture=CPU";
-        // dnnMethodName += "_CPU";
-#endif
-
-        factory.BookMethod(loader, TMVA::Types::kDL, methodTitle, dnnOptions);
+        TString methodTitle = getMethodTitle(TrainMethod::DNN);
+        factory.BookMethod(loader, TMVA::Types::kDL, methodTitle, getDLOptions(options, options.dnnLayout));
+        Info("trainTMVA_CNN", "%s has %lld trainable parameters", methodTitle.Data(), TmvaUtils::countLayoutParameters(getOutputLayout(options, options.dnnLayout), nVars));
+        bookedMethods.push_back(methodTitle);
     }
 
     /***
@@ -597,11 +1103,8 @@ void trainTMVA_CNN(const char *trainingFileURI, std::set<TMVA::Types::EMVA> tmva
      - CONV | number of units | filter height | filter width | stride height | stride width | padding height | paddig
      width | activation function
 
-     - note in this case we are using a filer 3x3 and padding=1 and stride=1 so we get the output dimension of the
-     conv layer equal to the input
-
-     - note we use after the first convolutional layer a batch normalization layer. This seems to help significatly the
-     convergence
+     - note in this case the waveform is an image of 1 x nVars pixels, so filters are 1 x width with padding only
+     along the time axis
 
      - For the MaxPool layer:
      - MAXPOOL  | pool height | pool width | stride height | stride width
@@ -609,10 +1112,19 @@ void trainTMVA_CNN(const char *trainingFileURI, std::set<TMVA::Types::EMVA> tmva
      The RESHAPE layer is needed to flatten the output before the Dense layer
 
 
-     Note that to run the CNN is required to have CPU  or GPU support
+     Note that to run the CNN is required to have CPU  or GPU support. CNN is booked only when requested (--cnn)
 
      ***/
 
+    if (tmvaMethodOnly.count(TrainMethod::CNN)) {
+        TString methodTitle = getMethodTitle(TrainMethod::CNN);
+        TString cnnOptions = getDLOptions(options, options.cnnLayout);
+        cnnOptions += TString::Format(":InputLayout=1|1|%d", nVars);
+        factory.BookMethod(loader, TMVA::Types::kDL, methodTitle, cnnOptions);
+        Info("trainTMVA_CNN", "%s has %lld trainable parameters", methodTitle.Data(), TmvaUtils::countLayoutParameters(getOutputLayout(options, options.cnnLayout), nVars));
+        bookedMethods.push_back(methodTitle);
+    }
+
     /*
      if (Use.count(TMVA::Types::kPyTorch)) {
 
@@ -634,12 +1146,40 @@ void trainTMVA_CNN(const char *trainingFileURI, std::set<TMVA::Types::EMVA> tmva
      */
 
     // Train Methods
+    TStopwatch trainTimer;
     factory.TrainAllMethods();
+    trainTimer.Stop();
+    Info("trainTMVA_CNN", "Training time: %.2f s (real), %.2f s (CPU)", trainTimer.RealTime(), trainTimer.CpuTime());
 
     // Test and Evaluate Methods
     factory.TestAllMethods();
     factory.EvaluateAllMethods();
 
+    // Summary of the classification performance and cost
+    std::ofstream summaryFile;
+    if (options.summaryFileName.Length() > 0) {
+        summaryFile.open(options.summaryFileName.Data());
+    }
+    for (const TString &methodTitle : bookedMethods) {
+        Double_t rocAuc = factory.GetROCIntegral(loader, methodTitle);
+        Info("trainTMVA_CNN", "ROC-AUC for %s: %.4f", methodTitle.Data(), rocAuc);
+
+        // Multiclass: first class (signal) versus the rest above, the other classes versus the rest
+        for (UInt_t iClass = 1; options.multiclass && iClass < loader->GetDataSetInfo().GetNClasses(); iClass++) {
+            Info("trainTMVA_CNN", "ROC-AUC for %s (%s vs rest): %.4f", methodTitle.Data(), loader->GetDataSetInfo().GetClassInfo(iClass)->GetName(),
+                    factory.GetROCIntegral(loader, methodTitle, iClass));
+        }
+
+        TMVA::MethodBase *method = dynamic_cast<TMVA::MethodBase*>(factory.GetMethod(loader->GetName(), methodTitle));
+        if (!method) continue;
+        Long64_t nTestEvents = method->Data()->GetNTestEvents();
+        Double_t inferenceTime = nTestEvents > 0 ? method->GetTestTime()/nTestEvents*1E6 : 0;
+        Info("trainTMVA_CNN", "Cost of %s: training %.2f s, inference %.2f us per event", methodTitle.Data(), method->GetTrainTime(), inferenceTime);
+        if (summaryFile.is_open()) {
+            summaryFile << methodTitle << "\t" << rocAuc << "\t" << method->GetTrainTime() << "\t" << inferenceTime << std::endl;
+        }
+    }
+
     // Plot ROC Curve
     if (!gROOT->IsBatch()) {
         TCanvas *canvas = factory.GetROCCurve(loader);
@@ -651,168 +1191,1353 @@ void trainTMVA_CNN(const char *trainingFileURI, std::set<TMVA::Types::EMVA> tmva
 
     // Launch the GUI for the root macros
     if (!gROOT->IsBatch()) {
-        TMVA::TMVAGui("TMVA_ClassificationOutput.root");
+        TMVA::TMVAGui(options.outputFileName);
     }
 
     Info("trainTMVA_CNN", "Training completed");
 }
 
-std::map<std::string, float> classifyWaveform_Linear(const char *weightDirPath, const char *testDirPath) {
-    // Read "good" waveforms to be tested
-    TList *goodTestHists = getGoodHistogramsList(testDirPath);
-    TList *goodTestHistsPrepared = HistUtils::prepHistsForTMVA(goodTestHists);  // TODO: Crop and invert histograms (required for the hist->GetRandom() to work)
-    if (goodTestHistsPrepared->GetSize() < 1) {
+// Function trains every booked method in a separate worker process (own TMVA factory and thread budget), all methods
+// in parallel or one after another, and merges the outputs into a single training output file. Weight files of all
+// workers share one folder. Output of a method is written under a temporary name and renamed when the method is
+// trained and evaluated, so a finished method can be skipped when an interrupted run is started again. An interrupted
+// method is trained again from the first epoch
 
-        std::map<std::string, float> map { };
-        return map;
+// Function returns the key of the method training: MD5 of the input file combined with the method, dataset and method
+// options. A method output kept by an interrupted run is reused by --skip-finished only if its key matches
+
+TString getTrainingKey(const char *trainingFileURI, const TrainOptions &options, TrainMethod method) {
+    TString description = TString::Format("Method=%s:Components=%d:Multiclass=%d:Variables=", getMethodTitle(method).Data(),
+            options.nComponents, (Int_t) options.multiclass);
+    for (Int_t i : options.variables) {
+        description += TString::Format("%d,", i);
     }
-    // Remember number of bins in first good histogram
-    Int_t nBins = ((TH1*) (goodTestHistsPrepared->At(0)))->GetNbinsX();
+    if (method == TrainMethod::BDT) {
+        description += ":" + options.bdtOptions;
+    } else {
+        description += ":" + (method == TrainMethod::CNN ? options.cnnLayout : options.dnnLayout) + ":" + options.dnnTraining;
+    }
+    return TmvaUtils::getDatasetKey(trainingFileURI, description);
+}
 
-    // Create a set of variables and declare them to the reader
-    // - the variable names MUST corresponds in name and type to those given in the weight file(s) used
-    std::vector<float> fValues(nBins);
-    // std::vector<float> *fValuesPtr = new std::vector<float>(nBins);
+void trainTMVA_Methods(const char *trainingFileURI, const TrainOptions &options) {
+    // All implemented methods unless specified
+    std::vector<TrainMethod> methods;
+    for (TrainMethod method : { TrainMethod::BDT, TrainMethod::DNN, TrainMethod::CNN }) {
+        if ((options.methods.size() == 0 && method != TrainMethod::CNN) || options.methods.count(method)) {
+            methods.push_back(method);
+        }
+    }
 
-    // Instantiate the reader
-    // Taken from: https://root.cern/doc/master/TMVAClassificationApplication_8C.html
-    TMVA::Reader *reader = new TMVA::Reader("!Color:!Silent");
+    // Thread budget: BDT training is essentially sequential and gets one core, the rest is shared by other methods
+    Int_t nParallel = options.parallelMethods ? methods.size() : 1;
+    Int_t nCores = options.nThreads > 0 ? options.nThreads : SystemUtils::getAvailableCores();
+    Bool_t hasBDT = std::find(methods.begin(), methods.end(), TrainMethod::BDT) != methods.end();
+    Int_t nOthers = methods.size() - (hasBDT ? 1 : 0);
+    Int_t bdtCores = nOthers > 0 ? 1 : nCores;
+    Int_t otherCores = nOthers > 0 ? std::max(1, (nCores - (hasBDT ? 1 : 0)) / nOthers) : 0;
+
+    // Key of every method training is saved next to its finished output
+    std::vector<TString> outputFiles;
+    std::vector<TString> keys;
+    std::vector<TString> names;
+    std::vector<Int_t> pending;
+    for (Int_t i = 0; i < (Int_t) methods.size(); i++) {
+        TString methodTitle = getMethodTitle(methods[i]);
+        outputFiles.push_back(TString::Format("TMVA_CNN_ClassificationOutput_%s.root", methodTitle.Data()));
+        keys.push_back(getTrainingKey(trainingFileURI, options, methods[i]));
+        if (options.skipFinished && !gSystem->AccessPathName(outputFiles[i].Data())) {
+            std::ifstream keyFile((outputFiles[i] + ".key").Data());
+            std::string key;
+            if (keyFile >> key && keys[i].Length() > 0 && key == keys[i].Data()) {
+                Info("trainTMVA_Methods", "%s is already trained (\"%s\"), skipping", methodTitle.Data(), outputFiles[i].Data());
+                continue;
+            }
+            Info("trainTMVA_Methods", "%s was trained with a different input or options (\"%s\"), training again", methodTitle.Data(),
+                    outputFiles[i].Data());
+        }
+        names.push_back(TString::Format("train-%s", methodTitle.Data()));
+        pending.push_back(i);
+    }
 
-    // Hint. We represent each spectrum bin for the reader as separate variable vars[0], vars[1],...
-    // Check the input "...weight.xml" files. Variables there are named like above
-    // for (std::size_t i = 0; i < nBins; i++) {
-    // Petr Stepanov: this taken from RReader.hxx, ROOT sources
-    // TString varExpression = TString::Format("vars[%d]", i);
-    // reader->AddVariable(varExpression, &fValues[i]);
+    // Workers share the dataset loaded before forking
+    TFile *inputFile = FileUtils::loadFileToMemory(trainingFileURI);
+    if (!inputFile) {
+        exit(1);
+    }
+
+    TStopwatch timer;
+    Int_t nFailed = SystemUtils::runInWorkers(names, nParallel, [&](Int_t p) {
+        Int_t i = pending[p];
+        TrainOptions workerOptions = options;
+        workerOptions.inputFile = inputFile;
+        workerOptions.methods = { methods[i] };
+        if (nParallel > 1) {
+            workerOptions.nThreads = methods[i] == TrainMethod::BDT ? bdtCores : otherCores;
+            workerOptions.nOmpThreads = 0;
+        }
+        workerOptions.outputFileName = outputFiles[i] + ".part";
+        workerOptions.writePreprocessing = (p == 0);
+        gROOT->SetBatch(kTRUE);
+        trainTMVA_CNN(trainingFileURI, workerOptions);
+        gSystem->Rename(workerOptions.outputFileName.Data(), outputFiles[i].Data());
+        std::ofstream keyFile((outputFiles[i] + ".key").Data());
+        keyFile << keys[i] << std::endl;
+    });
+    timer.Stop();
+    if (nFailed > 0) {
+        Error("trainTMVA_Methods", "%d training workers failed, finished methods are kept. Run again with --skip-finished to train the rest", nFailed);
+        exit(1);
+    }
+    Info("trainTMVA_Methods", "Training time: %.2f s (real, all workers)", timer.RealTime());
 
-    // Not working...
+    TmvaUtils::mergeTrainingOutputs(outputFiles, options.outputFileName);
+    for (const TString &outputFile : outputFiles) {
+        gSystem->Unlink(outputFile.Data());
+        gSystem->Unlink((outputFile + ".key").Data());
+    }
 
-    //}
-    // Petr Stepanov: &fValues is of wrong type. We need to pass float* which is &fvalues[0]
-    //                issue with the AddVariablesArray() method: https://github.com/root-project/root/pull/10780
-    // reader->DataInfo().AddVariablesArray("vars", nBins, "", "", 0, 0, 'F', kFALSE, &fValues[0]); // TODO: one of parameters is normalized. Use it?
-    for (int i = 0; i < nBins; i++) {
-        TString expression = "var";
-        expression += i;
-        reader->AddVariable(expression, &fValues[i]);
+    // Launch the GUI for the root macros
+    if (!gROOT->IsBatch()) {
+        TMVA::TMVAGui(options.outputFileName);
+    }
+}
+
+// Function estimates the spread of the classification performance with k-fold cross-validation. Folds are trained in
+// parallel worker processes (nFoldWorkers, 0 - one per fold within the core budget) or sequentially with all threads.
+// Weight files of every fold and the ensemble weight file averaging the folds are written to "crossval/weights"
+
+void crossValidateTMVA(const char *trainingFileURI, const TrainOptions &options, Int_t nFolds, Int_t nFoldWorkers) {
+    if (options.multiclass) {
+        Error("crossValidateTMVA", "Cross-validation is implemented for the signal/background classification only");
+        exit(1);
+    }
+    TMVA::Tools::Instance();
+
+    // Fold workers are forked, so ROOT thread pool must not be started in this process. Cores are shared
+    // between the workers through OpenMP/BLAS threads
+    Int_t nCores = options.nThreads > 0 ? options.nThreads : SystemUtils::getAvailableCores();
+    if (nFoldWorkers <= 0) {
+        nFoldWorkers = std::min(nFolds, nCores);
+    }
+    if (nFoldWorkers > 1) {
+        SystemUtils::configureThreads(-1, std::max(1, nCores / nFoldWorkers));
+    } else {
+        SystemUtils::configureThreads(options.nThreads, options.nOmpThreads);
+    }
+
+    TFile *outputFile = TFile::Open("TMVA_CNN_CrossValidationOutput.root", "RECREATE");
+    Int_t nEventsSig, nEventsBkg;
+    TMVA::DataLoader *loader = createDataLoader("crossval", trainingFileURI, options, nEventsSig, nEventsBkg);
+
+    // All events take part in the training, CrossValidation splits them into folds
+    loader->PrepareTrainingAndTestTree("", "", "nTest_Signal=1:nTest_Background=1:SplitMode=Random:SplitSeed=100:NormMode=NumEvents:!V:!CalcCorrelations");
+
+    TString cvOptions = TString::Format("!V:!Silent:ModelPersistence:AnalysisType=Classification:Transformations=None:!Correlations:"
+            "NumFolds=%d:SplitType=Random:OutputEnsembling=Avg:FoldFileOutput:NumWorkerProcs=%d", nFolds, nFoldWorkers);
+    TMVA::CrossValidation cv("TMVA_CNN_CrossValidation", loader, outputFile, cvOptions);
+
+    // Results are returned in the booking order
+    std::vector<TString> bookedMethods;
+    if (options.methods.size() == 0 || options.methods.count(TrainMethod::BDT)) {
+        TString methodTitle = getMethodTitle(TrainMethod::BDT);
+        cv.BookMethod(TMVA::Types::kBDT, methodTitle, options.bdtOptions);
+        bookedMethods.push_back(methodTitle);
+    }
+#if defined(R__HAS_TMVACPU) || defined(R__HAS_TMVAGPU)
+    if (options.methods.size() == 0 || options.methods.count(TrainMethod::DNN)) {
+        TString methodTitle = getMethodTitle(TrainMethod::DNN);
+        cv.BookMethod(TMVA::Types::kDL, methodTitle, getDLOptions(options, options.dnnLayout));
+        bookedMethods.push_back(methodTitle);
+    }
+    if (options.methods.count(TrainMethod::CNN)) {
+        TString methodTitle = getMethodTitle(TrainMethod::CNN);
+        cv.BookMethod(TMVA::Types::kDL, methodTitle,
+                getDLOptions(options, options.cnnLayout) + TString::Format(":InputLayout=1|1|%d", loader->GetDataSetInfo().GetNVariables()));
+        bookedMethods.push_back(methodTitle);
+    }
+#endif
+
+    Info("crossValidateTMVA", "%d-fold cross-validation, %d fold(s) in parallel", nFolds, nFoldWorkers);
+    TStopwatch trainTimer;
+    cv.Evaluate();
+    trainTimer.Stop();
+    Info("crossValidateTMVA", "Training time: %.2f s (real, all folds)", trainTimer.RealTime());
+
+    // Summary of the classification performance over the folds
+    const std::vector<TMVA::CrossValidationResult> &results = cv.GetResults();
+    for (size_t m = 0; m < results.size() && m < bookedMethods.size(); m++) {
+        for (const auto &fold : results[m].GetROCValues()) {
+            Info("crossValidateTMVA", "ROC-AUC for %s fold %u: %.4f", bookedMethods[m].Data(), fold.first, fold.second);
+        }
+        Info("crossValidateTMVA", "ROC-AUC for %s: %.4f +- %.4f (mean and standard deviation over %d folds)", bookedMethods[m].Data(),
+                results[m].GetROCAverage(), results[m].GetROCStandardDeviation(), nFolds);
+    }
+
+    outputFile->Close();
+    Info("crossValidateTMVA", "Weight files of the folds and the fold ensemble saved to \"%s/%s\"", loader->GetName(),
+            TMVA::gConfig().GetIONames().fWeightFileDir.Data());
+}
+
+// Line of the training summary written by trainTMVA_CNN() (see TrainOptions::summaryFileName)
+struct MethodSummary {
+    std::string method;
+    Double_t rocAuc;
+    Double_t trainTime;        // s
+    Double_t inferenceTime;    // us per event
+};
+
+std::vector<MethodSummary> readTrainingSummary(const char *summaryFilePath) {
+    std::vector<MethodSummary> summaries;
+    std::ifstream summaryFile(summaryFilePath);
+    MethodSummary summary;
+    while (summaryFile >> summary.method >> summary.rocAuc >> summary.trainTime >> summary.inferenceTime) {
+        summaries.push_back(summary);
+    }
+    return summaries;
+}
+
+// Hyperparameter sweep. Spec file lists one parameter per line followed by its candidate values, e.g.
+//   BDT:NTrees        200 400 800
+//   BDT:MaxDepth      2 3
+//   DNN:Layout        DENSE|64|RELU,DENSE|1|LINEAR DENSE|128|RELU,DENSE|128|RELU,DENSE|1|LINEAR
+//   DNN:LearningRate  1e-3 1e-4
+// "BDT:<key>" overrides BDT option, "DNN:Layout" and "CNN:Layout" the network layers, other "DNN:<key>" (or "CNN:<key>")
+// the training strategy shared by both networks.
+
+struct SweepParameter {
+    TString name;
+    std::vector<TString> values;
+};
+
+std::vector<SweepParameter> readSweepSpec(const char *specFilePath) {
+    std::ifstream specFile(specFilePath);
+    if (!specFile) {
+        Error("readSweepSpec", "Cannot open sweep specification \"%s\"", specFilePath);
+        exit(1);
+    }
+    std::vector<SweepParameter> parameters;
+    std::string line;
+    while (std::getline(specFile, line)) {
+        TString l = TString(line).Strip(TString::kBoth);
+        if (l.Length() == 0 || l.BeginsWith("#")) continue;
+        TObjArray *tokens = l.Tokenize(" \t");
+        SweepParameter parameter;
+        parameter.name = ((TObjString*) tokens->At(0))->GetString();
+        for (Int_t i = 1; i < tokens->GetEntriesFast(); i++) {
+            parameter.values.push_back(((TObjString*) tokens->At(i))->GetString());
+        }
+        delete tokens;
+        if (!(parameter.name.BeginsWith("BDT:") || parameter.name.BeginsWith("DNN:") || parameter.name.BeginsWith("CNN:")) || parameter.values.empty()) {
+            Error("readSweepSpec", "Wrong sweep parameter \"%s\"", l.Data());
+            exit(1);
+        }
+        parameters.push_back(parameter);
+    }
+    return parameters;
+}
+
+void applySweepParameter(TrainOptions &options, const TString &name, const TString &value) {
+    TString key = name(4, name.Length() - 4);
+    if (name.BeginsWith("BDT:")) {
+        options.bdtOptions = StringUtils::setOption(options.bdtOptions, key, value, ':');
+    } else if (key == "Layout") {
+        (name.BeginsWith("CNN:") ? options.cnnLayout : options.dnnLayout) = value;
+    } else {
+        options.dnnTraining = StringUtils::setOption(options.dnnTraining, key, value, ',');
+    }
+}
+
+// Function trains every combination of the sweep parameters (grid) or nRandom combinations picked at random.
+// Trials run in forked worker processes with trialThreads cores each, within the budget of options.nThreads cores.
+// Each trial writes its output and weights to "sweep/trial-NNN"; results are collected in "sweep/results.tsv"
+
+void sweepTMVA(const char *trainingFileURI, const TrainOptions &options, const char *specFilePath, Int_t nRandom, Int_t trialThreads) {
+    std::vector<SweepParameter> parameters = readSweepSpec(specFilePath);
+
+    // Trial index encodes the value of every parameter (mixed radix)
+    Long64_t nGrid = 1;
+    for (const SweepParameter &parameter : parameters) {
+        nGrid *= parameter.values.size();
+    }
+    std::vector<Long64_t> trials;
+    if (nRandom > 0 && nRandom < nGrid) {
+        TRandom3 random(0);
+        std::set<Long64_t> picked;
+        while ((Long64_t) picked.size() < nRandom) {
+            picked.insert((Long64_t) (random.Rndm()*nGrid) % nGrid);
+        }
+        trials.assign(picked.begin(), picked.end());
+    } else {
+        for (Long64_t i = 0; i < nGrid; i++) {
+            trials.push_back(i);
+        }
+    }
+    auto trialValues = [&](Long64_t index) {
+        std::vector<TString> values;
+        for (const SweepParameter &parameter : parameters) {
+            values.push_back(parameter.values[index % parameter.values.size()]);
+            index /= parameter.values.size();
+        }
+        return values;
+    };
+
+    // Core budget
+    Int_t nCores = options.nThreads > 0 ? options.nThreads : SystemUtils::getAvailableCores();
+    trialThreads = std::max(1, trialThreads);
+    Int_t nParallel = std::max(1, nCores/trialThreads);
+    Info("sweepTMVA", "Sweep of %d trials (grid of %lld), %d in parallel with %d threads each", (Int_t) trials.size(), nGrid, nParallel, trialThreads);
+
+    // Trials share the dataset loaded before forking. Trials run in their own folders, input path must be absolute
+    TString inputFilePath = FileUtils::getAbsolutePath(trainingFileURI);
+    TFile *inputFile = FileUtils::loadFileToMemory(inputFilePath.Data());
+    if (!inputFile) {
+        exit(1);
+    }
+
+    std::vector<TString> trialDirs;
+    std::vector<TString> names;
+    for (Int_t i = 0; i < (Int_t) trials.size(); i++) {
+        trialDirs.push_back(TString::Format("sweep/trial-%03d", i));
+        gSystem->mkdir(trialDirs.back().Data(), kTRUE);
+        names.push_back(trialDirs.back() + "/trial");
+    }
+
+    TStopwatch timer;
+    Int_t nFailed = SystemUtils::runInWorkers(names, nParallel, [&](Int_t i) {
+        TrainOptions trialOptions = options;
+        std::vector<TString> values = trialValues(trials[i]);
+        for (size_t p = 0; p < parameters.size(); p++) {
+            Info("sweepTMVA", "Trial %d: %s = %s", i, parameters[p].name.Data(), values[p].Data());
+            applySweepParameter(trialOptions, parameters[p].name, values[p]);
+        }
+        trialOptions.nThreads = trialThreads;
+        trialOptions.nOmpThreads = 0;
+        trialOptions.inputFile = inputFile;
+        trialOptions.summaryFileName = "summary.tsv";
+        gROOT->SetBatch(kTRUE);
+        gSystem->ChangeDirectory(trialDirs[i].Data());
+        trainTMVA_CNN(inputFilePath.Data(), trialOptions);
+    });
+    timer.Stop();
+    if (nFailed > 0) {
+        Warning("sweepTMVA", "%d of %d trials failed", nFailed, (Int_t) trials.size());
+    }
+    Info("sweepTMVA", "Sweep time: %.2f s (real, all trials)", timer.RealTime());
+
+    // Collect trial summaries into the results table
+    std::ofstream resultsFile("sweep/results.tsv");
+    resultsFile << "trial\tmethod\troc_auc\ttrain_s\tinference_us";
+    for (const SweepParameter &parameter : parameters) {
+        resultsFile << "\t" << parameter.name;
     }
+    resultsFile << std::endl;
+
+    std::map<std::string, std::pair<Double_t, Int_t>> best;
+    for (Int_t i = 0; i < (Int_t) trials.size(); i++) {
+        std::vector<TString> values = trialValues(trials[i]);
+        for (const MethodSummary &summary : readTrainingSummary(gSystem->ConcatFileName(trialDirs[i].Data(), "summary.tsv"))) {
+            resultsFile << i << "\t" << summary.method << "\t" << summary.rocAuc << "\t" << summary.trainTime << "\t" << summary.inferenceTime;
+            for (const TString &value : values) {
+                resultsFile << "\t" << value;
+            }
+            resultsFile << std::endl;
+            if (!best.count(summary.method) || summary.rocAuc > best[summary.method].first) {
+                best[summary.method] = std::make_pair(summary.rocAuc, i);
+            }
+        }
+    }
+    resultsFile.close();
+    for (const auto &b : best) {
+        Info("sweepTMVA", "Best ROC-AUC for %s: %.4f (trial %d)", b.first.c_str(), b.second.first, b.second.second);
+    }
+    Info("sweepTMVA", "Sweep results saved to \"sweep/results.tsv\"");
+}
+
+// Function returns importance of every waveform bin: the BDT variable importance if weight file (trained on all bins)
+// is given, otherwise per-bin separation of the signal and background computed in parallel. Method booked from the
+// weight file has no node event counts (its GetVariableImportance() is NaN), so the importance is computed from the
+// node tables with the counts of the input events
+
+std::vector<Double_t> rankWaveformBins(const char *trainingFileURI, const char *bdtWeightFilePath) {
+    TFile *inputFile = TFile::Open(trainingFileURI);
+    if (!inputFile) {
+        Error("rankWaveformBins", "Input file %s not found", trainingFileURI);
+        exit(1);
+    }
+    Int_t nBins = (Int_t) (*inputFile->Get<TVectorD>("bins"))[0];
+
+    if (strlen(bdtWeightFilePath) > 0) {
+        ForestUtils::Forest forest;
+        if (!ForestUtils::readForest(bdtWeightFilePath, forest)) {
+            exit(1);
+        }
+        Bool_t allBins = forest.variables.size() == (size_t) nBins;
+        for (Int_t i = 0; allBins && i < nBins; i++) {
+            allBins = forest.variables[i] == TString::Format("var%d", i);
+        }
+        if (!allBins) {
+            Error("rankWaveformBins", "BDT \"%s\" is not trained on all %d waveform bins", bdtWeightFilePath, nBins);
+            exit(1);
+        }
+
+        std::vector<Float_t> inputs;
+        std::vector<Int_t> classes;
+        std::vector<Float_t> values(nBins);
+        for (Int_t c = 0; c < 2; c++) {
+            TTree *tree = inputFile->Get<TTree>(c == 0 ? "treeS" : "treeB");
+            for (Int_t i = 0; i < nBins; i++) {
+                tree->SetBranchAddress(TString::Format("var%d", i).Data(), &values[i]);
+            }
+            for (Long64_t entry = 0; entry < tree->GetEntries(); entry++) {
+                tree->GetEntry(entry);
+                inputs.insert(inputs.end(), values.begin(), values.end());
+                classes.push_back(c);
+            }
+            tree->ResetBranchAddresses();
+        }
+        inputFile->Close();
 
-    // Book the MVA methods
-    // TString dir = weightDirPath;
-    // TString prefix = "TMVA_CNN_Classification_";
+        std::vector<Double_t> importance;
+        if (!ForestUtils::getVariableImportance(forest, inputs.data(), classes.data(), classes.size(), importance)) {
+            Error("rankWaveformBins", "BDT \"%s\" does not separate the input events, bins cannot be ranked", bdtWeightFilePath);
+            exit(1);
+        }
+        Info("rankWaveformBins", "Waveform bins are ranked by the BDT variable importance");
+        return importance;
+    }
+    inputFile->Close();
+
+    std::vector<Double_t> meanS, varianceS, meanB, varianceB;
+    AnalysisUtils::computeTreeMeanVariance(trainingFileURI, "treeS", nBins, meanS, varianceS);
+    AnalysisUtils::computeTreeMeanVariance(trainingFileURI, "treeB", nBins, meanB, varianceB);
+    Info("rankWaveformBins", "Waveform bins are ranked by the signal/background separation");
+    return AnalysisUtils::getSeparation(meanS, varianceS, meanB, varianceB);
+}
+
+// Function ranks the waveform bins, trains methods on the top K bins for every K in the list and summarizes accuracy
+// and cost against K in "prune/results.tsv". Every K is trained in a worker process in its own "prune/k-NNNN" folder.
+// Preprocessing file in its weight folder holds the reduced variable list used by the classification stage
+
+void pruneTMVA(const char *trainingFileURI, const TrainOptions &options, const char *bdtWeightFilePath, const std::vector<Int_t> &kValues,
+        Int_t trialThreads) {
+    TString inputFilePath = FileUtils::getAbsolutePath(trainingFileURI);
+    gSystem->mkdir("prune", kTRUE);
+
+    // Trials share the dataset loaded before forking
+    TFile *inputFile = FileUtils::loadFileToMemory(inputFilePath.Data());
+    if (!inputFile) {
+        exit(1);
+    }
+    Int_t nBins = (Int_t) (*inputFile->Get<TVectorD>("bins"))[0];
+
+    // Ranking runs threads, so it is done in a worker process too (training workers are forked later)
+    TString rankingFilePath = "prune/ranking.tsv";
+    gSystem->Unlink(rankingFilePath.Data());
+    Int_t nFailed = SystemUtils::runInWorkers({ "prune/ranking" }, 1, [&](Int_t) {
+        SystemUtils::configureThreads(options.nThreads, options.nOmpThreads);
+        std::vector<Double_t> importance = rankWaveformBins(inputFilePath.Data(), bdtWeightFilePath);
+        std::ofstream rankingFile(rankingFilePath.Data());
+        rankingFile << std::setprecision(17);
+        for (size_t i = 0; i < importance.size(); i++) {
+            rankingFile << i << "\t" << importance[i] << std::endl;
+        }
+    });
+    if (nFailed > 0) {
+        Error("pruneTMVA", "Ranking of the waveform bins failed");
+        exit(1);
+    }
+
+    // Bins sorted by decreasing importance. Every bin must have a finite importance
+    std::vector<std::pair<Double_t, Int_t>> ranking;
+    std::ifstream rankingFile(rankingFilePath.Data());
+    std::string binString, importanceString;
+    while (rankingFile >> binString >> importanceString) {
+        Int_t bin = std::atoi(binString.c_str());
+        Double_t importance = std::strtod(importanceString.c_str(), nullptr);
+        if (!std::isfinite(importance) || bin < 0 || bin >= nBins) {
+            Error("pruneTMVA", "Invalid importance \"%s\" of bin %s in \"%s\"", importanceString.c_str(), binString.c_str(), rankingFilePath.Data());
+            exit(1);
+        }
+        ranking.push_back(std::make_pair(importance, bin));
+    }
+    if ((Int_t) ranking.size() != nBins) {
+        Error("pruneTMVA", "Ranking \"%s\" has %d entries, %d waveform bins expected", rankingFilePath.Data(), (Int_t) ranking.size(), nBins);
+        exit(1);
+    }
+    std::sort(ranking.begin(), ranking.end(), std::greater<std::pair<Double_t, Int_t>>());
+
+    // Core budget
+    Int_t nCores = options.nThreads > 0 ? options.nThreads : SystemUtils::getAvailableCores();
+    trialThreads = std::max(1, trialThreads);
+    Int_t nParallel = std::max(1, nCores/trialThreads);
+
+    std::vector<TString> trialDirs;
+    std::vector<TString> names;
+    for (Int_t k : kValues) {
+        trialDirs.push_back(TString::Format("prune/k-%04d", std::min(k, nBins)));
+        gSystem->mkdir(trialDirs.back().Data(), kTRUE);
+        names.push_back(trialDirs.back() + "/train");
+    }
+
+    nFailed = SystemUtils::runInWorkers(names, nParallel, [&](Int_t i) {
+        TrainOptions trialOptions = options;
+        trialOptions.nComponents = 0;
+        trialOptions.variables.clear();
+        for (Int_t j = 0; j < std::min(kValues[i], nBins); j++) {
+            trialOptions.variables.push_back(ranking[j].second);
+        }
+        std::sort(trialOptions.variables.begin(), trialOptions.variables.end());
+        trialOptions.nThreads = trialThreads;
+        trialOptions.nOmpThreads = 0;
+        trialOptions.inputFile = inputFile;
+        trialOptions.summaryFileName = "summary.tsv";
+        gROOT->SetBatch(kTRUE);
+        gSystem->ChangeDirectory(trialDirs[i].Data());
+        trainTMVA_CNN(inputFilePath.Data(), trialOptions);
+    });
+    if (nFailed > 0) {
+        Warning("pruneTMVA", "%d of %d trainings failed", nFailed, (Int_t) kValues.size());
+    }
+
+    // Accuracy and cost against the number of bins
+    std::ofstream resultsFile("prune/results.tsv");
+    resultsFile << "k\tmethod\troc_auc\ttrain_s\tinference_us" << std::endl;
+    for (Int_t i = 0; i < (Int_t) kValues.size(); i++) {
+        Int_t k = std::min(kValues[i], nBins);
+        for (const MethodSummary &summary : readTrainingSummary(gSystem->ConcatFileName(trialDirs[i].Data(), "summary.tsv"))) {
+            resultsFile << k << "\t" << summary.method << "\t" << summary.rocAuc << "\t" << summary.trainTime << "\t" << summary.inferenceTime << std::endl;
+            Info("pruneTMVA", "%d bins, %s: ROC-AUC %.4f, training %.2f s, inference %.2f us per event", k, summary.method.c_str(), summary.rocAuc,
+                    summary.trainTime, summary.inferenceTime);
+        }
+    }
+    Info("pruneTMVA", "Pruning results saved to \"prune/results.tsv\", weights with reduced variable lists in \"prune/k-NNNN/dataset/weights\"");
+}
+
+// Load preprocessing parameters (HistUtils), waveform projection, selected bins, class names and the number of bins with
+// the axis range of the prepared waveforms (empty if not saved) written next to the weight files during the training (if
+// any). Returns true if waveforms are projected
+Bool_t readPreprocessing(const char *weightDirPath, TMatrixF &projection, TVectorF &offset, std::vector<Int_t> &variables, std::vector<TString> &classes,
+        std::vector<Double_t> *bins = nullptr) {
+    Bool_t useProjection = kFALSE;
+    TString preprocessingFilePath = gSystem->ConcatFileName(weightDirPath, PREPROCESSING_FILE_NAME);
+    if (bins) {
+        bins->clear();
+    }
+    if (!gSystem->AccessPathName(preprocessingFilePath.Data())) {
+        TDirectory::TContext context;
+        TFile *preprocessingFile = TFile::Open(preprocessingFilePath.Data());
+        HistUtils::readParameters(preprocessingFile);
+        TVectorD *binsVector = preprocessingFile->Get<TVectorD>("bins");
+        if (bins && binsVector && binsVector->GetNrows() == 3) {
+            bins->assign(binsVector->GetMatrixArray(), binsVector->GetMatrixArray() + 3);
+        }
+        useProjection = ProjectionUtils::readProjection(preprocessingFile, projection, offset);
+        TmvaUtils::readVariables(preprocessingFile, variables);
+        TmvaUtils::readClasses(preprocessingFile, classes);
+        preprocessingFile->Close();
+    }
+    return useProjection;
+}
 
-    // Book method(s)
-    // Search
-    // std::map<std::string, int> Use {{"BDT", 1}, {"DNN_CPU", 1}};
-    // std::set<TMVA::Types::EMVA> foundMethods {};
+// Post-training int8 quantization of every dense DNN weight file in the folder. Input scales of the layers are
+// calibrated on the first nCalibration training events of each class, ROC-AUC of the int8 and float networks is compared
+// on the test events held out by the training. Both samples are read from the training output file (TrainTree and
+// TestTree of the "dataset" directory). Scales are written next to the weight file ("<method>.weights.int8.txt")
+void quantizeNetworks(const char *outputFileURI, const char *weightDirPath, Long64_t nCalibration) {
+    TFile *outputFile = TFile::Open(outputFileURI);
+    if (!outputFile || outputFile->IsZombie()) {
+        Error("quantizeNetworks", "Cannot open training output file \"%s\"", outputFileURI);
+        exit(1);
+    }
+    TDirectory *datasetDir = outputFile->GetDirectory("dataset");
 
-    // Loop through all weight files in given weight directory
     TList *fileNames = FileUtils::getFilePathsInDirectory(weightDirPath, ".xml");
-    std::list<TH1F*> histograms { };
+    Int_t nQuantized = 0;
     for (TObject *obj : *fileNames) {
-        TObjString *fileNameObjString = (TObjString*) obj;
-        if (fileNameObjString) {
-            TString filePath = fileNameObjString->GetString();
-            TString methodType = FileUtils::getFileNameNoExtensionFromPath(filePath);
+        TString filePath = ((TObjString*) obj)->GetString();
+        if (filePath.Contains(TRegexp("_fold[0-9]+\\.weights\\.xml$"))) {
+            continue;
+        }
+        InferenceUtils::Method method;
+        if (!InferenceUtils::loadMethod(filePath, FileUtils::getFileNameNoExtensionFromPath(filePath), method) || method.type != TMVA::Types::kDL) {
+            continue;
+        }
+        // Convolutional networks are skipped
+        NetworkUtils::Network network;
+        if (!NetworkUtils::readNetwork(filePath, network)) {
+            Warning("quantizeNetworks", "Method %s is not a dense network, skipped", method.name.Data());
+            continue;
+        }
+        Int_t nVars = network.variables.size();
+        TmvaUtils::DatasetSample trainingSamples[2], evaluationSamples[2];
+        if (!TmvaUtils::readOutputSamples(datasetDir, "TrainTree", network.variables, trainingSamples)
+                || !TmvaUtils::readOutputSamples(datasetDir, "TestTree", network.variables, evaluationSamples)) {
+            Error("quantizeNetworks", "Method %s was not trained on the dataset of \"%s\"", method.name.Data(), outputFileURI);
+            exit(1);
+        }
+        if (evaluationSamples[0].weights.empty() || evaluationSamples[1].weights.empty()) {
+            Error("quantizeNetworks", "Training output \"%s\" has no test events of both classes", outputFileURI);
+            exit(1);
+        }
 
-            // Book TMVA method in the reader
-            reader->BookMVA(methodType, filePath);
+        // Calibration sample holds both classes, evaluation samples are kept per class for the ROC-AUC
+        std::vector<Float_t> calibrationInputs;
+        for (Int_t c = 0; c < 2; c++) {
+            size_t nValues = std::min<size_t>(nCalibration * nVars, trainingSamples[c].values.size());
+            calibrationInputs.insert(calibrationInputs.end(), trainingSamples[c].values.begin(), trainingSamples[c].values.begin() + nValues);
+        }
 
-            // Prepare output histogram
-            TH1F *hist = new TH1F(methodType, methodType, 100, -1.0, 1.0);
-            histograms.push_back(hist);
+        std::vector<Float_t> inputScales = NetworkUtils::calibrateInputScales(network, calibrationInputs.data(), calibrationInputs.size() / nVars);
+        NetworkUtils::Network quantized = network;
+        NetworkUtils::quantize(quantized, inputScales);
+
+        // Score evaluation samples with the float (0) and int8 (1) network
+        Double_t rocAuc[2], time[2];
+        for (Int_t q = 0; q < 2; q++) {
+            std::vector<Double_t> scores[2];
+            TStopwatch timer;
+            for (Int_t c = 0; c < 2; c++) {
+                scores[c].resize(evaluationSamples[c].weights.size());
+                NetworkUtils::evaluate(q ? quantized : network, evaluationSamples[c].values.data(), scores[c].size(), scores[c].data());
+            }
+            timer.Stop();
+            rocAuc[q] = AnalysisUtils::getRocAuc(scores[0], scores[1]);
+            time[q] = timer.RealTime() / std::max<size_t>(1, scores[0].size() + scores[1].size()) * 1E6;
         }
+        Info("quantizeNetworks", "ROC-AUC for %s: float %.4f, int8 %.4f, change %+.4f", method.name.Data(), rocAuc[0], rocAuc[1], rocAuc[1] - rocAuc[0]);
+        Info("quantizeNetworks", "Inference time for %s: float %.2f us (%s kernel), int8 %.2f us (%s kernel) per waveform", method.name.Data(), time[0],
+                KernelUtils::getDenseKernel(), time[1], KernelUtils::getInt8Kernel());
+
+        TString scalesPath = filePath(0, filePath.Length() - 4) + ".int8.txt";
+        if (!NetworkUtils::writeInputScales(scalesPath, filePath, inputScales)) {
+            exit(1);
+        }
+        Info("quantizeNetworks", "Int8 input scales of %s written to \"%s\"", method.name.Data(), scalesPath.Data());
+        nQuantized++;
+    }
+    outputFile->Close();
+    if (nQuantized == 0) {
+        Warning("quantizeNetworks", "No dense DNN weight files found in \"%s\"", weightDirPath);
     }
+}
 
-//	for (std::set<std::string, Bool_t>::iterator it = Use.begin(); it != Use.end(); it++) {
-//		if (it->second) {
-//			TString methodName = TString(it->first) + TString(" method");
-//			TString weightfile = dir + prefix + TString(it->first) + TString(".weights.xml");
-//
-//		}
-//	}
+// Pack methods of the weight folder with their variable lists, native engine tables and the preprocessing (HistUtils
+// parameters, noise cuts, projection and selected bins) into one binary file for 'classify --bundle'
+void bundleModels(const char *weightDirPath, const char *bundleFilePath) {
+    // Preprocessing comes only from the training, never from the program defaults
+    TString preprocessingFilePath = gSystem->ConcatFileName(weightDirPath, PREPROCESSING_FILE_NAME);
+    if (gSystem->AccessPathName(preprocessingFilePath.Data())) {
+        Error("bundleModels", "Preprocessing file \"%s\" of the training is missing", preprocessingFilePath.Data());
+        exit(1);
+    }
+    BundleUtils::Bundle bundle;
+    readPreprocessing(weightDirPath, bundle.projection, bundle.offset, bundle.variables, bundle.classes, &bundle.bins);
+    bundle.preprocessing = BundleUtils::getPreprocessing();
+    if (bundle.bins.empty()) {
+        Warning("bundleModels", "Preprocessing file of an older training has no waveform axis, classification cannot check it");
+    }
 
-    // Book Output histograms
-    // https://root.cern/doc/master/TMVAClassificationApplication_8C.html
-//	for (TObject* obj : *fileNames){
-//		TObjString* fileNameObjString = (TObjString*) obj;
-//		if (fileNameObjString){
-//			TString filePath = fileNameObjString->GetString();
-//			TString methodType = FileUtils::getFileNameNoExtensionFromPath(filePath);
-//			reader->BookMVA(methodType, filePath);
-//		}
-//	}
-//
-//	TH1F *histBdtF(0);
-//	TH1F *histDnnCpu(0);
-//	histBdtF = new TH1F("MVA_BDT", "MVA_BDT", nbin, -1.0, 1.0 );
-//	histDnnCpu = new TH1F("MVA_DNN_CPU", "MVA_DNN_CPU", nbin, -0.1, 1.1);
+    TList *fileNames = FileUtils::getFilePathsInDirectory(weightDirPath, ".xml");
+    for (TObject *obj : *fileNames) {
+        TString filePath = ((TObjString*) obj)->GetString();
+        if (filePath.Contains(TRegexp("_fold[0-9]+\\.weights\\.xml$"))) {
+            continue;
+        }
+        BundleUtils::BundleMethod entry;
+        InferenceUtils::Method &method = entry.method;
+        if (!InferenceUtils::loadMethod(filePath, FileUtils::getFileNameNoExtensionFromPath(filePath), method)) {
+            exit(1);
+        }
+        if (method.type == TMVA::Types::kCrossValidation) {
+            Warning("bundleModels", "Cross-validation method %s reads the weight files of the folds, not bundled", method.name.Data());
+            continue;
+        }
+        if (!InferenceUtils::getVariables(method, entry.variables)) {
+            Error("bundleModels", "No input variables in \"%s\"", filePath.Data());
+            exit(1);
+        }
 
-    // Prepare input tree (this must be replaced by your data source)
-    // in this example, there is a toy tree with signal and one with background events
-    // we'll later on use only the "signal" events for the test in this example.
+        // Tables of the native engines. Other configurations are evaluated by the TMVA reader from the weight file
+        if (method.type == TMVA::Types::kBDT) {
+            std::shared_ptr<ForestUtils::Forest> forest = std::make_shared<ForestUtils::Forest>();
+            if (ForestUtils::readForest(filePath, *forest)) {
+                method.forest = forest;
+            }
+        } else if (method.type == TMVA::Types::kDL) {
+            std::shared_ptr<NetworkUtils::Network> network = std::make_shared<NetworkUtils::Network>();
+            if (NetworkUtils::readNetwork(filePath, *network)) {
+                method.network = network;
+                TString scalesPath = filePath(0, filePath.Length() - 4) + ".int8.txt";
+                if (!gSystem->AccessPathName(scalesPath) && !NetworkUtils::readInputScales(scalesPath, filePath, entry.inputScales)) {
+                    exit(1);
+                }
+            }
+        }
+        Info("bundleModels", "Method %s: %zu variables%s%s", method.name.Data(), entry.variables.size(),
+                method.forest ? ", forest tables" : (method.network ? ", network tables" : ""), entry.inputScales.empty() ? "" : ", int8 scales");
+        bundle.methods.push_back(entry);
+    }
+    if (bundle.methods.empty()) {
+        Error("bundleModels", "No weight files found in \"%s\"", weightDirPath);
+        exit(1);
+    }
+    if (!BundleUtils::writeBundle(bundleFilePath, bundle)) {
+        exit(1);
+    }
+    Info("bundleModels", "%zu methods written to \"%s\" (version %s)", bundle.methods.size(), bundleFilePath, bundle.hash.Data());
+}
 
-    // Prepare trees
-    TTree *treeTest;
-    // if (rootFileType == MLFileType::Linear){
-    treeTest = HistUtils::histsToTreeLin(goodTestHistsPrepared, "tree", "Tree for Classification");
-    Info("classifyWaveform_Linear", "Test Tree Created");
-    // }
+// Generate C++ source of every BDT weight file in the folder and compile it into the plugin library next to the
+// weight file ("<method>.weights.so"). Classification loads the plugin instead of parsing the weight file
+void compileForests(const char *weightDirPath) {
+    TList *fileNames = FileUtils::getFilePathsInDirectory(weightDirPath, ".xml");
+    Int_t nCompiled = 0;
+    for (TObject *obj : *fileNames) {
+        TString filePath = ((TObjString*) obj)->GetString();
+        if (filePath.Contains(TRegexp("_fold[0-9]+\\.weights\\.xml$"))) {
+            continue;
+        }
+        InferenceUtils::Method method;
+        if (!InferenceUtils::loadMethod(filePath, FileUtils::getFileNameNoExtensionFromPath(filePath), method) || method.type != TMVA::Types::kBDT) {
+            continue;
+        }
+        ForestUtils::Forest forest;
+        if (!ForestUtils::readForest(filePath, forest)) {
+            exit(1);
+        }
+        TString basePath = filePath(0, filePath.Length() - 4);
+        TString sourcePath = basePath + ".cpp";
+        TString libraryPath = basePath + ".so";
+        if (!ForestUtils::writeSource(forest, sourcePath, filePath) || !SystemUtils::compileLibrary(sourcePath, libraryPath)) {
+            exit(1);
+        }
+        Info("compileForests", "Compiled \"%s\" into \"%s\"", method.name.Data(), libraryPath.Data());
+        nCompiled++;
+    }
+    if (nCompiled == 0) {
+        Warning("compileForests", "No BDT weight files found in \"%s\"", weightDirPath);
+    }
+}
 
-    // Read test tree
-    // std::vector<float> fV(nBins);
-    // std::vector<float>* fVPtr = &fValues;
+// Export every dense DNN weight file in the folder through TMVA SOFIE into a generated inference header and compile
+// it with the batch wrapper into the plugin library next to the weight file ("<method>.weights.so")
+void compileNetworks(const char *weightDirPath, Int_t batchSize) {
+    TList *fileNames = FileUtils::getFilePathsInDirectory(weightDirPath, ".xml");
+    Int_t nCompiled = 0;
+    for (TObject *obj : *fileNames) {
+        TString filePath = ((TObjString*) obj)->GetString();
+        if (filePath.Contains(TRegexp("_fold[0-9]+\\.weights\\.xml$"))) {
+            continue;
+        }
+        InferenceUtils::Method method;
+        if (!InferenceUtils::loadMethod(filePath, FileUtils::getFileNameNoExtensionFromPath(filePath), method) || method.type != TMVA::Types::kDL) {
+            continue;
+        }
+        // Convolutional networks are skipped
+        NetworkUtils::Network network;
+        if (!NetworkUtils::readNetwork(filePath, network)) {
+            Warning("compileNetworks", "Method %s is not a dense network, skipped", method.name.Data());
+            continue;
+        }
 
-    // Petr Stepanov: address of the "vars" should be address of a pointer
-    // How to read write vector to Tree: https://gist.github.com/jiafulow/8877081e032158471578
-    // Petr Stepanov: current GitHub issue prevents passing a vector to the Reader
-    // std::vector<float> *fValuesPtr = &fValues;
-    // treeTest->SetBranchAddress("vars", &fValuesPtr);
+        // Model name is a part of the generated namespace
+        TString modelName = method.name;
+        modelName.ReplaceAll(".weights", "");
+        for (Ssiz_t i = 0; i < modelName.Length(); i++) {
+            if (!isalnum(modelName[i])) {
+                modelName[i] = '_';
+            }
+        }
+        TString basePath = filePath(0, filePath.Length() - 4);
+        TString headerPath = basePath + ".hxx";
+        TString sourcePath = basePath + ".cpp";
+        TString libraryPath = basePath + ".so";
+        if (!NetworkUtils::writeSofieHeader(network, modelName, batchSize, headerPath)
+                || !NetworkUtils::writePluginSource(network, modelName, batchSize, FileUtils::getFileNameFromPath(headerPath), sourcePath, filePath)) {
+            exit(1);
+        }
+        // Generated code needs SOFIE_common.hxx from the ROOT headers and a BLAS library ($BLAS_LIBS, default is the
+        // library found by CMake or -lblas)
+        const char *blasLibraries = gSystem->Getenv("BLAS_LIBS");
+        TString flags = TString::Format("-O2 -std=c++17 -I\"%s\"", TROOT::GetIncludeDir().Data());
+        if (!SystemUtils::compileLibrary(sourcePath, libraryPath, flags, blasLibraries ? blasLibraries : SOFIE_BLAS_LIBS)) {
+            exit(1);
+        }
+        Info("compileNetworks", "Compiled \"%s\" into \"%s\" (batch size %d)", method.name.Data(), libraryPath.Data(), batchSize);
+        nCompiled++;
+    }
+    if (nCompiled == 0) {
+        Warning("compileNetworks", "No dense DNN weight files found in \"%s\"", weightDirPath);
+    }
+}
 
-    for (int i = 0; i < nBins; i++) {
-        TString expr = "var";
-        expr += i;
-        treeTest->SetBranchAddress(expr.Data(), &fValues[i]);
+// Compiled plugin (BDT or SOFIE DNN) is used only if it was built after the last training of the method
+Bool_t isPluginUpToDate(const char *libraryFilePath, const char *weightFilePath) {
+    FileStat_t libraryStat, weightStat;
+    if (gSystem->GetPathInfo(libraryFilePath, libraryStat) != 0 || gSystem->GetPathInfo(weightFilePath, weightStat) != 0) {
+        return kFALSE;
+    }
+    if (libraryStat.fMtime < weightStat.fMtime) {
+        Warning("isPluginUpToDate", "Plugin \"%s\" is older than the weight file, run 'compile-bdt' (BDT) or 'compile-dnn' (DNN) again",
+                libraryFilePath);
+        return kFALSE;
+    }
+    return kTRUE;
+}
+
+// Time every method separately on the same input rows (us per waveform). Number of outputs of the methods is
+// updated, evaluator of every method is kept for the classification. Returns index of the fastest method
+Int_t timeMethods(std::vector<InferenceUtils::Method> &methods, const std::vector<TString> &variableNames, const Float_t *inputs, Long64_t nEvents,
+        std::vector<Double_t> &times, std::vector<InferenceUtils::Evaluator> &evaluators) {
+    times.assign(methods.size(), 0);
+    evaluators.assign(methods.size(), InferenceUtils::Evaluator());
+    Int_t fastest = 0;
+    for (size_t m = 0; m < methods.size(); m++) {
+        std::vector<InferenceUtils::Method> single { methods[m] };
+        InferenceUtils::Evaluator &evaluator = evaluators[m];
+        if (!InferenceUtils::createEvaluator(single, variableNames, evaluator)) {
+            exit(1);
+        }
+        InferenceUtils::updateOutputs(single, evaluator);
+        methods[m].nOutputs = single[0].nOutputs;
+        std::vector<Float_t> scores(nEvents * single[0].nOutputs);
+        // First pass initializes lazily allocated buffers and warms up the caches
+        InferenceUtils::evaluateBatch(evaluator, single, inputs, nEvents, scores.data());
+        TStopwatch timer;
+        InferenceUtils::evaluateBatch(evaluator, single, inputs, nEvents, scores.data());
+        timer.Stop();
+        times[m] = nEvents > 0 ? timer.RealTime() / nEvents * 1E6 : 0;
+        if (times[m] < times[fastest]) {
+            fastest = m;
+        }
+    }
+    return fastest;
+}
+
+enum class InferenceEngine {
+    Auto,      // compiled plugin (BDT or SOFIE network) if it is up to date, TMVA reader otherwise
+    Reader,    // TMVA reader for all methods
+    Native     // native engines (ForestUtils for BDT, NetworkUtils for dense DNN), TMVA reader for other methods
+};
+
+std::map<std::string, float> classifyWaveform_Linear(const char *weightDirPath, const char *testDirPath, Int_t nThreads = 0, Int_t batchSize = 256,
+        Bool_t useTree = kFALSE, InferenceEngine engine = InferenceEngine::Auto, Bool_t checkEngine = kFALSE, Bool_t useInt8 = kFALSE,
+        Bool_t cascade = kFALSE, Double_t bandLow = -0.2, Double_t bandHigh = 0.2, const char *cascadeFirst = "BDT",
+        const BundleUtils::Bundle *bundle = nullptr, const char *cutsFilePath = "") {
+    // Load preprocessing parameters and waveform projection saved next to the weight files during the training (if any).
+    // Model bundle holds them itself, its HistUtils parameters are already applied
+    TMatrixF projection;
+    TVectorF offset;
+    std::vector<Int_t> variables;
+    std::vector<TString> classes;
+    Bool_t useProjection = kFALSE;
+    std::vector<Double_t> trainingBins;
+    if (bundle) {
+        trainingBins = bundle->bins;
+        projection.ResizeTo(bundle->projection);
+        projection = bundle->projection;
+        offset.ResizeTo(bundle->offset);
+        offset = bundle->offset;
+        useProjection = projection.GetNrows() > 0;
+        variables = bundle->variables;
+        classes = bundle->classes;
+    } else {
+        useProjection = readPreprocessing(weightDirPath, projection, offset, variables, classes, &trainingBins);
+    }
+
+    // Noise cuts are taken from the training preprocessing, an explicit cuts file overrides them
+    if (strlen(cutsFilePath) > 0) {
+        Double_t voltageThreshold = HistUtils::voltageThreshold;
+        Double_t minPeakSeconds = HistUtils::minPeakSeconds;
+        Double_t maxPeakSeconds = HistUtils::maxPeakSeconds;
+        if (!HistUtils::readNoiseCuts(cutsFilePath)) {
+            Error("classifyWaveform_Linear", "Cannot read noise cuts file \"%s\"", cutsFilePath);
+            exit(1);
+        }
+        if (voltageThreshold != HistUtils::voltageThreshold || minPeakSeconds != HistUtils::minPeakSeconds || maxPeakSeconds != HistUtils::maxPeakSeconds) {
+            Warning("classifyWaveform_Linear", "Noise cuts of \"%s\" override the cuts of the training (threshold %g V, peak window %g ... %g s)",
+                    cutsFilePath, voltageThreshold, minPeakSeconds, maxPeakSeconds);
+        }
     }
 
-    Long64_t nEntries = treeTest->GetEntries();
+    // Read "good" waveforms to be tested. Multiclass model scores the noise (baseline) waveforms itself, so the noise
+    // cuts are skipped
+    Bool_t multiclass = classes.size() > 2;
+    TList *goodTestHists = getGoodHistogramsList(testDirPath, kFALSE, nullptr, !multiclass);
+    if (multiclass) {
+        Info("classifyWaveform_Linear", "Multiclass model (%zu classes), scoring %d waveforms including noise", classes.size(), goodTestHists->GetSize());
+    }
+    TList *goodTestHistsPrepared = HistUtils::prepHistsForTMVA(goodTestHists);  // TODO: Crop and invert histograms (required for the hist->GetRandom() to work)
+    if (goodTestHistsPrepared->GetSize() < 1) {
+
+        std::map<std::string, float> map { };
+        return map;
+    }
+    // Remember number of bins in first good histogram
+    Int_t nBins = ((TH1*) (goodTestHistsPrepared->At(0)))->GetNbinsX();
+
+    if (useProjection && projection.GetNcols() != nBins) {
+        Error("classifyWaveform_Linear", "Projection expects %d bins, waveforms have %d bins", projection.GetNcols(), nBins);
+        exit(1);
+    }
+    for (Int_t i : variables) {
+        if (i >= nBins) {
+            Error("classifyWaveform_Linear", "Variable list refers to bin %d, waveforms have %d bins", i, nBins);
+            exit(1);
+        }
+    }
+    Bool_t useSelection = !useProjection && variables.size() > 0;
+    Int_t nVars = useProjection ? projection.GetNrows() : (useSelection ? (Int_t) variables.size() : nBins);
+    if (useProjection) {
+        Info("classifyWaveform_Linear", "Waveforms are projected onto %d principal components", nVars);
+    }
+    if (useSelection) {
+        Info("classifyWaveform_Linear", "Using %d of %d waveform bins", nVars, nBins);
+    }
+
+    // Names of the input variables
+    // - the variable names MUST corresponds in name and type to those given in the weight file(s) used
+    std::vector<TString> variableNames;
+    for (int i = 0; i < nVars; i++) {
+        TString expression = useProjection ? "pc" : "var";
+        expression += useSelection ? variables[i] : i;
+        variableNames.push_back(expression);
+    }
+
+    // Histograms in input order, scores of every waveform are written to its own row. Crop window and decimation of
+    // the training must give the waveforms the same bins as the training waveforms (axis within half a bin)
+    std::vector<TH1*> testHists;
+    for (TObject *obj : *goodTestHistsPrepared) {
+        TH1 *spectrumHist = (TH1*) obj;
+        if (spectrumHist->GetNbinsX() != nBins) {
+            Error("classifyWaveform_Linear", "Waveform \"%s\" has %d bins instead of %d", spectrumHist->GetName(), spectrumHist->GetNbinsX(), nBins);
+            exit(1);
+        }
+        TAxis *axis = spectrumHist->GetXaxis();
+        if (trainingBins.size() == 3 && (nBins != (Int_t) trainingBins[0] || std::abs(axis->GetXmin() - trainingBins[1]) > axis->GetBinWidth(1) / 2
+                || std::abs(axis->GetXmax() - trainingBins[2]) > axis->GetBinWidth(1) / 2)) {
+            Error("classifyWaveform_Linear", "Waveform \"%s\" is prepared into %d bins over %.3e ... %.3e s, methods were trained on %d bins over "
+                    "%.3e ... %.3e s (window %.3e ... %.3e s, decimation factor %d)", spectrumHist->GetName(), nBins, axis->GetXmin(), axis->GetXmax(),
+                    (Int_t) trainingBins[0], trainingBins[1], trainingBins[2], HistUtils::leftEdgeSeconds, HistUtils::rightEdgeSeconds,
+                    HistUtils::decimationFactor);
+            exit(1);
+        }
+        testHists.push_back(spectrumHist);
+    }
+    Long64_t nEntries = testHists.size();
+
+    // Prepared waveforms are copied straight from the histograms to the rows of the input matrix, or read back from
+    // the test tree if it is created. Only the copy is timed, projection and bin selection are not
+    TTree *treeTest = nullptr;
+    std::vector<float> treeWaveform(nBins);
+    std::mutex treeMutex;
+    auto readRow = [&](Long64_t entry, Float_t *waveform, Float_t *values, TStopwatch &inputTimer) {
+        Float_t *input = (useProjection || useSelection) ? waveform : values;
+        inputTimer.Start(kFALSE);
+        if (treeTest) {
+            // Tree is read by one worker at a time
+            std::lock_guard<std::mutex> lock(treeMutex);
+            treeTest->GetEntry(entry);
+            std::copy(treeWaveform.begin(), treeWaveform.end(), input);
+        } else {
+            HistUtils::histToBuffer(testHists[entry], input);
+        }
+        inputTimer.Stop();
+        if (useProjection) {
+            ProjectionUtils::project(projection, offset, waveform, values);
+        } else if (useSelection) {
+            for (Int_t i = 0; i < nVars; i++) {
+                values[i] = waveform[variables[i]];
+            }
+        }
+    };
+
+    // Hint. We represent each spectrum bin for the reader as separate variable var0, var1,...
+    // Check the input "...weight.xml" files. Variables there are named like above
+    // Petr Stepanov: issue with the AddVariablesArray() method: https://github.com/root-project/root/pull/10780
+
+    // Loop through all weight files in given weight directory. Weight files are read once and every worker books
+    // the methods in its own TMVA reader. Compiled plugins and native engines evaluate methods without the reader
+    TStopwatch setupTimer;
+    std::vector<InferenceUtils::Method> methods;
+    std::vector<TString> weightFilePaths;
+    if (bundle) {
+        // Bundle methods carry the native engine tables, plugins are not bundled
+        for (const BundleUtils::BundleMethod &entry : bundle->methods) {
+            InferenceUtils::Method method = entry.method;
+            if (entry.variables != variableNames) {
+                Error("classifyWaveform_Linear", "Method %s of the bundle expects %zu input variables, prepared waveforms give %zu (%s ... %s)",
+                        method.name.Data(), entry.variables.size(), variableNames.size(), variableNames.front().Data(), variableNames.back().Data());
+                exit(1);
+            }
+            if (engine == InferenceEngine::Reader) {
+                method.forest.reset();
+                method.network.reset();
+            } else if (useInt8 && method.network) {
+                if (entry.inputScales.size() != method.network->layers.size()) {
+                    Error("classifyWaveform_Linear", "Method %s of the bundle has no int8 scales, run 'quantize-dnn' and 'bundle' again", method.name.Data());
+                    exit(1);
+                }
+                std::shared_ptr<NetworkUtils::Network> network = std::make_shared<NetworkUtils::Network>(*method.network);
+                NetworkUtils::quantize(*network, entry.inputScales);
+                method.network = network;
+            }
+            if (method.forest) {
+                Info("classifyWaveform_Linear", "Method %s is evaluated by the native forest engine", method.name.Data());
+            } else if (method.network) {
+                Info("classifyWaveform_Linear", "Method %s is evaluated by the native network engine (%s kernel)", method.name.Data(),
+                        useInt8 ? KernelUtils::getInt8Kernel() : KernelUtils::getDenseKernel());
+            }
+            methods.push_back(method);
+            weightFilePaths.push_back(method.filePath);
+        }
+    } else {
+        TList *fileNames = FileUtils::getFilePathsInDirectory(weightDirPath, ".xml");
+        for (TObject *obj : *fileNames) {
+            TObjString *fileNameObjString = (TObjString*) obj;
+            if (fileNameObjString) {
+                TString filePath = fileNameObjString->GetString();
+                TString methodType = FileUtils::getFileNameNoExtensionFromPath(filePath);
+
+                // Weight files of the cross-validation folds are loaded by the fold ensemble method
+                if (filePath.Contains(TRegexp("_fold[0-9]+\\.weights\\.xml$"))) {
+                    continue;
+                }
+
+                // Load compiled plugin, native engine or TMVA method
+                InferenceUtils::Method method;
+                TString libraryPath = filePath(0, filePath.Length() - 4) + ".so";
+                if (engine == InferenceEngine::Auto && isPluginUpToDate(libraryPath, filePath)) {
+                    if (!InferenceUtils::loadPlugin(libraryPath, methodType, variableNames, method)) {
+                        exit(1);
+                    }
+                    Info("classifyWaveform_Linear", "Method %s is evaluated by the compiled plugin", methodType.Data());
+                } else if (!InferenceUtils::loadMethod(filePath, methodType, method)) {
+                    exit(1);
+                } else if (engine == InferenceEngine::Native && method.type == TMVA::Types::kBDT) {
+                    if (!InferenceUtils::loadForest(filePath, methodType, variableNames, method)) {
+                        exit(1);
+                    }
+                    Info("classifyWaveform_Linear", "Method %s is evaluated by the native forest engine", methodType.Data());
+                } else if (engine == InferenceEngine::Native && method.type == TMVA::Types::kDL) {
+                    // Convolutional networks stay with the TMVA reader. Int8 networks need scales of the 'quantize-dnn' mode
+                    TString scalesPath = filePath(0, filePath.Length() - 4) + ".int8.txt";
+                    if (InferenceUtils::loadNetwork(filePath, methodType, variableNames, method, useInt8 ? scalesPath.Data() : nullptr)) {
+                        Info("classifyWaveform_Linear", "Method %s is evaluated by the native network engine (%s kernel)", methodType.Data(),
+                                useInt8 ? KernelUtils::getInt8Kernel() : KernelUtils::getDenseKernel());
+                    } else if (useInt8) {
+                        exit(1);
+                    } else {
+                        Warning("classifyWaveform_Linear", "Method %s is evaluated by the TMVA reader", methodType.Data());
+                    }
+                }
+                methods.push_back(method);
+                weightFilePaths.push_back(filePath);
+            }
+        }
+    }
+
+    // Workers pull batches of waveforms from a shared queue. Nested ROOT/TMVA/BLAS thread pools are disabled
+    Int_t nWorkers = nThreads == 0 ? SystemUtils::getAvailableCores() : std::max(1, nThreads);
+    if (nWorkers > 1) {
+        ROOT::EnableThreadSafety();
+        SystemUtils::configureThreads(-1, 1);
+    }
+    // Worker 0 evaluators are booked here (number of outputs of the methods is known after the booking), the other
+    // workers book their own evaluators in parallel when they start. Cascade evaluates every method with own evaluator
+    std::vector<InferenceUtils::Evaluator> evaluators(nWorkers);
+    std::vector<std::vector<InferenceUtils::Evaluator>> methodEvaluators;
+    std::vector<std::vector<InferenceUtils::Method>> cascadeMethods;
+    std::vector<Int_t> escalationColumns;
+    std::vector<Double_t> methodTimes;
+    Int_t firstMethod = -1;
+    if (!cascade) {
+        if (!InferenceUtils::createEvaluator(methods, variableNames, evaluators[0])) {
+            exit(1);
+        }
+        InferenceUtils::updateOutputs(methods, evaluators[0]);
+    } else {
+        // Cascade: the first method (BDT by default, or the fastest one) scores every waveform, the other (escalation)
+        // methods only the waveforms with the first score inside the ambiguity band. Methods are timed on the first
+        // batch of waveforms
+        if (methods.size() < 2) {
+            Error("classifyWaveform_Linear", "Cascade needs at least two methods");
+            exit(1);
+        }
+        Long64_t nSample = std::min<Long64_t>(batchSize, nEntries);
+        std::vector<Float_t> sampleInputs(nSample * nVars);
+        std::vector<Float_t> waveform(nBins);
+        TStopwatch sampleTimer;
+        for (Long64_t row = 0; row < nSample; row++) {
+            readRow(row, waveform.data(), sampleInputs.data() + row * nVars, sampleTimer);
+        }
+        // Evaluators of the timing are reused by worker 0
+        methodEvaluators.resize(nWorkers);
+        firstMethod = timeMethods(methods, variableNames, sampleInputs.data(), nSample, methodTimes, methodEvaluators[0]);
+        if (TString(cascadeFirst) != "fastest") {
+            // Weight files are named "<job>_<method title>.weights.xml"
+            firstMethod = -1;
+            for (size_t m = 0; m < methods.size(); m++) {
+                if (methods[m].name == cascadeFirst || methods[m].name.EndsWith(TString::Format("_%s.weights", cascadeFirst))) {
+                    firstMethod = m;
+                }
+            }
+            if (firstMethod < 0) {
+                Error("classifyWaveform_Linear", "Method %s of --cascade-first is not found", cascadeFirst);
+                exit(1);
+            }
+        }
+        for (size_t m = 0; m < methods.size(); m++) {
+            // Score columns follow the method order, one column per method
+            if (methods[m].nOutputs != 1) {
+                Error("classifyWaveform_Linear", "Cascade needs binary classification methods, %s is multiclass", methods[m].name.Data());
+                exit(1);
+            }
+            Info("classifyWaveform_Linear", "Method %s: %.2f us per waveform", methods[m].name.Data(), methodTimes[m]);
+            cascadeMethods.push_back({ methods[m] });
+            if ((Int_t) m != firstMethod) {
+                escalationColumns.push_back(m);
+            }
+        }
+        // Band is given on the [-1, 1] scale of the BDT score, networks score in [0, 1] (sigmoid output)
+        if (methods[firstMethod].type == TMVA::Types::kDL) {
+            bandLow = (bandLow + 1) / 2;
+            bandHigh = (bandHigh + 1) / 2;
+        }
+        Info("classifyWaveform_Linear", "Cascade: %s scores first, other methods score waveforms with %s score in [%g, %g]",
+                methods[firstMethod].name.Data(), methods[firstMethod].name.Data(), bandLow, bandHigh);
+    }
+    Int_t nScores = InferenceUtils::getNScores(methods);
+    setupTimer.Stop();
+    Info("classifyWaveform_Linear", "Setup time: %.2f ms for %zu methods (other workers book them in parallel)", setupTimer.RealTime() * 1E3,
+            methods.size());
+
+    // Methods evaluated without the TMVA reader are also booked in the reference readers to compare the scores
+    std::vector<InferenceUtils::Method> referenceMethods, checkedMethods;
+    if (checkEngine) {
+        for (size_t m = 0; m < methods.size(); m++) {
+            if (!methods[m].usesReader()) {
+                InferenceUtils::Method reference;
+                if (bundle) {
+                    // Weight file is kept in the bundle next to the engine tables
+                    reference = bundle->methods[m].method;
+                    reference.forest.reset();
+                    reference.network.reset();
+                } else if (!InferenceUtils::loadMethod(weightFilePaths[m], methods[m].name, reference)) {
+                    exit(1);
+                }
+                referenceMethods.push_back(reference);
+                checkedMethods.push_back(methods[m]);
+            }
+        }
+        if (referenceMethods.empty()) {
+            Warning("classifyWaveform_Linear", "All methods are evaluated by the TMVA reader, nothing to check");
+        }
+    }
+    Int_t nReferences = referenceMethods.size();
+    std::vector<InferenceUtils::Evaluator> referenceEvaluators(nReferences > 0 ? nWorkers : 0);
+    std::vector<Long64_t> nMismatches(nWorkers * nReferences, 0);
+    std::vector<Double_t> maxDifferences(nWorkers * nReferences, 0);
+
+    // Prepare output histogram(s), one per class for the multiclass method
+    std::vector<TH1F*> histograms { };
+    for (const InferenceUtils::Method &method : methods) {
+        if (method.nOutputs > 1) {
+            for (Int_t c = 0; c < method.nOutputs; c++) {
+                TString histName = method.name + "_" + (c < (Int_t) classes.size() ? classes[c] : TString::Format("%d", c));
+                histograms.push_back(new TH1F(histName, histName, 100, 0.0, 1.0));
+            }
+        } else {
+            TH1F *hist = new TH1F(method.name, method.name, 100, -1.0, 1.0);
+            histograms.push_back(hist);
+        }
+    }
+
+    // Optionally waveforms are written to a tree and read back (former input path, kept to compare the input latency)
+    TStopwatch treeTimer;
+    treeTimer.Reset();
+    if (useTree) {
+        treeTimer.Start(kFALSE);
+        // if (rootFileType == MLFileType::Linear){
+        treeTest = HistUtils::histsToTreeLin(goodTestHistsPrepared, "tree", "Tree for Classification");
+        Info("classifyWaveform_Linear", "Test Tree Created");
+        // }
+
+        // Petr Stepanov: address of the "vars" should be address of a pointer
+        // How to read write vector to Tree: https://gist.github.com/jiafulow/8877081e032158471578
+        for (int i = 0; i < nBins; i++) {
+            TString expr = "var";
+            expr += i;
+            treeTest->SetBranchAddress(expr.Data(), &treeWaveform[i]);
+        }
+        treeTimer.Stop();
+    }
+
+    std::vector<Float_t> scores(nEntries * nScores);
+
+    // Worker: fill the input matrix of the next batch and evaluate all methods over it. In the cascade the escalation
+    // methods evaluate the ambiguous rows gathered into a smaller matrix, scores of the other rows are left NaN
+    std::atomic<Long64_t> nextBatch(0);
+    std::vector<Double_t> inputTimes(nWorkers, 0);
+    std::vector<Long64_t> nEscalated(nWorkers, 0);
+    std::vector<Double_t> cascadeTimes(nWorkers, 0);
+    auto work = [&](Int_t worker) {
+        // Weight files are parsed by every worker thread at the same time instead of serially before the start
+        Bool_t booked = kTRUE;
+        if (worker > 0 && !cascade) {
+            booked = InferenceUtils::createEvaluator(methods, variableNames, evaluators[worker]);
+        } else if (worker > 0) {
+            methodEvaluators[worker].resize(methods.size());
+            for (size_t m = 0; m < methods.size() && booked; m++) {
+                booked = InferenceUtils::createEvaluator(cascadeMethods[m], variableNames, methodEvaluators[worker][m]);
+            }
+        }
+        if (!booked || (nReferences > 0 && !InferenceUtils::createEvaluator(referenceMethods, variableNames, referenceEvaluators[worker]))) {
+            exit(1);
+        }
+        InferenceUtils::Evaluator &evaluator = evaluators[worker];
+        std::vector<Float_t> inputs(batchSize * nVars);
+        std::vector<Float_t> waveform(nBins);
+        std::vector<Double_t> referenceScores(nReferences > 0 ? batchSize : 0);
+        std::vector<Double_t> checkedScores(nReferences > 0 ? batchSize : 0);
+        std::vector<Float_t> firstScores(cascade ? batchSize : 0);
+        std::vector<Float_t> escalationInputs(cascade ? batchSize * nVars : 0);
+        std::vector<Float_t> escalationScores(cascade ? batchSize : 0);
+        std::vector<Long64_t> escalationRows(cascade ? batchSize : 0);
+        TStopwatch inputTimer, cascadeTimer;
+        inputTimer.Reset();
+        cascadeTimer.Reset();
+        for (Long64_t batchStart = nextBatch.fetch_add(batchSize); batchStart < nEntries; batchStart = nextBatch.fetch_add(batchSize)) {
+            Long64_t nBatch = std::min<Long64_t>(batchSize, nEntries - batchStart);
+            for (Long64_t row = 0; row < nBatch; row++) {
+                readRow(batchStart + row, waveform.data(), inputs.data() + row * nVars, inputTimer);
+            }
+            if (!cascade) {
+                InferenceUtils::evaluateBatch(evaluator, methods, inputs.data(), nBatch, scores.data() + batchStart * nScores);
+            } else {
+                cascadeTimer.Start(kFALSE);
+                InferenceUtils::evaluateBatch(methodEvaluators[worker][firstMethod], cascadeMethods[firstMethod], inputs.data(), nBatch, firstScores.data());
+                Long64_t nRows = 0;
+                for (Long64_t row = 0; row < nBatch; row++) {
+                    Float_t *score = scores.data() + (batchStart + row) * nScores;
+                    std::fill(score, score + nScores, NAN);
+                    score[firstMethod] = firstScores[row];
+                    if (firstScores[row] >= bandLow && firstScores[row] <= bandHigh) {
+                        std::copy(inputs.data() + row * nVars, inputs.data() + (row + 1) * nVars, escalationInputs.data() + nRows * nVars);
+                        escalationRows[nRows++] = row;
+                    }
+                }
+                if (nRows > 0) {
+                    for (Int_t column : escalationColumns) {
+                        InferenceUtils::evaluateBatch(methodEvaluators[worker][column], cascadeMethods[column], escalationInputs.data(), nRows,
+                                escalationScores.data());
+                        for (Long64_t i = 0; i < nRows; i++) {
+                            scores[(batchStart + escalationRows[i]) * nScores + column] = escalationScores[i];
+                        }
+                    }
+                }
+                cascadeTimer.Stop();
+                nEscalated[worker] += nRows;
+            }
+
+            // Scores must be bit-exact copies of the TMVA reader output. They are compared in double precision, the cast to
+            // the score matrix would hide small differences
+            for (Int_t j = 0; j < nReferences; j++) {
+                InferenceUtils::evaluateMethod(referenceEvaluators[worker], referenceMethods, j, inputs.data(), nBatch, referenceScores.data());
+                InferenceUtils::evaluateMethod(referenceEvaluators[worker], checkedMethods, j, inputs.data(), nBatch, checkedScores.data());
+                for (Long64_t row = 0; row < nBatch; row++) {
+                    if (checkedScores[row] != referenceScores[row]) {
+                        nMismatches[worker * nReferences + j]++;
+                        maxDifferences[worker * nReferences + j] = std::max(maxDifferences[worker * nReferences + j],
+                                std::abs(checkedScores[row] - referenceScores[row]));
+                    }
+                }
+            }
+        }
+        inputTimes[worker] = inputTimer.RealTime();
+        cascadeTimes[worker] = cascadeTimer.RealTime();
+    };
+
+    TStopwatch evaluateTimer;
+    std::vector<std::thread> workers;
+    for (Int_t worker = 1; worker < nWorkers; worker++) {
+        workers.emplace_back(work, worker);
+    }
+    work(0);
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    evaluateTimer.Stop();
+    Double_t inputTime = treeTimer.RealTime();
+    for (Double_t time : inputTimes) {
+        inputTime += time;
+    }
+
+    // Output to screen in input order, fill histograms with responses
     std::map<std::string, float> map;
     for (Long64_t ievt = 0; ievt < nEntries; ievt++) {
-        treeTest->GetEntry(ievt);
-
-//		TString hName = TString::Format("h%d", ievt);
-//		TH1F* h = new TH1F(hName.Data(), hName.Data(), nBins, 0, nBins);
-//		int i = 1;
-//		for (float val : *fValuesPtr){
-//			h->SetBinContent(i, val);
-//			i++;
-//		}
-//		new TCanvas();
-//		h->Draw();
-
-        // Get spectrunm name
-        TString spectrumName = "";
-        TObject *obj = goodTestHistsPrepared->At(ievt);
-        TH1 *spectrumHist = (TH1*) obj;
-        if (spectrumHist)
-            spectrumName = spectrumHist->GetName();
         std::cout << "Entry: " << ievt << std::endl;
-        std::cout << "Filename: " << spectrumName << std::endl;
-        for (TH1F *hist : histograms) {
-            // Get response from MVA - passing method name (here - hist name)
-            Double_t val = reader->EvaluateMVA(hist->GetName());
-            // Fill histogram with responce
-            hist->Fill(val);
-            map[hist->GetName()] = val;
-            // Output to screen
-            std::cout << "MVA response for \"" << hist->GetName() << "\": " << val << std::endl;
+        std::cout << "Filename: " << testHists[ievt]->GetName() << std::endl;
+        const Float_t *score = scores.data() + ievt * nScores;
+        Int_t column = 0;
+        for (const InferenceUtils::Method &method : methods) {
+            std::cout << "MVA response for \"" << method.name << "\":";
+            for (Int_t j = 0; j < method.nOutputs; j++, column++) {
+                Float_t val = score[column];
+                if (std::isnan(val)) {
+                    // Waveform is not escalated in the cascade
+                    std::cout << " -";
+                    continue;
+                }
+                histograms[column]->Fill(val);
+                map[histograms[column]->GetName()] = val;
+                if (method.nOutputs > 1) {
+                    std::cout << " " << (j < (Int_t) classes.size() ? classes[j] : TString::Format("%d", j));
+                }
+                std::cout << " " << val;
+            }
+            std::cout << std::endl;
         }
         std::cout << std::endl;
-
     }
 
-//	histBdtF->Fill( reader->EvaluateMVA("BDT method" ));
-//	histDnnCpu->Fill(reader->EvaluateMVA("DNN_CPU method"));
+    Info("classifyWaveform_Linear", "Inference time: %.3f s for %lld waveforms (%.2f us per waveform)", evaluateTimer.RealTime(), nEntries,
+            nEntries > 0 ? evaluateTimer.RealTime() / nEntries * 1E6 : 0.);
+    Info("classifyWaveform_Linear", "Input time (%s): %.3f s for %lld waveforms (%.2f us per waveform)", treeTest ? "tree" : "direct",
+            inputTime, nEntries, nEntries > 0 ? inputTime / nEntries * 1E6 : 0.);
+    Info("classifyWaveform_Linear", "Classified with %d worker threads, %.0f waveforms per second", nWorkers,
+            evaluateTimer.RealTime() > 0 ? nEntries / evaluateTimer.RealTime() : 0.);
+    if (cascade) {
+        // Full evaluation costs the sum of the method times. Gain is estimated from the method timings and measured
+        // from the evaluation time the workers spent in the cascade (without reading the inputs)
+        Long64_t nEscalatedTotal = 0;
+        Double_t measuredTime = 0;
+        for (Int_t worker = 0; worker < nWorkers; worker++) {
+            nEscalatedTotal += nEscalated[worker];
+            measuredTime += cascadeTimes[worker];
+        }
+        Double_t fraction = nEntries > 0 ? (Double_t) nEscalatedTotal / nEntries : 0;
+        measuredTime = nEntries > 0 ? measuredTime / nEntries * 1E6 : 0;
+        Double_t fullTime = 0;
+        for (Double_t time : methodTimes) {
+            fullTime += time;
+        }
+        Double_t cascadeTime = methodTimes[firstMethod] + fraction * (fullTime - methodTimes[firstMethod]);
+        Info("classifyWaveform_Linear", "Cascade: %lld of %lld waveforms (%.1f%%) escalated, estimated throughput gain x%.2f, measured x%.2f"
+                " (%.2f us per waveform, %.2f us with all methods)", nEscalatedTotal, nEntries, fraction * 100, cascadeTime > 0 ? fullTime / cascadeTime : 1.,
+                measuredTime > 0 ? fullTime / measuredTime : 1., measuredTime, fullTime);
+    }
+    for (Int_t j = 0; j < nReferences; j++) {
+        Long64_t nDifferent = 0;
+        Double_t maxDifference = 0;
+        for (Int_t worker = 0; worker < nWorkers; worker++) {
+            nDifferent += nMismatches[worker * nReferences + j];
+            maxDifference = std::max(maxDifference, maxDifferences[worker * nReferences + j]);
+        }
+        Info("classifyWaveform_Linear", "Engine check for %s: %lld of %lld scores differ from the TMVA reader (max difference %.3g)",
+                referenceMethods[j].name.Data(), nDifferent, nEntries, maxDifference);
+    }
 
     // Write histograms
     TFile *target = new TFile("TMVApp.root", "RECREATE");
@@ -827,8 +2552,6 @@ std::map<std::string, float> classifyWaveform_Linear(const char *weightDirPath,
     target->Close();
     std::cout << "--- Created root file: \"TMVApp.root\" containing the MVA output histograms" << std::endl;
 
-    delete reader;
-
     Info("classifyWaveform_Linear", "Classification completed");
 
     return map;
@@ -844,14 +2567,56 @@ int main(int argc, char *argv[]) {
 
     // Add command-line options
     options.allow_unrecognised_options().add_options()    //
-    ("mode", "Program mode ('prepare', 'train', 'tmva-gui', 'classify')", cxxopts::value<std::string>())    //
+    ("mode", "Program mode ('optimize-cuts', 'prepare', 'train', 'sweep', 'crossval', 'prune', 'tmva-gui', 'compile-bdt', 'compile-dnn', 'quantize-dnn', 'bundle', 'classify')", cxxopts::value<std::string>())    //
+    ("cuts", "Noise cuts config file ('optimize-cuts', 'prepare'), overrides the cuts of the training ('classify')", cxxopts::value<std::string>()->default_value(NOISE_CUTS_FILE_NAME))    //
+    ("good", "Directory path with labelled \"good\" .csv waveforms ('optimize-cuts')", cxxopts::value<std::string>())    //
+    ("noise", "Directory path with labelled noise .csv waveforms ('optimize-cuts')", cxxopts::value<std::string>())    //
+    ("cut-efficiency", "Minimum fraction of the \"good\" waveforms kept by the noise cuts ('optimize-cuts')", cxxopts::value<double>()->default_value("0.99"))    //
+    ("cut-steps", "Number of scanned values of every noise cut ('optimize-cuts')", cxxopts::value<int>()->default_value("100"))    //
     ("save-waveform-img", "Save .png waveforms images('prepare')", cxxopts::value<bool>()->default_value("false"))    //
+    ("decimate", "Low-pass filter and downsample waveforms by integer factor ('prepare')", cxxopts::value<int>()->default_value("1"))    //
+    ("align", "Align waveforms to a common constant fraction time before the crop ('prepare')", cxxopts::value<bool>()->default_value("false"))    //
+    ("align-fraction", "Constant fraction of the pulse maximum used for the alignment ('prepare')", cxxopts::value<double>()->default_value("0.3"))    //
+    ("align-t0", "Common pulse time after the alignment, s ('prepare')", cxxopts::value<double>()->default_value("0"))    //
+    ("align-cubic", "Use cubic instead of linear interpolation for the alignment ('prepare')", cxxopts::value<bool>()->default_value("false"))    //
+    ("reject-pileup", "Drop waveforms with more than one pulse ('prepare')", cxxopts::value<bool>()->default_value("false"))    //
+    ("multiclass", "Keep noise waveforms as the third (baseline) class and train signal/background/baseline classifier ('prepare', 'train')", cxxopts::value<bool>()->default_value("false"))    //
+    ("auto-window", "Detect crop window from the signal/background separation power ('prepare')", cxxopts::value<bool>()->default_value("false"))    //
+    ("window-sample", "Number of files per class analyzed for the crop window detection ('prepare')", cxxopts::value<int>()->default_value("1000"))    //
+    ("window-fraction", "Fraction of the total separation power kept inside the crop window ('prepare')", cxxopts::value<double>()->default_value("0.99"))    //
     ("background", "Directory path for background .csv waveforms ('prepare')", cxxopts::value<std::string>())    //
     ("signal", "Directory path for signal .csv waveforms ('prepare')", cxxopts::value<std::string>())    //
-    ("weight", "Machine learning weight file path ('classify')", cxxopts::value<std::string>())    //
+    ("weight", "Machine learning weight file path ('compile-bdt', 'compile-dnn', 'quantize-dnn', 'bundle', 'classify')", cxxopts::value<std::string>())    //
     ("test", "Directory path with .csv waveforms for classifying ('test')", cxxopts::value<std::string>())    //
+    ("batch-size", "Number of waveforms evaluated by every method at once ('classify'), batch size of the generated network ('compile-dnn')", cxxopts::value<int>()->default_value("256"))    //
+    ("reader-tree", "Pass waveforms to the TMVA reader through a TTree instead of the direct copy, for comparison ('classify')", cxxopts::value<bool>()->default_value("false"))    //
+    ("engine", "Inference engine: 'auto' - compiled BDT plugins if up to date, 'reader' - TMVA reader, 'native' - built-in engines ('classify')", cxxopts::value<std::string>()->default_value("auto"))    //
+    ("simd", "Instruction set of the native network engine: 'auto', 'avx512', 'avx2' or 'scalar' ('classify', 'quantize-dnn')", cxxopts::value<std::string>()->default_value("auto"))    //
+    ("int8", "Evaluate dense DNN with int8 weights, needs scales of the 'quantize-dnn' mode ('classify' with --engine native)", cxxopts::value<bool>()->default_value("false"))    //
+    ("calibration-events", "Number of training events of each class used to calibrate int8 scales ('quantize-dnn')", cxxopts::value<int>()->default_value("1000"))    //
+    ("cascade", "Score every waveform with the first method, other methods only score waveforms in the ambiguity band ('classify')", cxxopts::value<bool>()->default_value("false"))    //
+    ("cascade-first", "Method title scoring first in the cascade, 'fastest' picks it by timing ('classify' with --cascade)", cxxopts::value<std::string>()->default_value("BDT"))    //
+    ("cascade-band", "Ambiguity band of the first method score on the BDT scale [-1, 1], e.g. --cascade-band=-0.2,0.2 ('classify' with --cascade)", cxxopts::value<std::string>()->default_value("-0.2,0.2"))    //
+    ("bundle", "Model bundle file path ('bundle' - written, 'classify' - read instead of the weight folder)", cxxopts::value<std::string>())    //
+    ("check-engine", "Compare scores of the methods evaluated without the TMVA reader with the reader output ('classify')", cxxopts::value<bool>()->default_value("false"))    //
     ("bdt", "Use only Boosted Decision Trees (BDT) for training", cxxopts::value<bool>()->default_value("false"))    //
-    ("dnn", "Use only Deep Neural Network (DNN) for training", cxxopts::value<bool>()->default_value("false"))("help", "Print usage");    //
+    ("dnn", "Use only Deep Neural Network (DNN) for training", cxxopts::value<bool>()->default_value("false"))    //
+    ("cnn", "Use 1D Convolutional Neural Network (CNN) for training", cxxopts::value<bool>()->default_value("false"))    //
+    ("pca", "Number of principal components to project waveforms onto, 0 - use all bins ('train')", cxxopts::value<int>()->default_value("0"))    //
+    ("parallel-methods", "Train every method in a separate worker process ('train')", cxxopts::value<bool>()->default_value("false"))    //
+    ("cache", "Folder to cache the prepared (split) dataset between training runs ('train', 'sweep')", cxxopts::value<std::string>())    //
+    ("skip-finished", "Train only the methods not finished by the previous (interrupted) run ('train')", cxxopts::value<bool>()->default_value("false"))    //
+    ("dnn-epochs", "Maximum number of DNN training epochs ('train')", cxxopts::value<int>())    //
+    ("dnn-patience", "Stop DNN training after this number of epochs without improvement of the test error ('train')", cxxopts::value<int>())    //
+    ("threads", "Number of ROOT/TMVA threads ('train') or classification workers ('classify'), 0 - all available cores, -1 - sequential", cxxopts::value<int>()->default_value("0"))    //
+    ("omp-threads", "Number of OpenMP/BLAS threads, 0 - same as --threads ('train')", cxxopts::value<int>()->default_value("0"))    //
+    ("folds", "Number of cross-validation folds ('crossval')", cxxopts::value<int>()->default_value("5"))    //
+    ("fold-workers", "Number of folds trained in parallel, 0 - all folds within the --threads budget, 1 - sequential ('crossval')", cxxopts::value<int>()->default_value("0"))    //
+    ("sweep", "Hyperparameter sweep specification file ('sweep')", cxxopts::value<std::string>())    //
+    ("sweep-random", "Number of randomly picked parameter combinations, 0 - full grid ('sweep')", cxxopts::value<int>()->default_value("0"))    //
+    ("prune-k", "Comma-separated numbers of the most important waveform bins to train on ('prune')", cxxopts::value<std::string>()->default_value("25,50,100,200,400"))    //
+    ("prune-ranking", "BDT weight file (trained on all bins) to rank bins by variable importance, default - per-bin separation ('prune')", cxxopts::value<std::string>()->default_value(""))    //
+    ("trial-threads", "Number of threads per sweep or pruning trial, --threads is the total core budget ('sweep', 'prune')", cxxopts::value<int>()->default_value("1"))("help", "Print usage");    //
 
     auto result = options.parse(app->Argc(), app->Argv());
 
@@ -881,16 +2646,60 @@ int main(int argc, char *argv[]) {
     }
     // By default, training is performed for all possible methods (currently implemented kBDT and kDNN)
     // However, user can specify only certain training methods in particular via command-line parameters
-    std::set<TMVA::Types::EMVA> tmvaMethodsOnly { };
+    TrainOptions trainOptions;
     if (result["bdt"].as<bool>()) {
-        tmvaMethodsOnly.insert(TMVA::Types::EMVA::kBDT);
+        trainOptions.methods.insert(TrainMethod::BDT);
     }
     if (result["dnn"].as<bool>()) {
-        tmvaMethodsOnly.insert(TMVA::Types::EMVA::kDNN);
+        trainOptions.methods.insert(TrainMethod::DNN);
+    }
+    if (result["cnn"].as<bool>()) {
+        trainOptions.methods.insert(TrainMethod::CNN);
+    }
+    trainOptions.nComponents = result["pca"].as<int>();
+    trainOptions.multiclass = result["multiclass"].as<bool>();
+    trainOptions.nThreads = result["threads"].as<int>();
+    trainOptions.nOmpThreads = result["omp-threads"].as<int>();
+    trainOptions.parallelMethods = result["parallel-methods"].as<bool>();
+    trainOptions.skipFinished = result["skip-finished"].as<bool>();
+    if (result.count("cache")) {
+        // Absolute path, sweep trials run in their own folders
+        trainOptions.cacheDir = FileUtils::getAbsolutePath(result["cache"].as<std::string>().c_str());
+    }
+    if (result.count("dnn-epochs")) {
+        trainOptions.dnnTraining = StringUtils::setOption(trainOptions.dnnTraining, "MaxEpochs", TString::Format("%d", result["dnn-epochs"].as<int>()), ',');
+    }
+    if (result.count("dnn-patience")) {
+        trainOptions.dnnTraining = StringUtils::setOption(trainOptions.dnnTraining, "ConvergenceSteps", TString::Format("%d", result["dnn-patience"].as<int>()), ',');
     }
 
-    if (mode == "prepare") {
+    // Noise cuts written by the 'optimize-cuts' mode. Built-in defaults are used if the default file does not exist.
+    // Prepared input file and the training preprocessing keep the cuts, so the later stages read them from there
+    std::string cutsFilePath = result["cuts"].as<std::string>();
+    if (mode == "optimize-cuts" || mode == "prepare") {
+        Bool_t hasNoiseCuts = HistUtils::readNoiseCuts(cutsFilePath.c_str());
+        if (!hasNoiseCuts && result.count("cuts") && mode != "optimize-cuts") {
+            Error("main", "Cannot read noise cuts file \"%s\"", cutsFilePath.c_str());
+            exit(1);
+        }
+    }
+
+    if (mode == "optimize-cuts") {
+        // Step 0. Find noise cuts on the labelled waveforms
+        if (!result.count("good") || !result.count("noise")) {
+            Error("main", "Specify directories with labelled waveforms with --good and --noise");
+            exit(1);
+        }
+        gROOT->SetBatch(kTRUE);    // results are written to the config file, nothing to display
+        optimizeNoiseCuts(result["good"].as<std::string>().c_str(), result["noise"].as<std::string>().c_str(), result["cut-efficiency"].as<double>(),
+                result["cut-steps"].as<int>(), cutsFilePath.c_str());
+    } else if (mode == "prepare") {
         // Step 1. Process CSV waveforms into a ROOT file with trees for learning
+        HistUtils::decimationFactor = result["decimate"].as<int>();
+        if (HistUtils::decimationFactor < 1) {
+            Error("main", "Decimation factor must be a positive integer");
+            exit(1);
+        }
 
         // Check if backgroud directory passed via command line
         if (backgroundDir.size() == 0) {
@@ -905,7 +2714,16 @@ int main(int argc, char *argv[]) {
             TString dir = UiUtils::getDirectoryPath();
             signalDir = dir.Data();
         }
-        createROOTFileForLearning(backgroundDir.c_str(), signalDir.c_str(), saveWaveformImages);
+        if (result["align"].as<bool>()) {
+            HistUtils::alignFraction = result["align-fraction"].as<double>();
+            HistUtils::alignTimeSeconds = result["align-t0"].as<double>();
+            HistUtils::alignCubic = result["align-cubic"].as<bool>();
+        }
+        HistUtils::rejectPileup = result["reject-pileup"].as<bool>();
+        if (result["auto-window"].as<bool>()) {
+            detectSignalWindow(backgroundDir.c_str(), signalDir.c_str(), result["window-sample"].as<int>(), result["window-fraction"].as<double>());
+        }
+        createROOTFileForLearning(backgroundDir.c_str(), signalDir.c_str(), saveWaveformImages, trainOptions.multiclass);
     } else if (mode == "train") {
         // Step 2. Learn ROOT TMVA to categorize the
         std::vector<std::string> unmatched = result.unmatched();
@@ -916,7 +2734,47 @@ int main(int argc, char *argv[]) {
             unmatched.push_back(filePath.Data());
         }
         // trainTMVA(unmatched[0].c_str());
-        trainTMVA_CNN(unmatched[0].c_str(), tmvaMethodsOnly);
+        if (trainOptions.parallelMethods || trainOptions.skipFinished) {
+            trainTMVA_Methods(unmatched[0].c_str(), trainOptions);
+        } else {
+            trainTMVA_CNN(unmatched[0].c_str(), trainOptions);
+        }
+    } else if (mode == "sweep") {
+        // Step 2a. Find best training options
+        std::vector<std::string> unmatched = result.unmatched();
+        if (unmatched.size() == 0 || !result.count("sweep")) {
+            Error("main", "Specify sweep file with --sweep and the training file path");
+            exit(1);
+        }
+        gROOT->SetBatch(kTRUE);    // results are summarized in a table, nothing to display
+        sweepTMVA(unmatched[0].c_str(), trainOptions, result["sweep"].as<std::string>().c_str(), result["sweep-random"].as<int>(),
+                result["trial-threads"].as<int>());
+    } else if (mode == "crossval") {
+        // Step 2b. Estimate spread of the classification performance
+        std::vector<std::string> unmatched = result.unmatched();
+        if (unmatched.size() == 0) {
+            // Use GUI picker if 'testDirPath' command line parameter not passed
+            UiUtils::msgBoxInfo("Dual Readout TMVA", "Specify training file path");
+            TString filePath = UiUtils::getFilePath();
+            unmatched.push_back(filePath.Data());
+        }
+        gROOT->SetBatch(kTRUE);    // results are summarized in the log, nothing to display
+        crossValidateTMVA(unmatched[0].c_str(), trainOptions, result["folds"].as<int>(), result["fold-workers"].as<int>());
+    } else if (mode == "prune") {
+        // Step 2c. Find the smallest set of informative waveform bins
+        std::vector<std::string> unmatched = result.unmatched();
+        if (unmatched.size() == 0) {
+            Error("main", "Specify the training file path");
+            exit(1);
+        }
+        std::vector<Int_t> kValues;
+        TObjArray *tokens = TString(result["prune-k"].as<std::string>()).Tokenize(",");
+        for (TObject *obj : *tokens) {
+            kValues.push_back(((TObjString*) obj)->GetString().Atoi());
+        }
+        delete tokens;
+        gROOT->SetBatch(kTRUE);    // results are summarized in a table, nothing to display
+        pruneTMVA(unmatched[0].c_str(), trainOptions, result["prune-ranking"].as<std::string>().c_str(), kValues, result["trial-threads"].as<int>());
     } else if (mode == "tmva-gui") {
         // View training output
         std::vector<std::string> unmatched = result.unmatched();
@@ -927,9 +2785,67 @@ int main(int argc, char *argv[]) {
             unmatched.push_back(filePath.Data());
         }
         TMVA::TMVAGui(unmatched[0].c_str());
+    } else if (mode == "compile-bdt") {
+        // Step 3a. Turn BDT weight files into compiled plugins
+        if (weightDirPath.size() == 0) {
+            Error("main", "Specify directory with weight files with --weight");
+            exit(1);
+        }
+        gROOT->SetBatch(kTRUE);    // plugins are written next to the weight files, nothing to display
+        compileForests(weightDirPath.c_str());
+    } else if (mode == "compile-dnn") {
+        // Step 3b. Turn dense DNN weight files into compiled SOFIE plugins
+#ifndef HAS_TMVA_SOFIE
+        Error("main", "Program is built without TMVA SOFIE, 'compile-dnn' mode is not available");
+        exit(1);
+#endif
+        if (weightDirPath.size() == 0) {
+            Error("main", "Specify directory with weight files with --weight");
+            exit(1);
+        }
+        gROOT->SetBatch(kTRUE);    // plugins are written next to the weight files, nothing to display
+        compileNetworks(weightDirPath.c_str(), std::max(1, result["batch-size"].as<int>()));
+    } else if (mode == "quantize-dnn") {
+        // Step 3c. Calibrate int8 dense DNN on the training events and compare its ROC-AUC with the float network on the test events
+        std::vector<std::string> unmatched = result.unmatched();
+        if (unmatched.size() == 0 || weightDirPath.size() == 0) {
+            Error("main", "Specify directory with weight files with --weight and the training output file path");
+            exit(1);
+        }
+        if (!KernelUtils::selectDenseKernel(result["simd"].as<std::string>().c_str())) {
+            Error("main", "Instruction set \"%s\" is not supported", result["simd"].as<std::string>().c_str());
+            exit(1);
+        }
+        gROOT->SetBatch(kTRUE);    // results are summarized in the log, nothing to display
+        quantizeNetworks(unmatched[0].c_str(), weightDirPath.c_str(), std::max(1, result["calibration-events"].as<int>()));
+    } else if (mode == "bundle") {
+        // Step 3d. Pack methods and preprocessing into one file for fast classification startup
+        if (weightDirPath.size() == 0 || !result.count("bundle")) {
+            Error("main", "Specify directory with weight files with --weight and the bundle file path with --bundle");
+            exit(1);
+        }
+        gROOT->SetBatch(kTRUE);    // bundle is written to the file, nothing to display
+        bundleModels(weightDirPath.c_str(), result["bundle"].as<std::string>().c_str());
     } else if (mode == "classify") {
         // Step 3. Use TMVA to categorize the
-        if (weightDirPath.size() == 0) {
+        // Model bundle replaces the weight folder. Its preprocessing is applied, explicit noise cuts override its cuts
+        BundleUtils::Bundle bundle;
+        Bool_t useBundle = result.count("bundle") > 0;
+        if (useBundle) {
+            std::string bundleFilePath = result["bundle"].as<std::string>();
+            TStopwatch bundleTimer;
+            if (!BundleUtils::readBundle(bundleFilePath.c_str(), bundle)) {
+                exit(1);
+            }
+            bundleTimer.Stop();
+            Info("main", "Model bundle \"%s\" (version %s, %zu methods) loaded in %.2f ms", bundleFilePath.c_str(), bundle.hash.Data(),
+                    bundle.methods.size(), bundleTimer.RealTime() * 1E3);
+            BundleUtils::setPreprocessing(bundle.preprocessing);
+            if (weightDirPath.size() > 0) {
+                Warning("main", "Weight folder \"%s\" is ignored, methods are read from the model bundle", weightDirPath.c_str());
+            }
+        }
+        if (weightDirPath.size() == 0 && !useBundle) {
             // Use GUI picker if 'testDirPath' command line parameter not passed
             UiUtils::msgBoxInfo("Dual Readout TMVA", "Specify directory with weight files");
             TString dir = UiUtils::getDirectoryPath();
@@ -941,11 +2857,35 @@ int main(int argc, char *argv[]) {
             TString dir = UiUtils::getDirectoryPath();
             testDirPath = dir.Data();
         }
-        classifyWaveform_Linear(weightDirPath.c_str(), testDirPath.c_str());
+        std::string engineName = result["engine"].as<std::string>();
+        InferenceEngine engine = InferenceEngine::Auto;
+        if (engineName == "reader") {
+            engine = InferenceEngine::Reader;
+        } else if (engineName == "native") {
+            engine = InferenceEngine::Native;
+        } else if (engineName != "auto") {
+            Error("main", "Unknown inference engine \"%s\"", engineName.c_str());
+            exit(1);
+        }
+        if (!KernelUtils::selectDenseKernel(result["simd"].as<std::string>().c_str())) {
+            Error("main", "Instruction set \"%s\" is not supported", result["simd"].as<std::string>().c_str());
+            exit(1);
+        }
+        Double_t bandLow, bandHigh;
+        if (sscanf(result["cascade-band"].as<std::string>().c_str(), "%lf,%lf", &bandLow, &bandHigh) != 2 || bandLow > bandHigh) {
+            Error("main", "Ambiguity band \"%s\" is not \"low,high\"", result["cascade-band"].as<std::string>().c_str());
+            exit(1);
+        }
+        classifyWaveform_Linear(weightDirPath.c_str(), testDirPath.c_str(), result["threads"].as<int>(), std::max(1, result["batch-size"].as<int>()),
+                result["reader-tree"].as<bool>(), engine, result["check-engine"].as<bool>(), result["int8"].as<bool>(), result["cascade"].as<bool>(),
+                bandLow, bandHigh, result["cascade-first"].as<std::string>().c_str(), useBundle ? &bundle : nullptr,
+                result.count("cuts") ? cutsFilePath.c_str() : "");
     }
 
-    // Enter the event loop
-    app->Run();
+    // Enter the event loop (not needed in batch mode, e.g. when running benchmarks)
+    if (!gROOT->IsBatch()) {
+        app->Run();
+    }
 
     // Return success
     gSystem->Exit(0);
@@ -0,0 +1,90 @@
+// Native forest engine (ForestUtils) against the TMVA reader on a BDT weight file. Scores are compared
+// in double precision, so differences hidden by the single precision score matrix of 'classify' are caught too.
+// Usage: test-forest-engine <weight-file>
+
+#include <TError.h>
+#include <TMVA/Reader.h>
+#include <TSystem.h>
+
+#include "../src/ForestUtils.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+	// Copy of the weight file with the first cut replaced by a Fisher cut (UseFisherCuts option)
+	Bool_t writeFisherCut(const char* weightFilePath, const char* fisherFilePath){
+		std::ifstream input(weightFilePath);
+		std::stringstream buffer;
+		buffer << input.rdbuf();
+		std::string text = buffer.str();
+		size_t position = text.find("NCoef=\"0\" IVar=\"0\"");
+		if (position == std::string::npos) return kFALSE;
+		text.replace(position, 18, "NCoef=\"1\" fC0=\"1.0000000000000000e+00\" IVar=\"-1\"");
+		std::ofstream output(fisherFilePath);
+		output << text;
+		return output.good();
+	}
+}
+
+int main(int argc, char* argv[]){
+	if (argc < 2){
+		Error("forest-engine", "Usage: %s <weight-file>", argv[0]);
+		return 1;
+	}
+	const char* weightFilePath = argv[1];
+
+	ForestUtils::Forest forest;
+	if (!ForestUtils::readForest(weightFilePath, forest)){
+		return 1;
+	}
+	const Int_t nVariables = forest.variables.size();
+
+	// Grid of inputs, steps of 1/8 hit the cut values of the committed trees exactly
+	const Int_t nSteps = 33;
+	Long64_t nEvents = 1;
+	for (Int_t v = 0; v < nVariables; v++) nEvents *= nSteps;
+	std::vector<Float_t> inputs(nEvents*nVariables);
+	for (Long64_t i = 0; i < nEvents; i++){
+		Long64_t step = i;
+		for (Int_t v = 0; v < nVariables; v++, step /= nSteps) inputs[i*nVariables + v] = -2 + (step % nSteps)/8.f;
+	}
+	std::vector<Double_t> scores(nEvents);
+	ForestUtils::evaluate(forest, inputs.data(), nEvents, scores.data());
+
+	TMVA::Reader reader("!Color:Silent");
+	std::vector<Float_t> values(nVariables);
+	for (Int_t v = 0; v < nVariables; v++) reader.AddVariable(forest.variables[v], &values[v]);
+	if (!reader.BookMVA("BDT", weightFilePath)){
+		Error("forest-engine", "Cannot book \"%s\"", weightFilePath);
+		return 1;
+	}
+
+	Long64_t nMismatches = 0;
+	for (Long64_t i = 0; i < nEvents; i++){
+		std::copy(inputs.begin() + i*nVariables, inputs.begin() + (i + 1)*nVariables, values.begin());
+		Double_t reference = reader.EvaluateMVA("BDT");
+		if (scores[i] != reference){
+			if (nMismatches++ < 10) Error("forest-engine", "Event %lld: native %.17g, reader %.17g", i, scores[i], reference);
+		}
+	}
+	Info("forest-engine", "%lld of %lld scores differ from the TMVA reader", nMismatches, nEvents);
+
+	// Fisher cuts are not supported by the native engine, the forest must be rejected
+	TString fisherFilePath = TString::Format("%s/forest-engine-fisher.weights.xml", gSystem->TempDirectory());
+	if (!writeFisherCut(weightFilePath, fisherFilePath)){
+		Error("forest-engine", "Cannot write \"%s\"", fisherFilePath.Data());
+		return 1;
+	}
+	ForestUtils::Forest fisherForest;
+	Bool_t fisherRead = ForestUtils::readForest(fisherFilePath, fisherForest);
+	gSystem->Unlink(fisherFilePath);
+	if (fisherRead){
+		Error("forest-engine", "Forest with Fisher cuts is not rejected");
+		return 1;
+	}
+
+	return nMismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,54 @@
+// Writes BDT weight files with TMVA itself for the forest engine test: AdaBoost forest with the options of the 'train'
+// mode (yes/no leaves by default) and a gradient boosted forest. Both are trained on Gaussian signal and background
+// samples of three variables.
+// Usage: test-forest-train <output-dir>
+// Weight files: <output-dir>/forest/weights/forest_BDT.weights.xml and forest_BDTG.weights.xml
+
+#include <TError.h>
+#include <TFile.h>
+#include <TRandom3.h>
+#include <TSystem.h>
+#include <TMVA/DataLoader.h>
+#include <TMVA/Factory.h>
+#include <TMVA/Tools.h>
+
+#include <vector>
+
+int main(int argc, char* argv[]){
+	if (argc < 2){
+		Error("forest-train", "Usage: %s <output-dir>", argv[0]);
+		return 1;
+	}
+	gSystem->mkdir(argv[1], kTRUE);
+	if (!gSystem->ChangeDirectory(argv[1])){
+		Error("forest-train", "Cannot enter \"%s\"", argv[1]);
+		return 1;
+	}
+	TMVA::Tools::Instance();
+
+	const Int_t nVariables = 3;
+	const Int_t nEvents = 2000;
+	TMVA::DataLoader loader("forest");
+	for (Int_t v = 0; v < nVariables; v++) loader.AddVariable(TString::Format("var%d", v), 'F');
+
+	// Classes are shifted along every variable, test events are only needed by the DataLoader
+	TRandom3 random(100);
+	std::vector<Double_t> values(nVariables);
+	for (Int_t i = 0; i < nEvents; i++){
+		for (Int_t v = 0; v < nVariables; v++) values[v] = random.Gaus(0.5, 1);
+		if (i % 5) loader.AddSignalTrainingEvent(values); else loader.AddSignalTestEvent(values);
+		for (Int_t v = 0; v < nVariables; v++) values[v] = random.Gaus(-0.5, 1);
+		if (i % 5) loader.AddBackgroundTrainingEvent(values); else loader.AddBackgroundTestEvent(values);
+	}
+	loader.PrepareTrainingAndTestTree("", "", "SplitMode=Block:NormMode=NumEvents:!V:!CalcCorrelations");
+
+	TFile* outputFile = TFile::Open("forest.root", "RECREATE");
+	TMVA::Factory factory("forest", outputFile, "!V:Silent:!DrawProgressBar:AnalysisType=Classification");
+	factory.BookMethod(&loader, TMVA::Types::kBDT, "BDT", "!V:NTrees=400:MinNodeSize=2.5%:MaxDepth=2:BoostType=AdaBoost:AdaBoostBeta=0.5:"
+		"UseBaggedBoost:BaggedSampleFraction=0.5:SeparationType=GiniIndex:nCuts=20");
+	factory.BookMethod(&loader, TMVA::Types::kBDT, "BDTG", "!V:NTrees=100:MinNodeSize=2.5%:MaxDepth=3:BoostType=Grad:Shrinkage=0.1:"
+		"UseBaggedBoost:BaggedSampleFraction=0.5:nCuts=20");
+	factory.TrainAllMethods();
+	outputFile->Close();
+	return 0;
+}